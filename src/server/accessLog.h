@@ -0,0 +1,281 @@
+#ifndef ZALICZENIOWE1_ACCESSLOG_H
+#define ZALICZENIOWE1_ACCESSLOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../utils/httpRanges.h"
+
+/*
+ * Binary access log record: this fixed part followed by targetLength bytes of the request
+ * target and upstreamLength bytes of the correlated server ("ip:port") the request went to.
+ * */
+struct AccessRecord {
+    enum class Method : uint8_t {
+        Get, Head, Other
+    };
+    static constexpr size_t maxTargetLength = 2048;
+    static constexpr size_t maxUpstreamLength = UINT8_MAX;
+
+    // Wall clock time the request was handled at, in nanoseconds since the epoch.
+    uint64_t timestampNs;
+    // Time from handling the request until the whole response was queued.
+    uint64_t durationNs;
+    // Size of the response, headers included.
+    uint64_t bytes;
+    // 0 when the request couldn't be answered, e.g. a proxied response has broken off.
+    uint16_t status;
+    Method method;
+    uint8_t upstreamLength;
+    uint16_t targetLength;
+    uint16_t reserved;
+};
+
+// Record read back from a log file; target and upstream view into the file's contents.
+struct DecodedAccessRecord {
+    AccessRecord record;
+    std::string_view target;
+    std::string_view upstream;
+};
+
+// Request as it's logged, viewing into the request and the response being sent.
+struct AccessEntry {
+    std::string_view method;
+    std::string_view target;
+    std::string_view status;
+    std::string_view upstream;
+    uint64_t bytes = 0;
+    // WorkerMetrics::now() at which handling the request started.
+    uint64_t startedAt = 0;
+};
+
+/*
+ * Single-producer single-consumer ring of access log records: a worker appends, the log
+ * writer drains. Positions only grow and are published with release stores, so neither side
+ * ever waits for the other. A record which doesn't fit is dropped instead.
+ * */
+class AccessLogRing {
+public:
+    explicit AccessLogRing(size_t capacity = defaultCapacity) :
+            buffer(std::make_unique<char[]>(capacity)), capacity(capacity) {}
+
+    AccessLogRing(const AccessLogRing &) = delete;
+
+    AccessLogRing &operator=(const AccessLogRing &) = delete;
+
+    // Appends a record of the entry, ended at now (WorkerMetrics::now()). Returns false if it's been dropped.
+    bool record(const AccessEntry &entry, uint64_t now) {
+        AccessRecord record{};
+        timespec ts{};
+        clock_gettime(CLOCK_REALTIME, &ts);
+        record.durationNs = now - entry.startedAt;
+        record.timestampNs = ts.tv_sec * 1000000000ull + ts.tv_nsec - record.durationNs;
+        record.bytes = entry.bytes;
+        uint64_t status = 0;
+        httpRanges::parseNumber(entry.status, status);
+        record.status = std::min<uint64_t>(status, UINT16_MAX);
+        record.method = entry.method == "GET" ? AccessRecord::Method::Get
+                                              : entry.method == "HEAD" ? AccessRecord::Method::Head
+                                                                       : AccessRecord::Method::Other;
+        std::string_view target = entry.target.substr(0, AccessRecord::maxTargetLength);
+        std::string_view upstream = entry.upstream.substr(0, AccessRecord::maxUpstreamLength);
+        record.targetLength = target.size();
+        record.upstreamLength = upstream.size();
+
+        uint64_t position = head.load(std::memory_order_relaxed);
+        size_t size = sizeof(record) + target.size() + upstream.size();
+        if (position + size - cachedTail > capacity) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (position + size - cachedTail > capacity) {
+                return false;
+            }
+        }
+        copyIn(position, std::string_view(reinterpret_cast<const char *>(&record), sizeof(record)));
+        copyIn(position + sizeof(record), target);
+        copyIn(position + sizeof(record) + target.size(), upstream);
+        head.store(position + size, std::memory_order_release);
+        return true;
+    }
+
+    /*
+     * Passes all complete records appended so far to sink as at most two contiguous spans,
+     * then frees their space. Called by the consumer only. Returns the number of bytes drained.
+     * */
+    template<typename Sink>
+    size_t drain(Sink &&sink) {
+        uint64_t begin = tail.load(std::memory_order_relaxed);
+        uint64_t end = head.load(std::memory_order_acquire);
+        if (begin == end) {
+            return 0;
+        }
+        size_t offset = begin % capacity;
+        size_t first = std::min<uint64_t>(end - begin, capacity - offset);
+        sink(std::string_view(buffer.get() + offset, first),
+             std::string_view(buffer.get(), end - begin - first));
+        tail.store(end, std::memory_order_release);
+        return end - begin;
+    }
+
+private:
+    static constexpr size_t defaultCapacity = 1 << 20;
+
+    std::unique_ptr<char[]> buffer;
+    size_t capacity;
+    // Written by the producer only.
+    alignas(64) std::atomic<uint64_t> head{0};
+    uint64_t cachedTail = 0;
+    // Written by the consumer only.
+    alignas(64) std::atomic<uint64_t> tail{0};
+
+    void copyIn(uint64_t position, std::string_view bytes) {
+        size_t offset = position % capacity;
+        size_t first = std::min(bytes.size(), capacity - offset);
+        memcpy(buffer.get() + offset, bytes.data(), first);
+        memcpy(buffer.get(), bytes.data() + first, bytes.size() - first);
+    }
+};
+
+/*
+ * Access log of all workers, each recording into its own ring. A background thread drains
+ * the rings in batches into the file at path, rotated once it grows over maxFileBytes: the
+ * file becomes path.1, path.1 becomes path.2 and so on, up to keptFiles old files. Every
+ * file starts with fileMagic; decode() reads records back. Rings are added before serving starts.
+ * */
+class AccessLog {
+public:
+    static constexpr std::string_view fileMagic = "ZALOG001";
+    static constexpr int drainIntervalMs = 100;
+
+    explicit AccessLog(std::string path, uint64_t maxFileBytes = 64 << 20, unsigned keptFiles = 8) :
+            path(std::move(path)), maxFileBytes(maxFileBytes), keptFiles(keptFiles) {}
+
+    AccessLog(const AccessLog &) = delete;
+
+    AccessLog &operator=(const AccessLog &) = delete;
+
+    ~AccessLog() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    AccessLogRing &addWorker() {
+        return rings.emplace_back();
+    }
+
+    // Drains the rings every drainIntervalMs, forever. Meant to be run by a background thread.
+    void run() {
+        while (true) {
+            drain();
+            std::this_thread::sleep_for(std::chrono::milliseconds(drainIntervalMs));
+        }
+    }
+
+    /*
+     * Writes records of all rings to the file, rotating it first if it's full. Returns false if
+     * the file can't be written; the records are lost then, as the workers can't be held up.
+     * */
+    bool drain() {
+        if ((fd < 0 || written >= maxFileBytes) && !openNext()) {
+            for (AccessLogRing &ring : rings) {
+                ring.drain([](std::string_view, std::string_view) {});
+            }
+            return false;
+        }
+        bool ok = true;
+        for (AccessLogRing &ring : rings) {
+            ring.drain([this, &ok](std::string_view first, std::string_view second) {
+                uint64_t committed = written;
+                if (!writeAll(first) || !writeAll(second)) {
+                    ok = false;
+                    // A partly written batch would make the rest of the file undecodable.
+                    if (ftruncate(fd, committed) == 0) {
+                        written = committed;
+                    }
+                }
+            });
+        }
+        return ok;
+    }
+
+    /*
+     * Takes the next record off the front of data, which holds the contents of a log file
+     * after fileMagic. Returns nothing at the end of data or if what's left isn't a complete record.
+     * */
+    static std::optional<DecodedAccessRecord> decode(std::string_view &data) {
+        DecodedAccessRecord decoded{};
+        AccessRecord &record = decoded.record;
+        if (data.size() < sizeof(record)) {
+            return {};
+        }
+        memcpy(&record, data.data(), sizeof(record));
+        if (data.size() - sizeof(record) < size_t(record.targetLength) + record.upstreamLength) {
+            return {};
+        }
+        decoded.target = data.substr(sizeof(record), record.targetLength);
+        decoded.upstream = data.substr(sizeof(record) + record.targetLength, record.upstreamLength);
+        data.remove_prefix(sizeof(record) + record.targetLength + record.upstreamLength);
+        return decoded;
+    }
+
+private:
+    std::string path;
+    uint64_t maxFileBytes;
+    unsigned keptFiles;
+    std::deque<AccessLogRing> rings;
+    int fd = -1;
+    uint64_t written = 0;
+
+    bool writeAll(std::string_view bytes) {
+        while (!bytes.empty()) {
+            ssize_t len = write(fd, bytes.data(), bytes.size());
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len <= 0) {
+                return false;
+            }
+            written += len;
+            bytes.remove_prefix(len);
+        }
+        return true;
+    }
+
+    // Rotates a full file away, if there's one, and opens the file to write to, appending to a previous one.
+    bool openNext() {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+            for (unsigned i = keptFiles; i > 1; i--) {
+                rename((path + "." + std::to_string(i - 1)).c_str(), (path + "." + std::to_string(i)).c_str());
+            }
+            if (keptFiles > 0) {
+                rename(path.c_str(), (path + ".1").c_str());
+            } else {
+                unlink(path.c_str());
+            }
+        }
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            return false;
+        }
+        written = st.st_size;
+        return written > 0 || writeAll(fileMagic);
+    }
+};
+
+#endif //ZALICZENIOWE1_ACCESSLOG_H
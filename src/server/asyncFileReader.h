@@ -0,0 +1,244 @@
+#ifndef ZALICZENIOWE1_ASYNCFILEREADER_H
+#define ZALICZENIOWE1_ASYNCFILEREADER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "../utils/serverAssertions.h"
+#include "ioUring.h"
+#include "metrics.h"
+
+/*
+ * Reads file regions which aren't in the page cache without blocking the worker. Reads go to
+ * a fixed pool of buffers and are done by io_uring when the kernel allows it, or by a few helper
+ * threads otherwise. Reads requested while handling events are submitted together by submit(),
+ * and completions are signalled through an eventfd watched by the event loop.
+ * */
+class AsyncFileReader {
+public:
+    static constexpr size_t bufferSize = 128 * 1024;
+
+    // Whether a page of a file is in the page cache.
+    enum class Residency {
+        Cached, Cold, Unknown
+    };
+
+    struct Completion {
+        int socket;
+        uint64_t connectionId;
+        int buffer;
+        // Bytes read or -errno.
+        ssize_t result;
+        // WorkerMetrics::now() of the request.
+        uint64_t requestedAt;
+    };
+
+    explicit AsyncFileReader(size_t buffersNum = 32, bool useIoUring = true, size_t threadsNum = 2) :
+            buffersNum(buffersNum), requests(buffersNum) {
+        eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        exit_on_fail_with_errno(eventFd >= 0, "Eventfd() failed.");
+        memory = mmap(nullptr, buffersNum * bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        exit_on_fail_with_errno(memory != MAP_FAILED, "Mmap() failed.");
+        std::vector<iovec> buffers;
+        for (size_t i = 0; i < buffersNum; i++) {
+            buffers.push_back(iovec{bufferAt(i), bufferSize});
+            freeBuffers.push_back(buffersNum - 1 - i);
+        }
+        if (useIoUring) {
+            // Every read may take three entries: filling a file slot, the read and emptying the slot.
+            ring = std::make_unique<IoUring>(buffersNum * 3, eventFd);
+            if (ring->isValid()) {
+                ring->registerBuffers(buffers);
+                ring->registerFileSlots(buffersNum);
+                return;
+            }
+            ring.reset();
+        }
+        for (size_t i = 0; i < threadsNum; i++) {
+            threads.emplace_back([this]() { readInThread(); });
+        }
+    }
+
+    AsyncFileReader(const AsyncFileReader &) = delete;
+
+    AsyncFileReader &operator=(const AsyncFileReader &) = delete;
+
+    ~AsyncFileReader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        pendingChanged.notify_all();
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        ring.reset();
+        munmap(memory, buffersNum * bufferSize);
+        close(eventFd);
+    }
+
+    int getEventFd() const {
+        return eventFd;
+    }
+
+    bool usesIoUring() const {
+        return ring != nullptr;
+    }
+
+    // Tells whether the page holding offset is cached by reading a byte of it without waiting for the disk.
+    static Residency residencyOf(int fd, off_t offset) {
+        char byte;
+        iovec iov{&byte, 1};
+        if (preadv2(fd, &iov, 1, offset, RWF_NOWAIT) >= 0) {
+            return Residency::Cached;
+        }
+        return errno == EAGAIN ? Residency::Cold : Residency::Unknown;
+    }
+
+    /*
+     * Requests reading up to bufferSize bytes at offset of fd on behalf of a connection. The request
+     * is only submitted by submit(). Returns false if all buffers are busy.
+     * fdOwner, which keeps fd open, is held until the read completes: the connection may be closed
+     * meanwhile, and a descriptor closed before the read is done could be reused, e.g. for a socket.
+     * */
+    bool read(int fd, off_t offset, size_t length, int socket, uint64_t connectionId,
+              std::shared_ptr<const void> fdOwner = nullptr) {
+        if (freeBuffers.empty()) {
+            return false;
+        }
+        int buffer = freeBuffers.back();
+        freeBuffers.pop_back();
+        requests[buffer] = Request{fd, offset, std::min(length, bufferSize), socket, connectionId,
+                                   WorkerMetrics::now(), std::move(fdOwner)};
+        if (ring) {
+            ring->prepareRead(buffer, fd, bufferAt(buffer), requests[buffer].length, offset, buffer);
+        } else {
+            unsubmitted.push_back(buffer);
+        }
+        return true;
+    }
+
+    // Submits reads requested since the previous call at once.
+    void submit() {
+        if (ring) {
+            exit_on_fail_with_errno(ring->submit(), "Io_uring_enter() failed.");
+            return;
+        }
+        if (unsubmitted.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.insert(pending.end(), unsubmitted.begin(), unsubmitted.end());
+        }
+        unsubmitted.clear();
+        pendingChanged.notify_all();
+    }
+
+    /*
+     * Calls onCompletion(completion) for every finished read. The buffer stays taken until it's
+     * released; the callback may request new reads.
+     * */
+    template<typename OnCompletion>
+    void processCompletions(OnCompletion onCompletion) {
+        uint64_t signalled;
+        while (::read(eventFd, &signalled, sizeof(signalled)) > 0) {}
+        if (ring) {
+            ring->reap([this, &onCompletion](uint64_t buffer, int result) {
+                requests[buffer].fdOwner.reset();
+                onCompletion(completionOf(buffer, result));
+            });
+            return;
+        }
+        std::vector<std::pair<int, ssize_t>> finished;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.swap(done);
+        }
+        for (const auto &read : finished) {
+            requests[read.first].fdOwner.reset();
+            onCompletion(completionOf(read.first, read.second));
+        }
+    }
+
+    std::string_view data(int buffer, size_t length) const {
+        return std::string_view(static_cast<const char *>(bufferAt(buffer)), length);
+    }
+
+    void release(int buffer) {
+        freeBuffers.push_back(buffer);
+    }
+
+private:
+    struct Request {
+        int fd;
+        off_t offset;
+        size_t length;
+        int socket;
+        uint64_t connectionId;
+        uint64_t requestedAt;
+        std::shared_ptr<const void> fdOwner;
+    };
+
+    size_t buffersNum;
+    void *memory;
+    int eventFd;
+    std::unique_ptr<IoUring> ring;
+    std::vector<Request> requests;
+    std::vector<int> freeBuffers;
+    // Thread pool state; only pending, done and stopping are shared with the threads.
+    std::vector<std::thread> threads;
+    std::vector<int> unsubmitted;
+    std::mutex mutex;
+    std::condition_variable pendingChanged;
+    std::deque<int> pending;
+    std::vector<std::pair<int, ssize_t>> done;
+    bool stopping = false;
+
+    void *bufferAt(size_t buffer) const {
+        return static_cast<char *>(memory) + buffer * bufferSize;
+    }
+
+    Completion completionOf(int buffer, ssize_t result) const {
+        const Request &request = requests[buffer];
+        return Completion{request.socket, request.connectionId, buffer, result, request.requestedAt};
+    }
+
+    void readInThread() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            pendingChanged.wait(lock, [this]() { return stopping || !pending.empty(); });
+            if (stopping) {
+                return;
+            }
+            int buffer = pending.front();
+            pending.pop_front();
+            // Not copied with its owner, whose reference count is only touched by the worker.
+            const int fd = requests[buffer].fd;
+            const size_t length = requests[buffer].length;
+            const off_t offset = requests[buffer].offset;
+            lock.unlock();
+            ssize_t result = pread(fd, bufferAt(buffer), length, offset);
+            if (result < 0) {
+                result = -errno;
+            }
+            lock.lock();
+            done.emplace_back(buffer, result);
+            uint64_t one = 1;
+            ::write(eventFd, &one, sizeof(one));
+        }
+    }
+};
+
+#endif //ZALICZENIOWE1_ASYNCFILEREADER_H
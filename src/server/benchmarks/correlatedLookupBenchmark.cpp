@@ -0,0 +1,93 @@
+/*
+ * Compares lookups in CorrelatedIndex with the linear scan over the correlated files list
+ * it replaced, and loading of the correlated servers file with one and with all threads.
+ * Usage: ./correlated_bench [entries_num] [lookups_num]
+ * */
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+#include "../correlatedIndex.h"
+
+namespace {
+    std::vector<CorrelatedFile> generateFiles(size_t count) {
+        std::vector<CorrelatedFile> files;
+        files.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            files.emplace_back("/resources/dir" + std::to_string(i % 97) + "/file" + std::to_string(i) +
+                               "\t10.0.0." + std::to_string(i % 250) + "\t8080");
+        }
+        return files;
+    }
+
+    // Half of the targets exist, half are misses which have to scan the whole list.
+    std::vector<std::string> generateTargets(size_t entries, size_t count) {
+        std::mt19937 gen(42);
+        std::vector<std::string> targets;
+        for (size_t i = 0; i < count; i++) {
+            size_t n = gen() % (2 * entries);
+            targets.push_back("/resources/dir" + std::to_string(n % 97) + "/file" + std::to_string(n));
+        }
+        return targets;
+    }
+
+    void measureLoading(const std::vector<CorrelatedFile> &files) {
+        const std::string path = "/tmp/correlated_bench_servers.txt";
+        {
+            std::ofstream os(path);
+            for (const CorrelatedFile &f : files) {
+                os << f.resource << '\t' << f.ipAddress << '\t' << f.port << '\n';
+            }
+        }
+        for (unsigned threads : {1u, std::thread::hardware_concurrency()}) {
+            auto start = std::chrono::steady_clock::now();
+            CorrelatedIndex index = CorrelatedIndex::fromFile(path, threads);
+            auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "file load with " << threads << " threads: " << elapsed * 1e3 << " ms for "
+                      << index.size() << " entries" << std::endl;
+        }
+        std::remove(path.c_str());
+    }
+
+    template<typename Lookup>
+    void measure(const std::string &name, const std::vector<std::string> &targets, Lookup lookup) {
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const std::string &target : targets) {
+            found += lookup(target) != nullptr;
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ": " << targets.size() / elapsed << " lookups/s, "
+                  << elapsed * 1e9 / targets.size() << " ns/lookup (" << found << " found)" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t entries = argc > 1 ? std::stoul(argv[1]) : 200000;
+    size_t lookups = argc > 2 ? std::stoul(argv[2]) : 2000;
+    std::vector<CorrelatedFile> files = generateFiles(entries);
+    std::vector<std::string> targets = generateTargets(entries, lookups);
+
+    measure("linear scan", targets, [&files](const std::string &target) -> const CorrelatedFile * {
+        for (const CorrelatedFile &f : files) {
+            if (f.resource == target) {
+                return &f;
+            }
+        }
+        return nullptr;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    CorrelatedIndex index(files);
+    auto buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "index build: " << buildTime * 1e3 << " ms for " << entries << " entries" << std::endl;
+    std::vector<std::string> manyTargets;
+    for (size_t i = 0; i < 1000; i++) {
+        manyTargets.insert(manyTargets.end(), targets.begin(), targets.end());
+    }
+    measure("hash index", manyTargets, [&index](const std::string &target) {
+        return index.findRedirect(target) ? &target : nullptr;
+    });
+    measureLoading(files);
+}
@@ -0,0 +1,224 @@
+/*
+ * HTTP/1.1 load generator. Every connection is driven by its own thread and keeps
+ * pipeline_depth requests in flight, cycling through the given targets, so a mix of
+ * files, correlated resources and missing paths exercises 200, 302 and 404 responses.
+ * With -x every request is sent on a new connection with "Connection: close".
+ * Usage: ./load_generator [-c connections] [-p pipeline_depth] [-d seconds] [-x] host port target...
+ * */
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../../utils/serverAssertions.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        size_t connections = 4;
+        size_t pipelineDepth = 1;
+        double seconds = 5;
+        bool keepAlive = true;
+        sockaddr_in address{};
+        std::vector<std::string> targets;
+    };
+
+    struct Results {
+        size_t requests = 0;
+        size_t bytes = 0;
+        size_t errors = 0;
+        std::vector<uint32_t> latenciesUs;
+        std::map<std::string, size_t> statuses;
+    };
+
+    int connectTo(const sockaddr_in &address) {
+        int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        exit_on_fail_with_errno(sock >= 0, "Socket() failed.");
+        if (connect(sock, (const sockaddr *) &address, sizeof(address)) < 0) {
+            close(sock);
+            return -1;
+        }
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        // Bounds waiting for a stuck server, so the run still ends on time.
+        timeval timeout{1, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        return sock;
+    }
+
+    /*
+     * Length of the first complete response in buffer, 0 if it isn't complete yet.
+     * Responses without Content-Length have no body, as all of the server's errors.
+     * */
+    size_t completeResponse(const std::string &buffer, bool &closes) {
+        size_t headerEnd = buffer.find("\r\n\r\n");
+        if (headerEnd == std::string::npos) {
+            return 0;
+        }
+        std::string header = buffer.substr(0, headerEnd);
+        std::transform(header.begin(), header.end(), header.begin(), [](unsigned char c) { return std::tolower(c); });
+        size_t contentLength = 0;
+        size_t field = header.find("\r\ncontent-length:");
+        if (field != std::string::npos) {
+            contentLength = std::stoul(header.substr(field + 17));
+        }
+        closes = header.find("\r\nconnection: close") != std::string::npos;
+        size_t total = headerEnd + 4 + contentLength;
+        return buffer.size() >= total ? total : 0;
+    }
+
+    void runConnection(const Options &options, size_t id, Clock::time_point deadline, Results &results) {
+        std::string buffer;
+        std::deque<Clock::time_point> inFlight;
+        size_t nextTarget = id;
+        int sock = -1;
+        char chunk[64 * 1024];
+        while (Clock::now() < deadline) {
+            if (sock < 0 && (sock = connectTo(options.address)) < 0) {
+                results.errors++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+            std::string requests;
+            size_t depth = options.keepAlive ? options.pipelineDepth : 1;
+            while (inFlight.size() < depth) {
+                requests += "GET " + options.targets[nextTarget++ % options.targets.size()] + " HTTP/1.1\r\n";
+                requests += options.keepAlive ? "\r\n" : "Connection: close\r\n\r\n";
+                inFlight.push_back(Clock::now());
+            }
+            if (!requests.empty() && send(sock, requests.data(), requests.size(), MSG_NOSIGNAL) !=
+                                     (ssize_t) requests.size()) {
+                results.errors++;
+                close(sock);
+                sock = -1;
+                inFlight.clear();
+                buffer.clear();
+                continue;
+            }
+            ssize_t len = recv(sock, chunk, sizeof(chunk), 0);
+            bool broken = len <= 0;
+            if (len > 0) {
+                buffer.append(chunk, len);
+                results.bytes += len;
+            }
+            bool closes = false;
+            size_t responseLength;
+            while (!inFlight.empty() && (responseLength = completeResponse(buffer, closes)) > 0) {
+                auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - inFlight.front());
+                results.latenciesUs.push_back(latency.count());
+                results.statuses[buffer.substr(9, 3)]++;
+                results.requests++;
+                inFlight.pop_front();
+                buffer.erase(0, responseLength);
+                if (closes) {
+                    break;
+                }
+            }
+            if (broken || closes) {
+                results.errors += broken && options.keepAlive;
+                close(sock);
+                sock = -1;
+                inFlight.clear();
+                buffer.clear();
+            }
+        }
+        if (sock >= 0) {
+            close(sock);
+        }
+    }
+
+    uint32_t percentile(std::vector<uint32_t> &sorted, double fraction) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        return sorted[std::min(sorted.size() - 1, (size_t) (fraction * sorted.size()))];
+    }
+
+    [[noreturn]] void usage() {
+        std::cerr << "Usage: ./load_generator [-c connections] [-p pipeline_depth] [-d seconds] [-x] "
+                     "host port target..." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:p:d:x")) != -1) {
+        switch (opt) {
+            case 'c':
+                options.connections = std::max(1ul, std::stoul(optarg));
+                break;
+            case 'p':
+                options.pipelineDepth = std::max(1ul, std::stoul(optarg));
+                break;
+            case 'd':
+                options.seconds = std::stod(optarg);
+                break;
+            case 'x':
+                options.keepAlive = false;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (argc - optind < 3) {
+        usage();
+    }
+    addrinfo hints{}, *resolved;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    exit_on_fail(getaddrinfo(argv[optind], argv[optind + 1], &hints, &resolved) == 0, "Cannot resolve host.");
+    options.address = *reinterpret_cast<sockaddr_in *>(resolved->ai_addr);
+    freeaddrinfo(resolved);
+    options.targets.assign(argv + optind + 2, argv + argc);
+
+    std::vector<Results> results(options.connections);
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    for (size_t i = 0; i < options.connections; i++) {
+        threads.emplace_back(runConnection, std::cref(options), i, deadline, std::ref(results[i]));
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Results total;
+    for (Results &r : results) {
+        total.requests += r.requests;
+        total.bytes += r.bytes;
+        total.errors += r.errors;
+        total.latenciesUs.insert(total.latenciesUs.end(), r.latenciesUs.begin(), r.latenciesUs.end());
+        for (const auto &status : r.statuses) {
+            total.statuses[status.first] += status.second;
+        }
+    }
+    std::sort(total.latenciesUs.begin(), total.latenciesUs.end());
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "connections: " << options.connections << ", pipeline depth: " << options.pipelineDepth
+              << (options.keepAlive ? "" : ", no keep-alive") << ", duration: " << elapsed << " s" << std::endl;
+    std::cout << "requests: " << total.requests << " (" << total.requests / elapsed << " req/s), "
+              << total.bytes / elapsed / (1 << 20) << " MiB/s, errors: " << total.errors << std::endl;
+    std::cout << "latency us: p50 " << percentile(total.latenciesUs, 0.5) << ", p99 "
+              << percentile(total.latenciesUs, 0.99) << ", p999 " << percentile(total.latenciesUs, 0.999)
+              << ", max " << (total.latenciesUs.empty() ? 0 : total.latenciesUs.back()) << std::endl;
+    std::cout << "statuses:";
+    for (const auto &status : total.statuses) {
+        std::cout << ' ' << status.first << ": " << status.second;
+    }
+    std::cout << std::endl;
+}
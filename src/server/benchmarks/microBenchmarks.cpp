@@ -0,0 +1,79 @@
+/*
+ * Microbenchmarks of the per-request work done before a response is queued: parsing of
+ * the start line and of a whole request, path validation and correlated server lookup.
+ * Usage: ./micro_bench [iterations] [files_directory]
+ * */
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+
+#include "../../utils/httpParsers.h"
+#include "../../utils/pathUtils.h"
+#include "../correlatedIndex.h"
+
+namespace {
+    // Keeps the compiler from optimizing the measured call away.
+    volatile size_t sink;
+
+    template<typename Operation>
+    void measure(const std::string &name, size_t iterations, Operation operation) {
+        size_t accumulated = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            accumulated += operation(i);
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        sink = accumulated;
+        std::cout << name << ": " << elapsed * 1e9 / iterations << " ns/op, " << iterations / elapsed
+                  << " ops/s" << std::endl;
+    }
+
+    std::vector<CorrelatedFile> generateFiles(size_t count) {
+        std::vector<CorrelatedFile> files;
+        for (size_t i = 0; i < count; i++) {
+            files.emplace_back("/resources/file" + std::to_string(i) + "\t10.0.0." + std::to_string(i % 250) +
+                               "\t8080");
+        }
+        return files;
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t iterations = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    std::string filesDirectory = argc > 2 ? argv[2] : "/tmp";
+
+    const std::string startLine = "GET /some/directory/file.txt HTTP/1.1";
+    measure("StartLine::validateString", iterations, [&](size_t) {
+        return StartLine::validateString(startLine).has_value();
+    });
+
+    const std::vector<std::string_view> request = {startLine, "Host: localhost", "Connection: keep-alive",
+                                                   "Content-Length: 0", "User-Agent: micro_bench"};
+    RequestArena arena;
+    measure("HttpMessage::validateHttpRequest", iterations, [&](size_t) {
+        arena.reset();
+        return HttpMessage::validateHttpRequest(request, arena).has_value();
+    });
+
+    measure("validatePath", iterations / 10, [&](size_t) {
+        return validatePath(filesDirectory, "/some/directory/../file.txt");
+    });
+
+    PathResolver resolver(filesDirectory);
+    measure("PathResolver::open", iterations / 10, [&](size_t) {
+        int fd = resolver.open("/some/directory/file.txt");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return fd >= 0;
+    });
+
+    CorrelatedIndex index(generateFiles(100000));
+    std::vector<std::string> targets;
+    for (size_t i = 0; i < 1024; i++) {
+        targets.push_back("/resources/file" + std::to_string(i * 193)); // Half of them are misses.
+    }
+    measure("CorrelatedIndex::findRedirect", iterations, [&](size_t i) {
+        return index.findRedirect(targets[i % targets.size()]).has_value();
+    });
+}
@@ -0,0 +1,38 @@
+#!/bin/bash
+# Runs microbenchmarks, then serves a generated fixture directory with ./serwer and
+# loads it with a mix of 200, 302 and 404 requests, with and without pipelining.
+# Usage: src/server/benchmarks/runBenchmarks.sh [seconds_per_run] [port]
+set -e
+
+SECONDS_PER_RUN=${1:-5}
+PORT=${2:-18080}
+FIXTURE=$(mktemp -d /tmp/serwer_bench.XXXXXX)
+trap 'kill $SERVER_PID 2>/dev/null; rm -rf "$FIXTURE"' EXIT
+
+mkdir -p "$FIXTURE/files/dir"
+head -c 512 /dev/urandom > "$FIXTURE/files/small.bin"
+head -c 65536 /dev/urandom > "$FIXTURE/files/dir/medium.bin"
+head -c 1048576 /dev/urandom > "$FIXTURE/files/large.bin"
+for i in $(seq 1 1000); do
+    printf '/remote/%d\t10.0.0.%d\t8080\n' "$i" "$((i % 250))"
+done > "$FIXTURE/correlated.txt"
+
+./micro_bench 1000000 "$FIXTURE/files"
+./correlated_bench
+
+# Every scenario gets a freshly started server, so the runs don't influence each other.
+run() {
+    echo "== $1"
+    shift
+    ./serwer "$FIXTURE/files" "$FIXTURE/correlated.txt" "$PORT" &
+    SERVER_PID=$!
+    sleep 0.5
+    ./load_generator -d "$SECONDS_PER_RUN" "$@" 127.0.0.1 "$PORT" $TARGETS
+    kill $SERVER_PID 2>/dev/null || true
+    wait $SERVER_PID 2>/dev/null || true
+}
+
+TARGETS="/small.bin /small.bin /dir/medium.bin /remote/17 /remote/404 /missing /large.bin"
+run "keep-alive" -c 8
+run "keep-alive, pipeline depth 16" -c 8 -p 16
+run "new connection per request" -c 8 -x
@@ -0,0 +1,589 @@
+#ifndef ZALICZENIOWE1_CONNECTION_H
+#define ZALICZENIOWE1_CONNECTION_H
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <string>
+#include <utility>
+#include <vector>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "../utils/receiveBuffer.h"
+#include "../utils/requestArena.h"
+#include "asyncFileReader.h"
+#include "tlsSession.h"
+#include "upstreamExchange.h"
+
+/*
+ * Single piece of a response waiting to be written: bytes owned by the chunk, external
+ * bytes of header and body kept alive by a shared owner (e.g. a cached response) or
+ * outliving the connection, or a region of an open file. Chunk owns the file descriptor
+ * unless it has an owner.
+ * */
+struct OutputChunk {
+    std::string data;
+    size_t dataOffset = 0;
+    bool external = false;
+    std::shared_ptr<const void> owner;
+    std::string_view segments[2];
+    int fileFd = -1;
+    off_t fileOffset = 0;
+    size_t fileRemaining = 0;
+};
+
+/*
+ * FIFO of output chunks kept in a ring of slots which only ever grows, so once it fits the
+ * usual number of pipelined responses, queueing doesn't allocate. Popped slots keep the
+ * memory of their data for chunks composed in place later.
+ * */
+class OutputQueue {
+public:
+    // Adds an empty chunk at the back. References to other chunks may be invalidated.
+    OutputChunk &push() {
+        if (count == slots.size()) {
+            grow();
+        }
+        return slots[(head + count++) & (slots.size() - 1)];
+    }
+
+    OutputChunk &front() {
+        return slots[head];
+    }
+
+    OutputChunk &operator[](size_t i) {
+        return slots[(head + i) & (slots.size() - 1)];
+    }
+
+    const OutputChunk &operator[](size_t i) const {
+        return slots[(head + i) & (slots.size() - 1)];
+    }
+
+    void pop_front() {
+        OutputChunk &chunk = slots[head];
+        std::string data = std::move(chunk.data);
+        chunk = OutputChunk();
+        chunk.data = std::move(data);
+        chunk.data.clear();
+        head = (head + 1) & (slots.size() - 1);
+        count--;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+private:
+    static constexpr size_t initialSlots = 4;
+
+    // Power of two long, so positions wrap around with a mask.
+    std::vector<OutputChunk> slots;
+    size_t head = 0;
+    size_t count = 0;
+
+    void grow() {
+        std::vector<OutputChunk> grown(std::max(initialSlots, slots.size() * 2));
+        for (size_t i = 0; i < count; i++) {
+            grown[i] = std::move((*this)[i]);
+        }
+        slots = std::move(grown);
+        head = 0;
+    }
+};
+
+// Descriptor shared by several queued file chunks, closed once all of them are gone.
+struct SharedDescriptor {
+    explicit SharedDescriptor(int fd) : fd(fd) {}
+
+    SharedDescriptor(const SharedDescriptor &) = delete;
+
+    SharedDescriptor &operator=(const SharedDescriptor &) = delete;
+
+    ~SharedDescriptor() {
+        ::close(fd);
+    }
+
+    int fd;
+};
+
+/*
+ * State of one client connection served by the event loop: bytes read but not
+ * yet framed into requests, framing state and responses waiting to be written.
+ * */
+class Connection {
+public:
+    explicit Connection(int socket) : socket(socket) {}
+
+    Connection(const Connection &) = delete;
+
+    Connection &operator=(const Connection &) = delete;
+
+    ~Connection() {
+        if (readAheadBuffer >= 0) {
+            fileReader->release(readAheadBuffer);
+        }
+        for (size_t i = 0; i < output.size(); i++) {
+            const OutputChunk &chunk = output[i];
+            if (chunk.fileFd >= 0 && !chunk.owner) {
+                ::close(chunk.fileFd);
+            }
+        }
+        if (pipeFds[0] >= 0) {
+            ::close(pipeFds[0]);
+            ::close(pipeFds[1]);
+        }
+        tls.reset(); // Its close_notify goes out before the socket is closed.
+        ::close(socket);
+    }
+
+    int getSocket() const {
+        return socket;
+    }
+
+    ReceiveBuffer &getInput() {
+        return input;
+    }
+
+    // Makes the connection speak TLS; nothing is read or written until the handshake is done.
+    void setTls(std::unique_ptr<TlsSession> session) {
+        tls = std::move(session);
+    }
+
+    // Whether responses are encrypted, and so file bodies read, by the process rather than the kernel.
+    bool encryptsInUserspace() const {
+        return encryptInUserspace;
+    }
+
+    bool isHandshaking() const {
+        return tls && !tls->isEstablished();
+    }
+
+    const TlsSession *getTls() const {
+        return tls.get();
+    }
+
+    /*
+     * Carries on with the TLS handshake. Once it's done, responses are written straight to the
+     * socket if the kernel encrypts them, so that file bodies are still sent with sendfile().
+     * */
+    TlsSession::Status continueHandshake() {
+        TlsSession::Status status = tls->handshake();
+        if (status == TlsSession::Status::Done) {
+            encryptInUserspace = !tls->sendsInKernel();
+        }
+        return status;
+    }
+
+    // Reads like read() from the socket, decrypting if the connection speaks TLS.
+    ssize_t receive(char *buffer, size_t length) {
+        return tls ? tls->read(buffer, length) : ::read(socket, buffer, length);
+    }
+
+    // Whether received bytes wait in the TLS session, which polling the socket wouldn't report.
+    bool hasBufferedInput() const {
+        return tls && tls->hasPendingInput();
+    }
+
+    const ReceiveBuffer &getInput() const {
+        return input;
+    }
+
+    void queue(std::string data) {
+        output.push().data = std::move(data);
+    }
+
+    /*
+     * Queues an empty in-memory chunk and returns its data, to be composed in place before anything
+     * else is queued. Its memory is reused from earlier chunks, so small responses don't allocate.
+     * */
+    std::string &queueText() {
+        return output.push().data;
+    }
+
+    /*
+     * Header and body are sent together with a single writev(). Owner keeps them alive until
+     * they are written; it may be null for bytes guaranteed to outlive the connection.
+     * */
+    void queueShared(std::shared_ptr<const void> owner, std::string_view header, std::string_view body) {
+        OutputChunk &chunk = output.push();
+        chunk.external = true;
+        chunk.owner = std::move(owner);
+        chunk.segments[0] = header;
+        chunk.segments[1] = body;
+    }
+
+    void queueFile(int fd, off_t offset, size_t length, std::shared_ptr<const void> owner = nullptr) {
+        OutputChunk &chunk = output.push();
+        chunk.owner = std::move(owner);
+        chunk.fileFd = fd;
+        chunk.fileOffset = offset;
+        chunk.fileRemaining = length;
+    }
+
+    bool hasPendingOutput() const {
+        return !output.empty();
+    }
+
+    // Number of chunks queued and not yet sent, to be passed to bytesQueuedSince() later.
+    size_t queuedChunks() const {
+        return output.size();
+    }
+
+    // Bytes queued since there were firstChunk chunks, as long as nothing has been sent meanwhile.
+    uint64_t bytesQueuedSince(size_t firstChunk) const {
+        uint64_t bytes = 0;
+        for (size_t i = firstChunk; i < output.size(); i++) {
+            const OutputChunk &chunk = output[i];
+            bytes += chunk.external ? chunk.segments[0].size() + chunk.segments[1].size()
+                                    : chunk.data.size() - chunk.dataOffset + chunk.fileRemaining;
+        }
+        return bytes;
+    }
+
+    // Lets file regions missing from the page cache be read by reader instead of blocking in sendfile().
+    void setFileReader(AsyncFileReader *reader) {
+        fileReader = reader;
+    }
+
+    // Whether sending waits for the file reader; the socket doesn't need to be polled meanwhile.
+    bool isWaitingForFile() const {
+        return readInFlight;
+    }
+
+    /*
+     * Takes the result of reading the file region about to be sent, which is sent from
+     * the reader's buffer. Returns false if the file couldn't be read.
+     * */
+    bool completeFileRead(int buffer, ssize_t result) {
+        readInFlight = false;
+        if (result <= 0) {
+            fileReader->release(buffer);
+            return false;
+        }
+        readAheadBuffer = buffer;
+        readAhead = fileReader->data(buffer, result);
+        return true;
+    }
+
+    /*
+     * Writes as much of the queued output as the socket accepts without blocking.
+     * Consecutive in-memory chunks, e.g. responses to pipelined requests, are gathered
+     * into a single sendmsg(); partially written chunks are resumed on the next call.
+     * File regions are sent straight from the page cache with sendfile(), falling back
+     * to splice() through a pipe and finally to pread() + send(). With a file reader, parts
+     * of regions which aren't in the page cache are read by it first, and sending stops
+     * until the read completes. When TLS records are encrypted in userspace, chunks are written one
+     * segment at a time and files are copied. Returns false if the connection is broken and should be dropped.
+     * */
+    bool flush() {
+        while (!output.empty() && !readInFlight) {
+            OutputChunk &chunk = output.front();
+            if (chunk.fileFd < 0) {
+                if (writeGathered() < 0) {
+                    return errno == EAGAIN || errno == EWOULDBLOCK;
+                }
+                continue;
+            }
+            if (chunk.fileRemaining > 0) {
+                ssize_t sent = sendFilePart(chunk);
+                if (sent < 0) {
+                    return errno == EAGAIN || errno == EWOULDBLOCK;
+                }
+                if (sent == 0 && !readInFlight) { // File has been truncated in the meantime.
+                    return false;
+                }
+                continue;
+            }
+            if (!chunk.owner) {
+                ::close(chunk.fileFd);
+            }
+            output.pop_front();
+            residentEnd = 0;
+        }
+        return true;
+    }
+
+    // Returns number of bytes written to the socket since the previous call.
+    uint64_t takeSentBytes() {
+        return std::exchange(sentBytes, 0);
+    }
+
+    void setCloseAfterFlush() {
+        closeAfterFlush = true;
+    }
+
+    bool shouldCloseAfterFlush() const {
+        return closeAfterFlush;
+    }
+
+    // Whether the response being produced comes from a correlated server; later requests wait for it.
+    bool isWaitingForUpstream() const {
+        return upstream != nullptr;
+    }
+
+    // Events the event loop currently waits for on this socket.
+    uint32_t pollEvents = 0;
+
+    /*
+     * Timeout state, in milliseconds of TimerWheel::clockMs(). requestStart is when the first
+     * byte of the request being read arrived, lastProgress when anything was last read or
+     * written. scheduledDeadline is the deadline of the connection's live timer, 0 if none.
+     * */
+    uint64_t id = 0;
+    uint64_t requestStart = 0;
+    uint64_t lastProgress = 0;
+    uint64_t scheduledDeadline = 0;
+
+    /*
+     * Framing state of the request being currently read. Lines are kept as [begin, end)
+     * offsets into the input, as the buffer may move when more data arrives.
+     * scanOffset is the position from which searching for the next "\r\n" continues.
+     * */
+    size_t scanOffset = 0;
+    std::vector<std::pair<size_t, size_t>> requestLines;
+    std::vector<std::string_view> httpRequestTokens;
+    // Memory of the request being handled, e.g. its lowercased header fields; reset after each request.
+    RequestArena arena;
+
+    // Request proxied to a correlated server, prepared by the handler and carried out by the event loop.
+    std::unique_ptr<UpstreamExchange> upstream;
+
+private:
+    static constexpr size_t fileChunkSize = 64 * 1024;
+    static constexpr size_t tlsRecordSize = 16 * 1024;
+    static constexpr size_t sendfileChunkSize = 1 << 30;
+    static constexpr int maxGatheredSegments = 64;
+
+    enum class FileSendMethod {
+        Sendfile, Splice, Copy
+    };
+
+    int socket;
+    ReceiveBuffer input;
+    OutputQueue output;
+    bool closeAfterFlush = false;
+    FileSendMethod fileSendMethod = FileSendMethod::Sendfile;
+    int pipeFds[2] = {-1, -1};
+    size_t bytesInPipe = 0;
+    uint64_t sentBytes = 0;
+    AsyncFileReader *fileReader = nullptr;
+    bool readInFlight = false;
+    // Offset in the front file chunk up to which its file is known to be in the page cache.
+    off_t residentEnd = 0;
+    // Beginning of the front file chunk read by the file reader, still in its buffer.
+    int readAheadBuffer = -1;
+    std::string_view readAhead;
+    std::unique_ptr<TlsSession> tls;
+    bool encryptInUserspace = false;
+
+    // Sends like send(), through the TLS session if records aren't encrypted by the kernel.
+    ssize_t sendBytes(const char *data, size_t length, int flags) {
+        return encryptInUserspace ? tls->write(data, length) : send(socket, data, length, flags);
+    }
+
+    /*
+     * Writes in-memory chunks from the front of the queue with one sendmsg() and drops
+     * those written completely. Returns number of bytes written or -1 with errno set.
+     * */
+    ssize_t writeGathered() {
+        iovec iov[maxGatheredSegments];
+        int count = 0;
+        size_t chunks = 0;
+        for (; chunks < output.size() && output[chunks].fileFd < 0; chunks++) {
+            if (!appendSegments(output[chunks], iov, count)) {
+                break;
+            }
+        }
+        ssize_t written = 0;
+        if (count > 0) {
+            msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            // Headers followed by a file body are held back by the kernel to share a segment.
+            int flags = MSG_NOSIGNAL;
+            if (chunks < output.size() && output[chunks].fileRemaining > 0) {
+                flags |= MSG_MORE;
+            }
+            written = encryptInUserspace ? tls->write(static_cast<const char *>(iov[0].iov_base), iov[0].iov_len)
+                                         : sendmsg(socket, &msg, flags);
+            if (written < 0) {
+                return -1;
+            }
+        }
+        sentBytes += written;
+        size_t left = written;
+        while (!output.empty() && output.front().fileFd < 0) {
+            OutputChunk &chunk = output.front();
+            size_t pending = pendingBytes(chunk);
+            if (left < pending) {
+                chunk.dataOffset += left;
+                break;
+            }
+            left -= pending;
+            output.pop_front();
+        }
+        return written;
+    }
+
+    // Adds unwritten parts of an in-memory chunk to iov, unless there's no room for all of them.
+    static bool appendSegments(const OutputChunk &chunk, iovec *iov, int &count) {
+        std::string_view segments[2] = {chunk.data, {}};
+        if (chunk.external) {
+            segments[0] = chunk.segments[0];
+            segments[1] = chunk.segments[1];
+        }
+        if (count + 2 > maxGatheredSegments) {
+            return false;
+        }
+        size_t skip = chunk.dataOffset;
+        for (std::string_view segment : segments) {
+            if (skip >= segment.size()) {
+                skip -= segment.size();
+                continue;
+            }
+            iov[count].iov_base = const_cast<char *>(segment.data() + skip);
+            iov[count].iov_len = segment.size() - skip;
+            count++;
+            skip = 0;
+        }
+        return true;
+    }
+
+    static size_t pendingBytes(const OutputChunk &chunk) {
+        size_t size = chunk.external ? chunk.segments[0].size() + chunk.segments[1].size() : chunk.data.size();
+        return size - chunk.dataOffset;
+    }
+
+    /*
+     * Sends next part of a file region: bytes already read by the file reader or, once the
+     * page cache holds the next window of the file, the file itself. A window which isn't
+     * in the page cache is given to the file reader and 0 is returned; if the reader has no
+     * free buffer, the window is sent anyway. Returns like sendFileRegion().
+     * */
+    ssize_t sendFilePart(OutputChunk &chunk) {
+        if (!readAhead.empty()) {
+            int flags = MSG_NOSIGNAL | (chunk.fileRemaining > readAhead.size() ? MSG_MORE : 0);
+            ssize_t sent = sendBytes(readAhead.data(), readAhead.size(), flags);
+            if (sent < 0) {
+                return -1;
+            }
+            advance(chunk, sent);
+            readAhead.remove_prefix(sent);
+            if (readAhead.empty()) {
+                fileReader->release(std::exchange(readAheadBuffer, -1));
+            }
+            return sent;
+        }
+        if (fileReader == nullptr) {
+            return sendFileRegion(chunk, chunk.fileRemaining);
+        }
+        if (chunk.fileOffset >= residentEnd) {
+            size_t window = std::min(AsyncFileReader::bufferSize, chunk.fileRemaining);
+            // Pages are read ahead in order, so the last one of the window stands for all of them.
+            switch (AsyncFileReader::residencyOf(chunk.fileFd, chunk.fileOffset + window - 1)) {
+                case AsyncFileReader::Residency::Cold:
+                    if (fileReader->read(chunk.fileFd, chunk.fileOffset, window, socket, id, chunk.owner)) {
+                        readInFlight = true;
+                        return 0;
+                    }
+                    break;
+                case AsyncFileReader::Residency::Unknown: // Filesystem can't tell.
+                    residentEnd = chunk.fileOffset + chunk.fileRemaining;
+                    break;
+                case AsyncFileReader::Residency::Cached:
+                    break;
+            }
+            residentEnd = std::max<off_t>(residentEnd, chunk.fileOffset + window);
+        }
+        return sendFileRegion(chunk, residentEnd - chunk.fileOffset);
+    }
+
+    /*
+     * Sends next part, at most limit bytes, of a file region. Returns number of file bytes
+     * sent, 0 on unexpected end of file and -1 with errno set on error.
+     * */
+    ssize_t sendFileRegion(OutputChunk &chunk, size_t limit) {
+        if (encryptInUserspace) {
+            return copyFileRegion(chunk, limit);
+        }
+        if (fileSendMethod == FileSendMethod::Sendfile) {
+            off_t offset = chunk.fileOffset;
+            ssize_t sent = sendfile(socket, chunk.fileFd, &offset, std::min(sendfileChunkSize, limit));
+            if (sent >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+                advance(chunk, sent);
+                return sent;
+            }
+            fileSendMethod = FileSendMethod::Splice;
+        }
+        if (fileSendMethod == FileSendMethod::Splice) {
+            ssize_t sent = spliceFileRegion(chunk, limit);
+            if (sent >= 0 || (errno != EINVAL && errno != ENOSYS)) {
+                return sent;
+            }
+            fileSendMethod = FileSendMethod::Copy;
+        }
+        return copyFileRegion(chunk, limit);
+    }
+
+    ssize_t spliceFileRegion(OutputChunk &chunk, size_t limit) {
+        if (pipeFds[0] < 0 && pipe2(pipeFds, O_NONBLOCK | O_CLOEXEC) < 0) {
+            return -1;
+        }
+        if (bytesInPipe == 0) {
+            off_t offset = chunk.fileOffset;
+            ssize_t filled = splice(chunk.fileFd, &offset, pipeFds[1], nullptr,
+                                    std::min(fileChunkSize, limit), SPLICE_F_MOVE);
+            if (filled <= 0) {
+                return filled;
+            }
+            bytesInPipe = filled;
+        }
+        unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+        if (chunk.fileRemaining > bytesInPipe) {
+            flags |= SPLICE_F_MORE;
+        }
+        ssize_t sent = splice(pipeFds[0], nullptr, socket, nullptr, bytesInPipe, flags);
+        if (sent < 0) {
+            return -1;
+        }
+        bytesInPipe -= sent;
+        advance(chunk, sent);
+        return sent;
+    }
+
+    ssize_t copyFileRegion(OutputChunk &chunk, size_t limit) {
+        char buffer[fileChunkSize];
+        // A TLS record takes at most 16 KiB, and the session writes one at a time.
+        size_t size = encryptInUserspace ? tlsRecordSize : fileChunkSize;
+        ssize_t bytesRead = pread(chunk.fileFd, buffer, std::min(size, limit), chunk.fileOffset);
+        if (bytesRead <= 0) {
+            return bytesRead;
+        }
+        ssize_t written = sendBytes(buffer, bytesRead, MSG_NOSIGNAL);
+        if (written < 0) {
+            return -1;
+        }
+        advance(chunk, written);
+        return written;
+    }
+
+    void advance(OutputChunk &chunk, ssize_t bytes) {
+        if (bytes > 0) {
+            sentBytes += bytes;
+            chunk.fileOffset += bytes;
+            chunk.fileRemaining -= bytes;
+        }
+    }
+};
+
+#endif //ZALICZENIOWE1_CONNECTION_H
@@ -2,117 +2,199 @@
 #define ZALICZENIOWE1_CONNECTIONHANDLER_H
 
 #include <vector>
-#include <fstream>
-#include <sstream>
 #include <iostream>
-#include <filesystem>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "../utils/serverAssertions.h"
+#include "../utils/gzipCompressor.h"
+#include "../utils/httpEncodings.h"
 #include "../utils/httpParsers.h"
+#include "../utils/httpRanges.h"
 #include "../utils/pathUtils.h"
+#include "../utils/crlfScanner.h"
+#include "connection.h"
+#include "contentPack.h"
+#include "correlatedTable.h"
+#include "targetFilter.h"
+#include "upstreamExchange.h"
+#include "upstreams.h"
+#include "workerContext.h"
 
-struct CorrelatedFile {
-    CorrelatedFile(const std::string &s) {
-        std::istringstream ss(s);
-        std::string substr;
-        std::vector<std::string> tokens;
-        while (getline(ss, substr, '\t')) {
-            tokens.push_back(substr);
-        }
-        exit_on_fail(tokens.size() == 3, "Bad servers file format");
-        resource = tokens[0];
-        ipAddress = tokens[1];
-        port = tokens[2];
-    }
-
-    bool operator==(const CorrelatedFile &cf) {
-        return resource == cf.resource && ipAddress == cf.ipAddress && port == cf.port;
-    }
-
-    std::string toString() const {
-        return "http://" + ipAddress + ":" + port + resource;
-    }
-
-    std::string resource;
-    std::string ipAddress;
-    std::string port;
+// How resources of correlated servers are served.
+enum class CorrelatedMode {
+    // With a redirect to the server.
+    Redirect,
+    // Fetched from the server, with a redirect while the server is down.
+    ProxyElseRedirect,
+    // Fetched from the server, with 404 while the server is down.
+    ProxyElseNotFound
 };
 
 class ConnectionHandler {
 public:
-    ConnectionHandler(const std::string &filesDirectory, const std::string &correlatedServersFile) : filesDir(
-            filesDirectory) {
-        std::ifstream is(correlatedServersFile);
-        std::string line;
-
-        while (std::getline(is, line)) {
-            correlatedFiles.emplace_back(line);
-        }
-        exit_on_fail(is.eof(), "Cannot read file " + correlatedServersFile);
-    }
-
-    void handleIncomingConnection(int socket) {
-        bool hasClosedConnection = false;
-        std::string remainingCharacters = "";
-        bool clrfBefore = false;
-        bool isOffsetInBuffer = false;
-        std::vector<std::string> httpRequestTokens;
-        char buffer[4096];
-        while (!hasClosedConnection) {
-            int len = read(socket, buffer + isOffsetInBuffer, sizeof(buffer) - isOffsetInBuffer);
-            exit_on_fail_with_errno(len >= 0, "Read() failed.");
-            // Iterate over the buffer and split by \r\n characters
-            int i;
-            for (i = 0; i < len - 1 + isOffsetInBuffer; i++) {
-                if (!(buffer[i] == '\r' && buffer[i + 1] == '\n')) {
-                    remainingCharacters += buffer[i];
-                    clrfBefore = false;
-                } else if (!clrfBefore) {
-                    httpRequestTokens.push_back(remainingCharacters);
-                    remainingCharacters.clear();
-                    clrfBefore = true;
-                    i++;
-                } else {
-                    if (handleSingleRequest(httpRequestTokens, socket)) {
-                        hasClosedConnection = true;
-                    }
-                    httpRequestTokens.clear();
-                    clrfBefore = false;
-                    i++;
+    /*
+     * Files found in contentPack, if given, are served from it; the others are looked for in
+     * filesDirectory as usual.
+     * */
+    ConnectionHandler(const std::string &filesDirectory, const std::string &correlatedServersFile,
+                      CorrelatedMode correlatedMode = CorrelatedMode::Redirect,
+                      std::shared_ptr<const ContentPack> contentPack = nullptr,
+                      std::shared_ptr<const TargetFilter> targetFilter = nullptr) :
+            correlatedFiles(correlatedServersFile), filesDir(filesDirectory), resolver(filesDirectory),
+            correlatedMode(correlatedMode), contentPack(std::move(contentPack)),
+            targetFilter(std::move(targetFilter)) {}
+
+    /*
+     * Frames requests buffered in the connection and handles every complete one. A request
+     * is the sequence of \r\n terminated lines up to the first empty line which is not its
+     * first line. Framing state is kept in the connection, so requests may be split across reads.
+     * Stops after a request which requires closing the connection or has to be proxied.
+     * A request whose header block exceeds maxHeaderBytes or maxHeaderLines is answered with 431
+     * and the connection is closed, so a client can't make the buffered request grow without bound.
+     * */
+    void handleIncomingConnection(Connection &conn, WorkerContext &context) const {
+        ReceiveBuffer &buffer = conn.getInput();
+        while (!conn.shouldCloseAfterFlush() && !conn.isWaitingForUpstream()) {
+            const char *data = buffer.data();
+            const char *crlf = findCrlf(data + conn.scanOffset, data + buffer.size());
+            if (crlf == nullptr) {
+                // Everything buffered belongs to the request in progress, as earlier ones are consumed.
+                if (buffer.size() > maxHeaderBytes) {
+                    rejectLargeHeader(conn, context);
+                    return;
+                }
+                // Trailing '\r' may still be followed by '\n' from the next read.
+                conn.scanOffset = std::max(conn.scanOffset, buffer.size() > 0 ? buffer.size() - 1 : 0);
+                return;
+            }
+            size_t lineBegin = conn.requestLines.empty() ? 0 : conn.requestLines.back().second + 2;
+            size_t lineEnd = crlf - data;
+            conn.scanOffset = lineEnd + 2;
+            if (lineBegin != lineEnd || conn.requestLines.empty()) {
+                if (conn.scanOffset > maxHeaderBytes || conn.requestLines.size() >= maxHeaderLines) {
+                    rejectLargeHeader(conn, context);
+                    return;
                 }
+                conn.requestLines.emplace_back(lineBegin, lineEnd);
+                continue;
             }
-            if (i == len - 1) { // Additional character unused
-                buffer[0] = buffer[i];
-                isOffsetInBuffer = true;
-            } else {
-                isOffsetInBuffer = false;
+            conn.httpRequestTokens.clear();
+            for (const auto &line : conn.requestLines) {
+                conn.httpRequestTokens.push_back(buffer.view(line.first, line.second - line.first));
             }
+            uint64_t startedAt = WorkerMetrics::now();
+            size_t firstChunk = conn.queuedChunks();
+            context.responseStatus = {};
+            context.responseUpstream = {};
+            if (handleSingleRequest(conn.httpRequestTokens, conn, context)) {
+                conn.setCloseAfterFlush();
+            }
+            // Proxied requests are logged by the event loop, once the response has been passed on.
+            if (context.accessLog != nullptr && !conn.isWaitingForUpstream()) {
+                logAccess(conn, context, startedAt, firstChunk);
+            }
+            conn.arena.reset();
+            conn.requestLines.clear();
+            buffer.consume(conn.scanOffset);
+            conn.scanOffset = 0;
         }
     }
 
+    const std::string &getFilesDirectory() const {
+        return filesDir;
+    }
+
+    CorrelatedTable &getCorrelatedTable() {
+        return correlatedFiles;
+    }
+
+    CorrelatedMode getCorrelatedMode() const {
+        return correlatedMode;
+    }
+
+    const UpstreamRegistry &getUpstreams() const {
+        return upstreams;
+    }
+
 private:
-    std::vector<CorrelatedFile> correlatedFiles;
+    static constexpr std::string_view multipartBoundary = "zaliczeniowe1-byteranges-5f0c3e7a91d2";
+    // Files compressed on the fly; smaller ones don't gain much and bigger ones would stall the worker.
+    static constexpr uint64_t minCompressedFileBytes = 256;
+    static constexpr uint64_t maxCompressedFileBytes = 2 << 20;
+    static constexpr std::string_view notFoundResponse = "HTTP/1.1 404 Not found\r\n\r\n";
+    // Limits of a request's header block, counting the request line.
+    static constexpr size_t maxHeaderBytes = 16 * 1024;
+    static constexpr size_t maxHeaderLines = 101;
+
+    CorrelatedTable correlatedFiles;
     std::string filesDir;
+    PathResolver resolver;
+    CorrelatedMode correlatedMode;
+    UpstreamRegistry upstreams;
+    std::shared_ptr<const ContentPack> contentPack;
+    std::shared_ptr<const TargetFilter> targetFilter;
+
+    // Logs the request just handled, whose response has been queued from chunk firstChunk on.
+    static void logAccess(const Connection &conn, WorkerContext &context, uint64_t startedAt, size_t firstChunk) {
+        // Taken from the raw start line, as the request may not have been valid.
+        std::string_view startLine = conn.httpRequestTokens[0];
+        size_t methodEnd = std::min(startLine.find(' '), startLine.size());
+        std::string_view target = startLine.substr(std::min(methodEnd + 1, startLine.size()));
+        context.logAccess(AccessEntry{startLine.substr(0, methodEnd), target.substr(0, target.find(' ')),
+                                      context.responseStatus, context.responseUpstream,
+                                      conn.bytesQueuedSince(firstChunk), startedAt});
+    }
 
-    bool handleSingleRequest(std::vector<std::string> tokens, int socket) {
+    // Answers the request in progress with 431 and drops what's buffered of it; nothing more is read.
+    void rejectLargeHeader(Connection &conn, WorkerContext &context) const {
+        ReceiveBuffer &buffer = conn.getInput();
+        uint64_t startedAt = WorkerMetrics::now();
+        size_t firstChunk = conn.queuedChunks();
+        context.responseStatus = {};
+        context.responseUpstream = {};
+        sendError(conn, context, "Header too large", "431");
+        conn.setCloseAfterFlush();
+        if (context.accessLog != nullptr) {
+            conn.httpRequestTokens.clear();
+            // Logged with the request line, if it's complete.
+            conn.httpRequestTokens.push_back(conn.requestLines.empty() ? std::string_view()
+                                                                        : buffer.view(0, conn.requestLines[0].second));
+            logAccess(conn, context, startedAt, firstChunk);
+        }
+        conn.arena.reset();
+        conn.requestLines.clear();
+        buffer.consume(buffer.size());
+        conn.scanOffset = 0;
+    }
+
+    static void countResponse(WorkerContext &context, std::string_view statusCode) {
+        context.metrics.countResponse(statusCode);
+        context.responseStatus = statusCode;
+    }
+
+    bool handleSingleRequest(const std::vector<std::string_view> &tokens, Connection &conn,
+                             WorkerContext &context) const {
         bool closeConnection;
 
-        std::optional<HttpMessage> validated = HttpMessage::validateHttpRequest(tokens);
+        uint64_t parseStart = WorkerMetrics::now();
+        std::optional<HttpMessage> validated = HttpMessage::validateHttpRequest(tokens, conn.arena);
+        context.metrics.recordSince(WorkerMetrics::Phase::Parse, parseStart);
         if (!validated) {
-            sendError(socket, "Bad syntax", "400");
+            sendError(conn, context, "Bad syntax", "400");
             return true;
         }
         if (!validated.value().getStartLine().validCharacters()) {
-            closeConnection = sendError(socket, "Not found", "404");
+            closeConnection = sendError(conn, context, "Not found", "404");
             return closeConnection;
         }
-        auto validatedMessage = validated.value();
-        const std::string method = validatedMessage.getStartLine().getMethod();
+        const HttpMessage &validatedMessage = validated.value();
+        std::string_view method = validatedMessage.getStartLine().getMethod();
         if (method == "GET" || method == "HEAD") {
-            closeConnection = handleGetOrHeadRequest(validatedMessage, socket, method == "GET");
+            closeConnection = handleGetOrHeadRequest(validatedMessage, conn, context, method == "GET");
         } else {
-            sendError(socket, "Not implemented", "501");
+            sendError(conn, context, "Not implemented", "501");
             return true;
         }
         // Check if "Connection: close" is in the headers.
@@ -124,72 +206,392 @@ private:
         return closeConnection;
     }
 
-    bool sendError(int socket, const std::string &reasoning, const std::string &statusCode) {
-        std::string statusLine = HttpMessage::generateResponseStatusLine(statusCode, reasoning);
-        std::string toSend;
-        if (statusCode != "404") {
-            toSend = HttpMessage::generateHttpString({statusLine,
-                                                      "Connection: close",
-                                                     });
+    /*
+     * Responses are only queued in the connection; the event loop writes them once
+     * the socket is writable. Return value tells whether the connection should be closed.
+     * */
+    bool sendError(Connection &conn, WorkerContext &context, const std::string &reasoning,
+                   std::string_view statusCode) const {
+        countResponse(context, statusCode);
+        if (statusCode == "404") {
+            conn.queueShared(nullptr, notFoundResponse, {});
+            return false;
+        }
+        std::string statusLine = HttpMessage::generateResponseStatusLine(std::string(statusCode), reasoning);
+        conn.queue(HttpMessage::generateHttpString({statusLine,
+                                                    "Connection: close",
+                                                   }));
+        return true;
+    }
+
+    // Prebuilt response isn't copied; the index snapshot holding it is kept until it's sent.
+    bool sendRedirectToCorrelatedServer(Connection &conn, WorkerContext &context,
+                                        std::shared_ptr<const CorrelatedIndex> index,
+                                        std::string_view redirect) const {
+        countResponse(context, "302");
+        conn.queueShared(std::move(index), redirect, {});
+        return false;
+    }
+
+    /*
+     * Prepares fetching the resource from its correlated server, done by the event loop. While the
+     * server is known to be down, and when fetching fails before any of the response is passed on,
+     * the client gets a redirect or 404 instead.
+     * */
+    bool proxyToCorrelatedServer(Connection &conn, WorkerContext &context, std::shared_ptr<const CorrelatedIndex> index,
+                                 const CorrelatedServer &server, std::string_view redirect, bool writeContent) const {
+        std::shared_ptr<Upstream> &upstream = context.upstreams[std::string(server.ipAddress) + ":" +
+                                                                std::string(server.port)];
+        if (!upstream) {
+            upstream = upstreams.get(server.ipAddress, server.port);
+        }
+        bool fallbackRedirect = correlatedMode == CorrelatedMode::ProxyElseRedirect;
+        if (!upstream->isHealthy()) {
+            context.metrics.countUpstream(WorkerMetrics::UpstreamResult::Fallback);
+            if (fallbackRedirect) {
+                return sendRedirectToCorrelatedServer(conn, context, std::move(index), redirect);
+            }
+            return sendError(conn, context, "Not found", "404");
+        }
+        std::string request = std::string(writeContent ? "GET " : "HEAD ") + std::string(server.resource) +
+                              " HTTP/1.1\r\nHost: " + upstream->getName() + "\r\n\r\n";
+        std::string fallback(fallbackRedirect ? redirect : notFoundResponse);
+        conn.upstream = std::make_unique<UpstreamExchange>(upstream, std::move(request), !writeContent,
+                                                           std::move(fallback), fallbackRedirect ? "302" : "404");
+        return false;
+    }
+
+    // Body of a served file: bytes in memory or a region of a descriptor, both kept alive by owner.
+    struct FileBody {
+        std::shared_ptr<const void> owner;
+        std::string_view memory;
+        int fd = -1;
+        int mappedFd = -1;
+    };
+
+    static FileBody bodyOf(const std::shared_ptr<const CachedResponse> &response) {
+        return FileBody{response, response->getBody(), response->getFileFd(), response->getMappedFd()};
+    }
+
+    /*
+     * Serves the file from the content pack, in the most preferred coding it's packed in. Queued
+     * responses pin the pack through a worker-private reference, like correlated indexes do.
+     * Returns nothing if the file isn't packed.
+     * */
+    std::optional<bool> sendPackedFile(const HttpMessage &hm, Connection &conn, WorkerContext &context,
+                                       std::string_view requestTarget, const httpEncodings::AcceptedCodings &codings,
+                                       uint64_t lookupStart, bool writeContent) const {
+        const CachedResponse *response = contentPack->find(requestTarget);
+        if (response == nullptr) {
+            return {};
+        }
+        for (const httpEncodings::Coding &coding : codings) {
+            if (const CachedResponse *variant = contentPack->findVariant(requestTarget, coding.name)) {
+                response = variant;
+                break;
+            }
+        }
+        context.metrics.recordSince(WorkerMetrics::Phase::FileLookup, lookupStart);
+        if (!context.contentPack) {
+            context.contentPack = std::shared_ptr<const ContentPack>(contentPack.get(),
+                                                                     [pack = contentPack](const ContentPack *) {});
+        }
+        return sendCachedResponse(hm, conn, context, std::shared_ptr<const CachedResponse>(context.contentPack,
+                                                                                           response), writeContent);
+    }
+
+    bool sendCachedResponse(const HttpMessage &hm, Connection &conn, WorkerContext &context,
+                            std::shared_ptr<const CachedResponse> response, bool writeContent) const {
+        return sendFile(hm, conn, context, response->getMetadata(), bodyOf(response), response->getHeader(),
+                        writeContent);
+    }
+
+    /*
+     * Answers GET or HEAD of a regular file: 304 when the client's copy is still valid, 206 or
+     * 416 when a range is requested, the whole file otherwise. okHeader is a prebuilt header
+     * of the whole file response, if there's one. Bodies are never copied: they're sent from
+     * cached memory or straight from the file.
+     * */
+    bool sendFile(const HttpMessage &hm, Connection &conn, WorkerContext &context, const FileMetadata &metadata,
+                  const FileBody &body, std::string_view okHeader, bool writeContent) const {
+        if (isNotModified(hm, metadata)) {
+            countResponse(context, "304");
+            std::string &header = conn.queueText();
+            header.append("HTTP/1.1 304 Not Modified\r\n");
+            metadata.appendValidatorFields(header);
+            header.append("\r\n");
+            return false;
+        }
+        if (!metadata.contentCoding.empty()) {
+            context.metrics.countEncodedResponse(metadata.contentCoding);
+        }
+        const HeaderField *range = hm.findHeaderField("range");
+        if (range != nullptr && writeContent && rangeApplies(hm, metadata)) {
+            if (auto ranges = httpRanges::parseRange(range->getValue(), metadata.size)) {
+                return sendRanges(conn, context, metadata, body, *ranges);
+            }
+        }
+        countResponse(context, "200");
+        if (okHeader.empty()) {
+            conn.queue(metadata.okHeader());
         } else {
-            toSend = HttpMessage::generateHttpString({statusLine});
+            conn.queueShared(body.owner, okHeader, {});
         }
+        if (writeContent) {
+            queueBody(conn, body, 0, metadata.size);
+        }
+        return false;
+    }
 
-        long unsigned int bytesWritten = write(socket, toSend.c_str(), toSend.size());
-        return bytesWritten != toSend.size();
+    static bool isNotModified(const HttpMessage &hm, const FileMetadata &metadata) {
+        // If-Modified-Since is only considered without If-None-Match.
+        if (const HeaderField *ifNoneMatch = hm.findHeaderField("if-none-match")) {
+            return httpRanges::matchesAnyEtag(ifNoneMatch->getValue(), metadata.etag);
+        }
+        if (const HeaderField *ifModifiedSince = hm.findHeaderField("if-modified-since")) {
+            std::optional<time_t> date = httpRanges::parseHttpDate(ifModifiedSince->getValue());
+            return date && metadata.lastModified <= *date;
+        }
+        return false;
     }
 
-    bool sendOctetStream(int socket, std::streamsize bytesToSend) {
-        std::string statusLine = HttpMessage::generateResponseStatusLine("200", "OK");
-        std::string toSend = HttpMessage::generateHttpString({statusLine,
-                                                              "Content-Type: application/octet-stream",
-                                                              "Content-Length: " + std::to_string(bytesToSend)
-                                                             });
-        long unsigned int bytesWritten = write(socket, toSend.c_str(), toSend.size());
-        return bytesWritten != toSend.size();
+    // With If-Range, a range is only sent if the client's copy is the current one (strong comparison).
+    static bool rangeApplies(const HttpMessage &hm, const FileMetadata &metadata) {
+        const HeaderField *ifRange = hm.findHeaderField("if-range");
+        if (ifRange == nullptr) {
+            return true;
+        }
+        std::string_view value = ifRange->getValue();
+        if (value.front() == '"' || value.compare(0, 2, "w/") == 0) {
+            return value == metadata.etag;
+        }
+        std::optional<time_t> date = httpRanges::parseHttpDate(value);
+        return date && *date == metadata.lastModified;
     }
 
-    bool sendRedirectToCorrelatedServer(int socket, const CorrelatedFile &cf) {
-        std::string statusLine = HttpMessage::generateResponseStatusLine("302", "Redirected");
-        std::string toSend = HttpMessage::generateHttpString({statusLine,
-                                                              "Location: " + cf.toString(),
-                                                             });
-        long unsigned int bytesWritten = write(socket, toSend.c_str(), toSend.size());
-        return bytesWritten != toSend.size();
+    bool sendRanges(Connection &conn, WorkerContext &context, const FileMetadata &metadata, const FileBody &body,
+                    const std::vector<httpRanges::ByteRange> &ranges) const {
+        const std::string size = std::to_string(metadata.size);
+        if (ranges.empty()) {
+            countResponse(context, "416");
+            conn.queue(HttpMessage::generateHttpString({HttpMessage::generateResponseStatusLine(
+                    "416", "Range Not Satisfiable"), "Content-Range: bytes */" + size, "Content-Length: 0"}));
+            return false;
+        }
+        countResponse(context, "206");
+        auto contentRange = [&size](const httpRanges::ByteRange &r) {
+            return "Content-Range: bytes " + std::to_string(r.first) + "-" + std::to_string(r.last) + "/" + size;
+        };
+        std::string header = HttpMessage::generateResponseStatusLine("206", "Partial Content") + "\r\n";
+        if (ranges.size() == 1) {
+            header += "Content-Type: application/octet-stream\r\n" + contentRange(ranges[0]) +
+                      "\r\nContent-Length: " + std::to_string(ranges[0].length()) + "\r\n";
+            metadata.appendValidatorFields(header);
+            conn.queue(header + "\r\n");
+            queueBody(conn, body, ranges[0].first, ranges[0].length());
+            return false;
+        }
+        std::vector<std::string> partHeaders;
+        const std::string closing = "\r\n--" + std::string(multipartBoundary) + "--\r\n";
+        uint64_t contentLength = closing.size();
+        for (const httpRanges::ByteRange &r : ranges) {
+            partHeaders.push_back("\r\n--" + std::string(multipartBoundary) +
+                                  "\r\nContent-Type: application/octet-stream\r\n" + contentRange(r) + "\r\n\r\n");
+            contentLength += partHeaders.back().size() + r.length();
+        }
+        header += "Content-Type: multipart/byteranges; boundary=" + std::string(multipartBoundary) +
+                  "\r\nContent-Length: " + std::to_string(contentLength) + "\r\n";
+        metadata.appendValidatorFields(header);
+        conn.queue(header + "\r\n");
+        for (size_t i = 0; i < ranges.size(); i++) {
+            conn.queue(std::move(partHeaders[i]));
+            queueBody(conn, body, ranges[i].first, ranges[i].length());
+        }
+        conn.queue(closing);
+        return false;
+    }
+
+    static void queueBody(Connection &conn, const FileBody &body, uint64_t offset, uint64_t length) {
+        if (length == 0) {
+            return;
+        }
+        if (body.fd >= 0) {
+            conn.queueFile(body.fd, offset, length, body.owner);
+        } else if (body.mappedFd >= 0 && conn.encryptsInUserspace()) {
+            // The kernel fails sending a truncated mapping with EFAULT, userspace would get SIGBUS.
+            conn.queueFile(body.mappedFd, offset, length, body.owner);
+        } else {
+            conn.queueShared(body.owner, body.memory.substr(offset, length), {});
+        }
+    }
+
+    // Opens target like the resolver does, but fails with ENOENT right away if the target filter rules it out.
+    int openTarget(WorkerContext &context, std::string_view target) const {
+        if (!targetFilter) {
+            return resolver.open(target);
+        }
+        if (!targetFilter->mayContain(target)) {
+            context.metrics.countFilterLookup(WorkerMetrics::FilterResult::Rejected);
+            errno = ENOENT;
+            return -1;
+        }
+        int fd = resolver.open(target);
+        bool missing = fd < 0 && (errno == ENOENT || errno == ENOTDIR);
+        context.metrics.countFilterLookup(missing ? WorkerMetrics::FilterResult::FalsePositive
+                                                  : WorkerMetrics::FilterResult::Found);
+        return fd;
     }
 
-    bool handleGetOrHeadRequest(const HttpMessage &hm, int socket, bool writeContent) {
-        const std::string requestTarget = hm.getStartLine().getRequestTarget();
-        std::string filename = requestTarget;
-        if (!validatePath(filesDir, filename)) {
-            return sendError(socket, "Not found", "404");
+    static httpEncodings::AcceptedCodings acceptedCodings(const HttpMessage &hm) {
+        const HeaderField *acceptEncoding = hm.findHeaderField("accept-encoding");
+        if (acceptEncoding == nullptr) {
+            return {};
         }
-        filename = filesDir + filename;
-        if (!std::filesystem::exists(filename)) { // Search in correlated files list.
-            for (const CorrelatedFile &f : correlatedFiles) {
-                if (f.resource == requestTarget) {
-                    return sendRedirectToCorrelatedServer(socket, f);
+        return httpEncodings::acceptedCodings(acceptEncoding->getValue());
+    }
+
+    /*
+     * Finds the most preferred of codings, starting from codings[first], available for the file: its
+     * precompressed sibling, unless it's older than the file, or the file compressed on the fly. Variants
+     * found are cached, and so are the missing ones, so a hot file is neither looked for nor compressed
+     * again until it changes.
+     * */
+    std::shared_ptr<const CachedResponse> findEncodedVariant(WorkerContext &context, std::string_view requestTarget,
+                                                             const httpEncodings::AcceptedCodings &codings,
+                                                             size_t first, const FileMetadata &metadata,
+                                                             const FileBody &body) const {
+        for (size_t i = first; i < codings.size(); i++) {
+            const httpEncodings::Coding &coding = codings[i];
+            std::string key = FileCache::variantKey(requestTarget, coding.name);
+            std::string siblingTarget = std::string(requestTarget) + std::string(coding.extension);
+            std::vector<std::string> sources = {std::string(requestTarget), siblingTarget};
+            uint64_t lookupStart = WorkerMetrics::now();
+            int fd = openTarget(context, siblingTarget);
+            struct stat st{};
+            bool fresh = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                         st.st_mtim.tv_sec >= metadata.lastModified;
+            context.metrics.recordSince(WorkerMetrics::Phase::FileLookup, lookupStart);
+            if (fresh) {
+                FileMetadata siblingMetadata = FileMetadata::of(st);
+                siblingMetadata.contentCoding = coding.name;
+                if (auto cached = context.fileCache.insert(key, sources, fd, siblingMetadata)) {
+                    close(fd);
+                    return cached;
+                }
+                return std::make_shared<const CachedResponse>(siblingMetadata, fd);
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (coding.onTheFly && metadata.size >= minCompressedFileBytes && metadata.size <= maxCompressedFileBytes) {
+                // Reading a file missing from the page cache would block the worker; it's compressed once
+                // serving it has brought it there.
+                if (body.fd >= 0 && (AsyncFileReader::residencyOf(body.fd, 0) == AsyncFileReader::Residency::Cold ||
+                                     AsyncFileReader::residencyOf(body.fd, metadata.size - 1) ==
+                                     AsyncFileReader::Residency::Cold)) {
+                    continue;
+                }
+                // Compressed variant is only worth it when it's at least a tenth smaller. It's served
+                // uncompressed when it couldn't be cached, rather than compressed again for every request.
+                size_t maxOutput = metadata.size - metadata.size / 10;
+                if (!context.fileCache.accepts(sources, maxOutput)) {
+                    continue;
+                }
+                uint64_t compressStart = WorkerMetrics::now();
+                // Mapped bodies are read from the file, as the mapping of a truncated one raises SIGBUS.
+                int fileFd = body.fd >= 0 ? body.fd : body.mappedFd;
+                std::optional<std::string> compressed = fileFd >= 0
+                                                        ? gzipCompressFile(fileFd, metadata.size, maxOutput)
+                                                        : gzipCompress(body.memory, maxOutput);
+                context.metrics.recordSince(WorkerMetrics::Phase::Compress, compressStart);
+                if (compressed) {
+                    auto variant = std::make_shared<const CachedResponse>(
+                            metadata.encoded(coding.name, compressed->size()), std::move(*compressed));
+                    context.fileCache.insert(key, sources, variant);
+                    return variant;
                 }
             }
-            return sendError(socket, "Not found", "404");
+            context.fileCache.insert(key, sources, std::make_shared<const CachedResponse>());
+        }
+        return nullptr;
+    }
+
+    bool handleGetOrHeadRequest(const HttpMessage &hm, Connection &conn, WorkerContext &context,
+                                bool writeContent) const {
+        std::string_view requestTarget = hm.getStartLine().getRequestTarget();
+        httpEncodings::AcceptedCodings codings = acceptedCodings(hm);
+        uint64_t lookupStart = WorkerMetrics::now();
+        if (contentPack) {
+            if (std::optional<bool> packed = sendPackedFile(hm, conn, context, requestTarget, codings, lookupStart,
+                                                            writeContent)) {
+                return *packed;
+            }
+        }
+        // Cached variants are served right away; codings from the first one unknown to the cache are looked for.
+        size_t known = 0;
+        for (; known < codings.size(); known++) {
+            auto variant = context.fileCache.findVariant(requestTarget, codings[known].name);
+            if (!variant) {
+                break;
+            }
+            if (!variant->isMissing()) {
+                context.metrics.recordSince(WorkerMetrics::Phase::FileLookup, lookupStart);
+                return sendCachedResponse(hm, conn, context, std::move(variant), writeContent);
+            }
+        }
+        if (auto cached = context.fileCache.find(requestTarget)) {
+            context.metrics.recordSince(WorkerMetrics::Phase::FileLookup, lookupStart);
+            if (auto variant = findEncodedVariant(context, requestTarget, codings, known, cached->getMetadata(),
+                                                  bodyOf(cached))) {
+                return sendCachedResponse(hm, conn, context, std::move(variant), writeContent);
+            }
+            return sendCachedResponse(hm, conn, context, std::move(cached), writeContent);
+        }
+        int fd = openTarget(context, requestTarget);
+        struct stat st{};
+        bool regularFile = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        int openErrno = errno;
+        context.metrics.recordSince(WorkerMetrics::Phase::FileLookup, lookupStart);
+        if (fd < 0) {
+            if (openErrno != ENOENT && openErrno != ENOTDIR) { // Outside of the files directory or unreadable.
+                return sendError(conn, context, "Not found", "404");
+            }
+            // Search in correlated files list.
+            uint64_t redirectStart = WorkerMetrics::now();
+            const std::shared_ptr<const CorrelatedIndex> &index = context.correlated.get(correlatedFiles);
+            std::optional<std::string_view> redirect = index->findRedirect(requestTarget);
+            context.metrics.recordSince(WorkerMetrics::Phase::RedirectLookup, redirectStart);
+            if (redirect && context.accessLog != nullptr) {
+                context.responseUpstream = index->find(requestTarget)->address;
+            }
+            if (redirect && correlatedMode != CorrelatedMode::Redirect) {
+                return proxyToCorrelatedServer(conn, context, index, *index->find(requestTarget), *redirect,
+                                               writeContent);
+            }
+            if (redirect) {
+                return sendRedirectToCorrelatedServer(conn, context, index, *redirect);
+            }
+            return sendError(conn, context, "Not found", "404");
         } else {
-            if (!std::filesystem::is_regular_file(filename)) {
-                return sendError(socket, "Not found", "404");
-            }
-            std::ifstream is(filename, std::ios::in | std::ios::binary);
-            std::uintmax_t fileSize = std::filesystem::file_size(filename);
-            bool isOk = sendOctetStream(socket, fileSize);
-            std::vector<char> buffer(4096);
-            if (writeContent) {
-                do {
-                    is.read(buffer.data(), 4096);
-                    std::streamsize bytesRead = is.gcount();
-                    int bytesSent = write(socket, buffer.data(), bytesRead);
-                    isOk = isOk | (bytesSent != bytesRead);
-                } while (is.good());
-                exit_on_fail(is.eof(), "Reading file has failed.");
-            }
-            return isOk;
+            if (!regularFile) {
+                close(fd);
+                return sendError(conn, context, "Not found", "404");
+            }
+            FileMetadata metadata = FileMetadata::of(st);
+            metadata.negotiable = true; // May have a precompressed sibling, or be compressed on the fly.
+            std::shared_ptr<const CachedResponse> cached = context.fileCache.insert(std::string(requestTarget), fd,
+                                                                                    metadata);
+            FileBody body = cached ? bodyOf(cached) : FileBody{std::make_shared<SharedDescriptor>(fd), {}, fd};
+            if (cached) {
+                close(fd);
+            }
+            if (auto variant = findEncodedVariant(context, requestTarget, codings, known, metadata, body)) {
+                return sendCachedResponse(hm, conn, context, std::move(variant), writeContent);
+            }
+            if (cached) {
+                return sendCachedResponse(hm, conn, context, std::move(cached), writeContent);
+            }
+            return sendFile(hm, conn, context, metadata, body, {}, writeContent);
         }
     }
 };
@@ -0,0 +1,328 @@
+#ifndef ZALICZENIOWE1_CONTENTPACK_H
+#define ZALICZENIOWE1_CONTENTPACK_H
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../utils/httpEncodings.h"
+#include "../utils/pathUtils.h"
+#include "../utils/serverAssertions.h"
+#include "fileCache.h"
+
+/*
+ * Files of a directory tree packed into a single file by build(), served from memory mapped
+ * at startup. Once the pack is loaded, serving a packed file takes no filesystem syscalls:
+ * the target is binary searched in the mapped index and the body is sent from the mapping.
+ * Metadata of the original files is kept, so entity tags match those of the directory.
+ * A pack is a snapshot; files changed since it was built are served as they were.
+ *
+ * Layout, in native byte order: Header, Header::entryCount Entries sorted by name, then
+ * names and bodies, which Entries point at by offsets from the beginning of the file.
+ * */
+class ContentPack {
+public:
+    ContentPack(const ContentPack &) = delete;
+
+    ContentPack &operator=(const ContentPack &) = delete;
+
+    /*
+     * Maps the pack at path and prepares responses for all of its files. With populate, the whole
+     * pack is read into memory before returning, so that not even the first requests wait for the
+     * disk; otherwise reading it is only started.
+     * Returns nullptr with error set if the pack can't be read or is malformed.
+     * */
+    static std::shared_ptr<const ContentPack> tryFromFile(const std::string &path, bool populate, std::string &error) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            error = "Can't open content pack: " + std::string(strerror(errno));
+            if (fd >= 0) {
+                close(fd);
+            }
+            return nullptr;
+        }
+        size_t size = st.st_size;
+        void *memory = size == 0 ? MAP_FAILED : mmap(nullptr, size, PROT_READ, MAP_SHARED |
+                                                                            (populate ? MAP_POPULATE : 0), fd, 0);
+        close(fd);
+        if (memory == MAP_FAILED) {
+            error = "Can't map content pack.";
+            return nullptr;
+        }
+        if (!populate) {
+            madvise(memory, size, MADV_WILLNEED); // Read ahead in the background instead.
+        }
+        std::shared_ptr<const char> mapping(static_cast<const char *>(memory),
+                                            [size](const char *p) { munmap(const_cast<char *>(p), size); });
+        std::shared_ptr<ContentPack> pack(new ContentPack(std::move(mapping), size));
+        if (!pack->validate()) {
+            error = "Bad content pack format.";
+            return nullptr;
+        }
+        pack->prepareResponses();
+        return pack;
+    }
+
+    static std::shared_ptr<const ContentPack> fromFile(const std::string &path, bool populate) {
+        std::string error;
+        std::shared_ptr<const ContentPack> pack = tryFromFile(path, populate, error);
+        exit_on_fail(pack != nullptr, error);
+        return pack;
+    }
+
+    /*
+     * Packs regular files below directory, and files symlinked to from it, into a pack at packPath,
+     * each under the request target it's served at. Files are opened like the server opens them
+     * (PathResolver), so symlinks leading outside of directory are skipped, as they'd be 404 there.
+     * Returns false with error set on failure.
+     * */
+    static bool build(const std::string &directory, const std::string &packPath, std::string &error) {
+        struct Source {
+            std::string name;
+            struct stat st;
+        };
+        std::vector<std::string> names;
+        std::error_code ec;
+        std::filesystem::path base = std::filesystem::absolute(directory, ec);
+        for (auto it = std::filesystem::recursive_directory_iterator(base, ec);
+             !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            std::error_code typeEc; // E.g. a dangling symlink, which is just skipped.
+            if (it->is_regular_file(typeEc)) {
+                names.push_back("/" + it->path().lexically_relative(base).generic_string());
+            }
+        }
+        if (ec) {
+            error = "Can't list " + directory + ": " + ec.message();
+            return false;
+        }
+        PathResolver resolver(directory);
+        std::vector<Source> sources;
+        for (std::string &name : names) {
+            Source source{std::move(name), {}};
+            int fd = resolver.open(source.name);
+            if (fd >= 0 && fstat(fd, &source.st) == 0 && S_ISREG(source.st.st_mode)) {
+                sources.push_back(std::move(source));
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        std::sort(sources.begin(), sources.end(), [](const Source &a, const Source &b) { return a.name < b.name; });
+
+        std::vector<Entry> entries(sources.size());
+        uint64_t offset = sizeof(Header) + sizeof(Entry) * entries.size();
+        for (size_t i = 0; i < sources.size(); i++) {
+            entries[i].nameOffset = offset;
+            entries[i].nameLength = sources[i].name.size();
+            offset += sources[i].name.size();
+        }
+        for (size_t i = 0; i < sources.size(); i++) {
+            if (sources[i].st.st_size > 0) { // Padding is only ever followed by a body, so the pack ends with data.
+                offset = (offset + bodyAlignment - 1) & ~(bodyAlignment - 1);
+            }
+            entries[i].bodyOffset = offset;
+            entries[i].size = sources[i].st.st_size;
+            entries[i].inode = sources[i].st.st_ino;
+            entries[i].modifiedSeconds = sources[i].st.st_mtim.tv_sec;
+            entries[i].modifiedNanoseconds = sources[i].st.st_mtim.tv_nsec;
+            offset += entries[i].size;
+        }
+        Header header{};
+        std::copy(magic.begin(), magic.end(), header.magic);
+        header.entryCount = entries.size();
+        header.packSize = offset;
+
+        // Written aside and renamed, so that a server never maps a pack being written.
+        const std::string temporaryPath = packPath + ".tmp";
+        std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(entries.data()), sizeof(Entry) * entries.size());
+        for (const Source &source : sources) {
+            out << source.name;
+        }
+        std::vector<char> buffer(1 << 16);
+        for (size_t i = 0; i < sources.size() && out; i++) {
+            out.seekp(entries[i].bodyOffset);
+            int fd = resolver.open(sources[i].name);
+            uint64_t copied = 0;
+            ssize_t len = 0;
+            while (fd >= 0 && copied < entries[i].size &&
+                   (len = read(fd, buffer.data(), std::min<uint64_t>(buffer.size(), entries[i].size - copied))) > 0) {
+                out.write(buffer.data(), len);
+                copied += len;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (copied != entries[i].size) {
+                error = "Can't read " + directory + sources[i].name + ", it may have changed while being packed.";
+                std::filesystem::remove(temporaryPath, ec);
+                return false;
+            }
+        }
+        out.close();
+        if (!out || rename(temporaryPath.c_str(), packPath.c_str()) < 0) {
+            error = "Can't write " + packPath + ": " + std::string(strerror(errno));
+            std::filesystem::remove(temporaryPath, ec);
+            return false;
+        }
+        return true;
+    }
+
+    // Response for the packed file served at requestTarget, nullptr if there's no such file.
+    const CachedResponse *find(std::string_view requestTarget) const {
+        std::optional<size_t> i = findEntry(requestTarget);
+        return i ? responses[*i].get() : nullptr;
+    }
+
+    /*
+     * Response for the precompressed sibling of the file at requestTarget with given coding,
+     * nullptr if there's no file or sibling, or the sibling is older than the file.
+     * */
+    const CachedResponse *findVariant(std::string_view requestTarget, std::string_view coding) const {
+        std::optional<size_t> i = findEntry(requestTarget);
+        if (!i) {
+            return nullptr;
+        }
+        for (size_t c = 0; c < httpEncodings::supportedCodings.size(); c++) {
+            if (httpEncodings::supportedCodings[c].name == coding) {
+                return variants[*i][c].get();
+            }
+        }
+        return nullptr;
+    }
+
+    size_t size() const {
+        return header().entryCount;
+    }
+
+private:
+    static constexpr std::string_view magic = "ZPACK001";
+    static constexpr uint64_t bodyAlignment = 16;
+
+    struct Header {
+        char magic[8];
+        uint64_t entryCount;
+        uint64_t packSize;
+    };
+
+    struct Entry {
+        uint64_t nameOffset;
+        uint64_t nameLength;
+        uint64_t bodyOffset;
+        uint64_t size;
+        uint64_t inode;
+        int64_t modifiedSeconds;
+        int64_t modifiedNanoseconds;
+    };
+
+    std::shared_ptr<const char> mapping;
+    size_t mappingSize;
+    std::vector<std::unique_ptr<const CachedResponse>> responses;
+    std::vector<std::array<std::unique_ptr<const CachedResponse>, httpEncodings::supportedCodings.size()>> variants;
+
+    ContentPack(std::shared_ptr<const char> mapping, size_t mappingSize) :
+            mapping(std::move(mapping)), mappingSize(mappingSize) {}
+
+    const Header &header() const {
+        return *reinterpret_cast<const Header *>(mapping.get());
+    }
+
+    const Entry &entry(size_t i) const {
+        return reinterpret_cast<const Entry *>(mapping.get() + sizeof(Header))[i];
+    }
+
+    std::string_view nameOf(const Entry &e) const {
+        return std::string_view(mapping.get() + e.nameOffset, e.nameLength);
+    }
+
+    std::string_view bodyOf(const Entry &e) const {
+        return std::string_view(mapping.get() + e.bodyOffset, e.size);
+    }
+
+    // Checks that every entry lies within the pack and names are sorted, so lookups can trust the index.
+    bool validate() const {
+        if (mappingSize < sizeof(Header) || std::string_view(header().magic, sizeof(Header::magic)) != magic ||
+            header().packSize != mappingSize ||
+            header().entryCount > (mappingSize - sizeof(Header)) / sizeof(Entry)) {
+            return false;
+        }
+        for (size_t i = 0; i < size(); i++) {
+            const Entry &e = entry(i);
+            if (e.nameOffset > mappingSize || e.nameLength > mappingSize - e.nameOffset ||
+                e.bodyOffset > mappingSize || e.size > mappingSize - e.bodyOffset) {
+                return false;
+            }
+            std::string_view name = nameOf(e);
+            if (name.empty() || name[0] != '/' || (i > 0 && nameOf(entry(i - 1)) >= name)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::optional<size_t> findEntry(std::string_view name) const {
+        size_t low = 0;
+        size_t high = size();
+        while (low < high) {
+            size_t middle = low + (high - low) / 2;
+            std::string_view middleName = nameOf(entry(middle));
+            if (middleName == name) {
+                return middle;
+            }
+            if (middleName < name) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return {};
+    }
+
+    static FileMetadata metadataOf(const Entry &e) {
+        struct stat st{};
+        st.st_ino = e.inode;
+        st.st_size = e.size;
+        st.st_mtim.tv_sec = e.modifiedSeconds;
+        st.st_mtim.tv_nsec = e.modifiedNanoseconds;
+        return FileMetadata::of(st);
+    }
+
+    // Responses share the mapping, so it lives as long as any of them is being sent.
+    void prepareResponses() {
+        responses.resize(size());
+        variants.resize(size());
+        for (size_t i = 0; i < size(); i++) {
+            for (size_t c = 0; c < httpEncodings::supportedCodings.size(); c++) {
+                const httpEncodings::Coding &coding = httpEncodings::supportedCodings[c];
+                std::optional<size_t> sibling = findEntry(std::string(nameOf(entry(i))) + std::string(coding.extension));
+                if (sibling && entry(*sibling).modifiedSeconds >= entry(i).modifiedSeconds) {
+                    FileMetadata metadata = metadataOf(entry(*sibling));
+                    metadata.contentCoding = coding.name;
+                    variants[i][c] = std::make_unique<const CachedResponse>(std::move(metadata), mapping,
+                                                                            bodyOf(entry(*sibling)));
+                }
+            }
+            FileMetadata metadata = metadataOf(entry(i));
+            metadata.negotiable = std::any_of(variants[i].begin(), variants[i].end(),
+                                              [](const auto &variant) { return variant != nullptr; });
+            responses[i] = std::make_unique<const CachedResponse>(std::move(metadata), mapping, bodyOf(entry(i)));
+        }
+    }
+};
+
+#endif //ZALICZENIOWE1_CONTENTPACK_H
@@ -0,0 +1,320 @@
+#ifndef ZALICZENIOWE1_CORRELATEDINDEX_H
+#define ZALICZENIOWE1_CORRELATEDINDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../utils/serverAssertions.h"
+#include "../utils/httpParsers.h"
+
+namespace correlatedFormat {
+    /*
+     * Splits line of the correlated servers file by tabs into resource, ip address and port.
+     * Tab at the very end of the line doesn't start another field.
+     * */
+    inline bool splitLine(std::string_view line, std::string_view (&tokens)[3]) {
+        size_t count = 0;
+        size_t pos = 0;
+        while (pos < line.size()) {
+            size_t next = line.find('\t', pos);
+            if (count == 3) {
+                return false;
+            }
+            tokens[count++] = line.substr(pos, next == std::string_view::npos ? std::string_view::npos : next - pos);
+            if (next == std::string_view::npos) {
+                break;
+            }
+            pos = next + 1;
+        }
+        return count == 3;
+    }
+}
+
+struct CorrelatedFile {
+    CorrelatedFile(std::string_view s) {
+        std::string_view tokens[3];
+        exit_on_fail(correlatedFormat::splitLine(s, tokens), "Bad servers file format");
+        resource = tokens[0];
+        ipAddress = tokens[1];
+        port = tokens[2];
+    }
+
+    bool operator==(const CorrelatedFile &cf) {
+        return resource == cf.resource && ipAddress == cf.ipAddress && port == cf.port;
+    }
+
+    std::string toString() const {
+        return "http://" + ipAddress + ":" + port + resource;
+    }
+
+    std::string resource;
+    std::string ipAddress;
+    std::string port;
+};
+
+// Correlated server holding a resource, viewing into the index.
+struct CorrelatedServer {
+    std::string_view resource;
+    std::string_view ipAddress;
+    std::string_view port;
+    // "ip:port", as the server is named in the access log.
+    std::string_view address;
+};
+
+/*
+ * Read-only open addressing hash table from resource to the correlated server holding it,
+ * built once at startup. For every entry only the complete 302 response is stored, in one
+ * shared string arena; resource, ip address and port are views into its Location header.
+ * When a resource is listed more than once, the first entry wins, as in a linear scan.
+ * */
+class CorrelatedIndex {
+public:
+    explicit CorrelatedIndex(const std::vector<CorrelatedFile> &correlatedFiles) {
+        for (const CorrelatedFile &cf : correlatedFiles) {
+            appendEntry(arena, entries, cf.resource, cf.ipAddress, cf.port);
+        }
+        buildTable();
+    }
+
+    /*
+     * Memory maps the correlated servers file and parses it in parallel chunks split at
+     * line boundaries. Exits with the same errors as reading it line by line would.
+     * */
+    static CorrelatedIndex fromFile(const std::string &correlatedServersFile,
+                                    unsigned threadsNum = std::thread::hardware_concurrency()) {
+        std::string error;
+        std::optional<CorrelatedIndex> index = tryFromFile(correlatedServersFile, error, threadsNum);
+        exit_on_fail(index.has_value(), error);
+        return std::move(index.value());
+    }
+
+    // Same as fromFile(), but on failure sets error and returns nothing instead of exiting.
+    static std::optional<CorrelatedIndex> tryFromFile(const std::string &correlatedServersFile, std::string &error,
+                                                      unsigned threadsNum = std::thread::hardware_concurrency()) {
+        int fd = open(correlatedServersFile.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st{};
+        void *mapping = nullptr;
+        if (fd < 0 || fstat(fd, &st) != 0 ||
+            (st.st_size > 0 && (mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            error = "Cannot read file " + correlatedServersFile;
+            return {};
+        }
+        close(fd);
+        std::string_view content;
+        if (mapping != nullptr) {
+            madvise(mapping, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+            content = std::string_view(static_cast<const char *>(mapping), st.st_size);
+        }
+
+        std::vector<size_t> bounds = chunkBounds(content, content.size() < parallelThreshold ? 1 : threadsNum);
+        std::vector<ParsedChunk> chunks(bounds.size() - 1);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            threads.emplace_back([&chunks, &bounds, content, i]() {
+                chunks[i] = parseChunk(content.substr(bounds[i], bounds[i + 1] - bounds[i]));
+            });
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+        if (mapping != nullptr) {
+            munmap(mapping, st.st_size);
+        }
+
+        CorrelatedIndex index;
+        size_t arenaSize = 0, entriesNum = 0;
+        for (const ParsedChunk &chunk : chunks) {
+            if (!chunk.valid) {
+                error = "Bad servers file format";
+                return {};
+            }
+            arenaSize += chunk.arena.size();
+            entriesNum += chunk.entries.size();
+        }
+        index.arena.reserve(arenaSize);
+        index.entries.reserve(entriesNum);
+        for (ParsedChunk &chunk : chunks) {
+            size_t base = index.arena.size();
+            index.arena += chunk.arena;
+            for (Entry entry : chunk.entries) {
+                entry.offset += base;
+                index.entries.push_back(entry);
+            }
+            chunk = ParsedChunk();
+        }
+        index.buildTable();
+        return index;
+    }
+
+    std::optional<CorrelatedServer> find(std::string_view resource) const {
+        uint32_t entry = findEntry(resource);
+        if (entry == emptySlot) {
+            return {};
+        }
+        const Entry &e = entries[entry];
+        const char *ip = arena.data() + e.offset + redirectPrefix.size();
+        return CorrelatedServer{std::string_view(ip + e.ipLength + 1 + e.portLength, e.resourceLength),
+                                std::string_view(ip, e.ipLength),
+                                std::string_view(ip + e.ipLength + 1, e.portLength),
+                                std::string_view(ip, e.ipLength + 1 + e.portLength)};
+    }
+
+    // Returns serialized 302 response pointing to the correlated server, nothing if resource is unknown.
+    std::optional<std::string_view> findRedirect(std::string_view resource) const {
+        uint32_t entry = findEntry(resource);
+        if (entry == emptySlot) {
+            return {};
+        }
+        return redirectOf(entries[entry]);
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+private:
+    static constexpr uint32_t emptySlot = UINT32_MAX;
+    static constexpr size_t parallelThreshold = 1 << 20;
+    static constexpr std::string_view redirectPrefix = "HTTP/1.1 302 Redirected\r\nLocation: http://";
+    static constexpr std::string_view redirectSuffix = "\r\n\r\n";
+
+    // Position of "<prefix>ip:port resource<suffix>" in the arena.
+    struct Entry {
+        size_t offset;
+        uint32_t ipLength;
+        uint32_t portLength;
+        uint32_t resourceLength;
+    };
+
+    struct Slot {
+        size_t hash;
+        uint32_t entry;
+    };
+
+    struct ParsedChunk {
+        bool valid = true;
+        std::string arena;
+        std::vector<Entry> entries;
+    };
+
+    std::string arena;
+    std::vector<Entry> entries;
+    std::vector<Slot> slots;
+    size_t mask = 0;
+
+    CorrelatedIndex() = default;
+
+    static void appendEntry(std::string &arena, std::vector<Entry> &entries, std::string_view resource,
+                            std::string_view ipAddress, std::string_view port) {
+        entries.push_back(Entry{arena.size(), static_cast<uint32_t>(ipAddress.size()),
+                                static_cast<uint32_t>(port.size()), static_cast<uint32_t>(resource.size())});
+        arena.append(redirectPrefix).append(ipAddress).append(":").append(port).append(resource)
+                .append(redirectSuffix);
+    }
+
+    // Splits content into parts ending right after a newline.
+    static std::vector<size_t> chunkBounds(std::string_view content, unsigned parts) {
+        parts = std::max(1u, parts);
+        std::vector<size_t> bounds = {0};
+        for (unsigned i = 1; i < parts; i++) {
+            size_t newline = content.find('\n', std::max(bounds.back(), content.size() / parts * i));
+            if (newline == std::string_view::npos) {
+                break;
+            }
+            bounds.push_back(newline + 1);
+        }
+        if (bounds.back() != content.size() || bounds.size() == 1) {
+            bounds.push_back(content.size());
+        }
+        return bounds;
+    }
+
+    static ParsedChunk parseChunk(std::string_view content) {
+        ParsedChunk chunk;
+        chunk.arena.reserve(content.size() + content.size() / 8 * (redirectPrefix.size() + redirectSuffix.size()));
+        size_t pos = 0;
+        while (pos < content.size()) {
+            size_t newline = content.find('\n', pos);
+            if (newline == std::string_view::npos) {
+                newline = content.size();
+            }
+            std::string_view tokens[3];
+            if (!correlatedFormat::splitLine(content.substr(pos, newline - pos), tokens)) {
+                chunk.valid = false;
+                return chunk;
+            }
+            appendEntry(chunk.arena, chunk.entries, tokens[0], tokens[1], tokens[2]);
+            pos = newline + 1;
+        }
+        return chunk;
+    }
+
+    std::string_view redirectOf(const Entry &e) const {
+        return std::string_view(arena.data() + e.offset, redirectPrefix.size() + e.ipLength + 1 + e.portLength +
+                                                         e.resourceLength + redirectSuffix.size());
+    }
+
+    std::string_view resourceOf(const Entry &e) const {
+        return std::string_view(arena.data() + e.offset + redirectPrefix.size() + e.ipLength + 1 + e.portLength,
+                                e.resourceLength);
+    }
+
+    static size_t hashOf(std::string_view resource) {
+        return std::hash<std::string_view>()(resource);
+    }
+
+    void buildTable() {
+        size_t capacity = 2;
+        while (capacity < 2 * entries.size()) {
+            capacity *= 2;
+        }
+        slots.assign(capacity, Slot{0, emptySlot});
+        mask = capacity - 1;
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            insert(i);
+        }
+    }
+
+    void insert(uint32_t entry) {
+        std::string_view resource = resourceOf(entries[entry]);
+        size_t hash = hashOf(resource);
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            if (slots[i].entry == emptySlot) {
+                slots[i] = Slot{hash, entry};
+                return;
+            }
+            if (slots[i].hash == hash && resourceOf(entries[slots[i].entry]) == resource) {
+                return;
+            }
+        }
+    }
+
+    uint32_t findEntry(std::string_view resource) const {
+        size_t hash = hashOf(resource);
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            const Slot &slot = slots[i];
+            if (slot.entry == emptySlot) {
+                return emptySlot;
+            }
+            if (slot.hash == hash && resourceOf(entries[slot.entry]) == resource) {
+                return slot.entry;
+            }
+        }
+    }
+};
+
+#endif //ZALICZENIOWE1_CORRELATEDINDEX_H
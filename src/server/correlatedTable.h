@@ -0,0 +1,172 @@
+#ifndef ZALICZENIOWE1_CORRELATEDTABLE_H
+#define ZALICZENIOWE1_CORRELATEDTABLE_H
+
+#include <atomic>
+#include <csignal>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <thread>
+#include <unistd.h>
+
+#include "../utils/serverAssertions.h"
+#include "correlatedIndex.h"
+
+/*
+ * Current CorrelatedIndex of the correlated servers file, replaced as a whole when the file
+ * changes. Readers notice a new index by an atomic generation counter and take it once
+ * (see CorrelatedSnapshot); the old index lives as long as anyone still uses it. The index
+ * is published through an atomic pointer and readers announce themselves in an atomic count
+ * while copying it, so they never wait: it's the publisher which waits for readers which may
+ * still copy the previous pointer before freeing it.
+ * (std::atomic_load of a shared_ptr isn't an option: libstdc++ implements it with a lock.)
+ * */
+class CorrelatedTable {
+public:
+    explicit CorrelatedTable(const std::string &correlatedServersFile) :
+            path(correlatedServersFile),
+            current(new std::shared_ptr<const CorrelatedIndex>(
+                    std::make_shared<const CorrelatedIndex>(CorrelatedIndex::fromFile(correlatedServersFile)))) {}
+
+    CorrelatedTable(const CorrelatedTable &) = delete;
+
+    CorrelatedTable &operator=(const CorrelatedTable &) = delete;
+
+    ~CorrelatedTable() {
+        delete current.load();
+    }
+
+    uint64_t getGeneration() const {
+        return generation.load(std::memory_order_acquire);
+    }
+
+    // Lock-free and wait-free: two atomic read-modify-writes around copying the shared pointer.
+    std::shared_ptr<const CorrelatedIndex> snapshot() const {
+        readers.fetch_add(1, std::memory_order_seq_cst);
+        std::shared_ptr<const CorrelatedIndex> index = *current.load(std::memory_order_seq_cst);
+        readers.fetch_sub(1, std::memory_order_release);
+        return index;
+    }
+
+    void publish(std::shared_ptr<const CorrelatedIndex> index) {
+        std::unique_ptr<std::shared_ptr<const CorrelatedIndex>> previous(
+                current.exchange(new std::shared_ptr<const CorrelatedIndex>(std::move(index)),
+                                 std::memory_order_seq_cst));
+        generation.fetch_add(1, std::memory_order_release);
+        /*
+         * A reader which has loaded the previous pointer was counted before the exchange, so once
+         * no reader is counted it's done copying. Readers only come once per published index, so
+         * this doesn't take long. Previous index is released here, unless a worker still holds it.
+         * */
+        while (readers.load(std::memory_order_seq_cst) != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    /*
+     * Builds a new index from the file and publishes it. A file which can't be parsed is
+     * reported and the previous index stays in use.
+     * */
+    bool reload() {
+        std::string error;
+        std::optional<CorrelatedIndex> index = CorrelatedIndex::tryFromFile(path, error);
+        if (!index) {
+            std::cerr << "Reloading correlated servers failed: " << error << std::endl;
+            return false;
+        }
+        publish(std::make_shared<const CorrelatedIndex>(std::move(index.value())));
+        return true;
+    }
+
+    /*
+     * Reloads the table whenever SIGHUP arrives or the file is rewritten or replaced in its
+     * directory. Never returns. SIGHUP has to be blocked in every thread of the process.
+     * */
+    void watchForChanges() {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGHUP);
+        int signalFd = signalfd(-1, &mask, SFD_CLOEXEC);
+        exit_on_fail_with_errno(signalFd >= 0, "Signalfd() failed.");
+        int notifyFd = inotify_init1(IN_CLOEXEC);
+        std::filesystem::path file(path);
+        std::string dir = file.has_parent_path() ? file.parent_path().string() : ".";
+        if (notifyFd >= 0 && inotify_add_watch(notifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+            close(notifyFd);
+            notifyFd = -1;
+        }
+        const std::string fileName = file.filename().string();
+
+        pollfd fds[2] = {{signalFd, POLLIN, 0}, {notifyFd, POLLIN, 0}};
+        while (true) {
+            if (poll(fds, notifyFd >= 0 ? 2 : 1, -1) < 0) {
+                continue;
+            }
+            bool changed = false;
+            if (fds[0].revents & POLLIN) {
+                signalfd_siginfo info;
+                changed = read(signalFd, &info, sizeof(info)) == sizeof(info);
+            }
+            if (notifyFd >= 0 && (fds[1].revents & POLLIN)) {
+                changed = drainEvents(notifyFd, fileName) || changed;
+            }
+            if (changed) {
+                // Let a writer finish a burst of writes before the file is parsed.
+                while (notifyFd >= 0 && poll(&fds[1], 1, debounceMs) > 0) {
+                    drainEvents(notifyFd, fileName);
+                }
+                reload();
+            }
+        }
+    }
+
+private:
+    static constexpr int debounceMs = 100;
+
+    std::string path;
+    // Owned by the table; replaced, and the previous one freed, only by publish().
+    std::atomic<std::shared_ptr<const CorrelatedIndex> *> current;
+    mutable std::atomic<uint64_t> readers{0};
+    std::atomic<uint64_t> generation{0};
+
+    // Returns whether any of the read events concerns the watched file.
+    static bool drainEvents(int notifyFd, const std::string &fileName) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t len = read(notifyFd, buffer, sizeof(buffer));
+        bool concerned = false;
+        for (char *p = buffer; len > 0 && p < buffer + len;) {
+            auto *event = reinterpret_cast<inotify_event *>(p);
+            concerned = concerned || (event->len > 0 && fileName == event->name);
+            p += sizeof(inotify_event) + event->len;
+        }
+        return concerned;
+    }
+};
+
+/*
+ * Index a single worker serves requests from. Checking for a newer index costs one atomic
+ * load of the generation; the index itself is loaded only once per published index.
+ * */
+class CorrelatedSnapshot {
+public:
+    const std::shared_ptr<const CorrelatedIndex> &get(const CorrelatedTable &table) {
+        uint64_t currentGeneration = table.getGeneration();
+        if (!local || currentGeneration != generation) {
+            std::shared_ptr<const CorrelatedIndex> shared = table.snapshot();
+            // Worker-private control block, so that pinning the index for every queued
+            // response doesn't bounce a shared reference count between cores.
+            local = std::shared_ptr<const CorrelatedIndex>(shared.get(), [shared](const CorrelatedIndex *) {});
+            generation = currentGeneration;
+        }
+        return local;
+    }
+
+private:
+    std::shared_ptr<const CorrelatedIndex> local;
+    uint64_t generation = 0;
+};
+
+#endif //ZALICZENIOWE1_CORRELATEDTABLE_H
@@ -0,0 +1,602 @@
+#ifndef ZALICZENIOWE1_EVENTLOOP_H
+#define ZALICZENIOWE1_EVENTLOOP_H
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../utils/serverAssertions.h"
+#include "asyncFileReader.h"
+#include "connection.h"
+#include "connectionHandler.h"
+#include "metrics.h"
+#include "timerWheel.h"
+#include "upstreamExchange.h"
+#include "workerContext.h"
+
+// Limits on how long a connection may hold server resources without progress, in milliseconds.
+struct ConnectionTimeouts {
+    // Time to receive a whole request, counted from its first byte, so trickling bytes doesn't help.
+    uint64_t headerMs = 10 * 1000;
+    // Time a connection may stay open with no request in progress.
+    uint64_t idleMs = 60 * 1000;
+    // Time the client may leave queued responses unread.
+    uint64_t writeMs = 30 * 1000;
+    // Time to connect to a correlated server in proxy mode, and time it may leave a proxied request unanswered.
+    uint64_t upstreamConnectMs = 1000;
+    uint64_t upstreamMs = 10 * 1000;
+};
+
+/*
+ * Level-triggered epoll loop serving many non-blocking client connections at once.
+ * While a connection has responses waiting to be written, it is not read from,
+ * so a slow reader cannot make the server buffer unbounded amounts of data.
+ * I/O errors only close the affected connection. Timeouts of all connections are kept
+ * in a timer wheel, and accepting pauses for a while when descriptors run out. Files missing
+ * from the page cache are read by an asynchronous file reader, so that a connection waiting
+ * for the disk doesn't hold up the others. In proxy mode, connections to correlated servers
+ * are polled by the same loop, and the idle ones are kept for later requests.
+ * */
+class EventLoop {
+public:
+    // Workers is the number of the server's loops, which split the budget of their file caches.
+    EventLoop(int listenSocket, const ConnectionHandler &handler, WorkerMetrics &metrics, unsigned workers = 1,
+              ConnectionTimeouts timeouts = ConnectionTimeouts()) :
+            listenSocket(listenSocket), handler(handler), context(handler.getFilesDirectory(), metrics, workers),
+            timeouts(timeouts), timers(timerTickMs, timerSlots, TimerWheel<Timer>::clockMs()) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        exit_on_fail_with_errno(epollFd >= 0, "Epoll_create() failed.");
+        setNonBlocking(listenSocket);
+        exit_on_fail_with_errno(watch(listenSocket), "Epoll_ctl() failed.");
+        if (context.fileCache.getNotifyFd() >= 0) {
+            exit_on_fail_with_errno(watch(context.fileCache.getNotifyFd()), "Epoll_ctl() failed.");
+        }
+        exit_on_fail_with_errno(watch(fileReader.getEventFd()), "Epoll_ctl() failed.");
+    }
+
+    EventLoop(const EventLoop &) = delete;
+
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    ~EventLoop() {
+        connections.clear();
+        for (const auto &idle : idleUpstreamSockets) {
+            close(idle.first);
+        }
+        close(epollFd);
+    }
+
+    // Also accepts connections speaking TLS on socket, configured by tlsContext.
+    void listenTls(int socket, std::shared_ptr<const TlsContext> tlsContext) {
+        tlsListenSocket = socket;
+        this->tlsContext = std::move(tlsContext);
+        setNonBlocking(socket);
+        exit_on_fail_with_errno(watch(socket), "Epoll_ctl() failed.");
+    }
+
+    // Makes handled requests be recorded into ring, or not at all if it's null.
+    void setAccessLog(AccessLogRing *ring) {
+        context.accessLog = ring;
+    }
+
+    void run() {
+        while (true) {
+            runOnce();
+        }
+    }
+
+    // Waits for events once and handles them.
+    void runOnce() {
+        epoll_event events[maxEvents];
+        // Without connections and with accepting enabled there's nothing to time out.
+        int timeout = connections.empty() && acceptResumeMs == 0 ? -1 : static_cast<int>(timerTickMs);
+        int ready = epoll_wait(epollFd, events, maxEvents, timeout);
+        if (ready < 0 && errno == EINTR) {
+            return;
+        }
+        exit_on_fail_with_errno(ready >= 0, "Epoll_wait() failed.");
+        for (int i = 0; i < ready; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listenSocket || fd == tlsListenSocket) {
+                acceptConnections(fd);
+                continue;
+            }
+            if (fd == context.fileCache.getNotifyFd()) {
+                context.fileCache.processEvents();
+                continue;
+            }
+            if (fd == fileReader.getEventFd()) {
+                handleFileReads();
+                continue;
+            }
+            if (auto upstream = upstreamClients.find(fd); upstream != upstreamClients.end()) {
+                handleUpstream(*connections.at(upstream->second));
+                continue;
+            }
+            if (idleUpstreamSockets.count(fd) > 0) { // Closed by the server or sending unasked for data.
+                dropIdleUpstream(fd);
+                continue;
+            }
+            auto it = connections.find(fd);
+            if (it == connections.end()) {
+                continue;
+            }
+            Connection &conn = *it->second;
+            if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) {
+                closeConnection(fd, WorkerMetrics::CloseReason::Reset);
+                continue;
+            }
+            if (conn.isHandshaking()) {
+                continueHandshake(conn);
+            } else if (events[i].events & EPOLLOUT) {
+                handleWritable(conn);
+            } else if (events[i].events & EPOLLIN) {
+                handleReadable(conn);
+            }
+        }
+        handleTimeouts();
+        // Reads requested by all connections handled above are submitted at once.
+        fileReader.submit();
+    }
+
+private:
+    static constexpr int maxEvents = 256;
+    static constexpr size_t readChunkSize = 16 * 1024;
+    static constexpr uint64_t timerTickMs = 100;
+    static constexpr size_t timerSlots = 1024;
+    static constexpr uint64_t acceptBackoffMs = 100;
+    static constexpr size_t maxIdleUpstreamSockets = 16;
+
+    // Timer of a connection; it's stale once the connection is gone or has rescheduled.
+    struct Timer {
+        int fd;
+        uint64_t connectionId;
+    };
+
+    int epollFd;
+    int listenSocket;
+    int tlsListenSocket = -1;
+    std::shared_ptr<const TlsContext> tlsContext;
+    const ConnectionHandler &handler;
+    WorkerContext context;
+    ConnectionTimeouts timeouts;
+    TimerWheel<Timer> timers;
+    // Declared before connections, which release its buffers.
+    AsyncFileReader fileReader;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    uint64_t nextConnectionId = 1;
+    // Time at which accepting is resumed after running out of descriptors, 0 when not paused.
+    uint64_t acceptResumeMs = 0;
+    // Sockets of proxied requests in progress, mapped to sockets of their clients.
+    std::unordered_map<int, int> upstreamClients;
+    // Idle keep-alive connections to correlated servers, by server, and the server of each of them.
+    std::unordered_map<const Upstream *, std::vector<int>> idleUpstreams;
+    std::unordered_map<int, const Upstream *> idleUpstreamSockets;
+
+    bool watch(int fd) {
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) >= 0;
+    }
+
+    static void setNonBlocking(int fd) {
+        int flags = fcntl(fd, F_GETFL, 0);
+        exit_on_fail_with_errno(flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0, "Fcntl() failed.");
+    }
+
+    void setListening(uint32_t events) {
+        for (int socket : {listenSocket, tlsListenSocket}) {
+            if (socket < 0) {
+                continue;
+            }
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.fd = socket;
+            exit_on_fail_with_errno(epoll_ctl(epollFd, EPOLL_CTL_MOD, socket, &ev) >= 0, "Epoll_ctl() failed.");
+        }
+    }
+
+    void acceptConnections(int listener) {
+        while (true) {
+            sockaddr_in client_address;
+            socklen_t client_address_len = sizeof(client_address);
+            int msg_sock = accept4(listener, (struct sockaddr *) &client_address, &client_address_len,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (msg_sock < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                // Out of descriptors or memory: the pending connection would be reported again
+                // immediately, so the listening socket isn't polled for a while.
+                bool exhausted = errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM;
+                context.metrics.countAcceptError(exhausted);
+                if (exhausted) {
+                    setListening(0);
+                    acceptResumeMs = TimerWheel<Timer>::clockMs() + acceptBackoffMs;
+                    return;
+                }
+                continue; // Connection aborted by the client before it was accepted.
+            }
+            std::unique_ptr<TlsSession> tls;
+            if (listener == tlsListenSocket) {
+                tls = std::make_unique<TlsSession>(*tlsContext, msg_sock);
+            }
+            if ((tls && !tls->isValid()) || !watch(msg_sock)) {
+                close(msg_sock);
+                context.metrics.countAcceptError(false);
+                continue;
+            }
+            auto conn = std::make_unique<Connection>(msg_sock);
+            if (tls) {
+                conn->setTls(std::move(tls));
+                conn->requestStart = TimerWheel<Timer>::clockMs();
+            }
+            conn->pollEvents = EPOLLIN;
+            conn->id = nextConnectionId++;
+            conn->setFileReader(&fileReader);
+            conn->lastProgress = TimerWheel<Timer>::clockMs();
+            Connection &added = *connections.emplace(msg_sock, std::move(conn)).first->second;
+            context.metrics.connectionOpened();
+            updateDeadline(added);
+        }
+    }
+
+    void handleReadable(Connection &conn) {
+        ReceiveBuffer &input = conn.getInput();
+        bool requestInProgress = !input.empty();
+        ssize_t len = conn.receive(input.prepare(readChunkSize), readChunkSize);
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        if (len < 0) {
+            closeConnection(conn.getSocket(), errno == ECONNRESET || errno == ETIMEDOUT
+                                              ? WorkerMetrics::CloseReason::Reset
+                                              : WorkerMetrics::CloseReason::ReadError);
+            return;
+        }
+        if (len == 0) { // Client has closed its side of the connection.
+            closeConnection(conn.getSocket(), WorkerMetrics::CloseReason::PeerClosed);
+            return;
+        }
+        input.commit(len);
+        // Bytes already decrypted by the TLS session wouldn't make the socket readable again.
+        while (conn.hasBufferedInput() && (len = conn.receive(input.prepare(readChunkSize), readChunkSize)) > 0) {
+            input.commit(len);
+        }
+        conn.lastProgress = TimerWheel<Timer>::clockMs();
+        if (!requestInProgress) {
+            conn.requestStart = conn.lastProgress;
+        }
+        handleRequests(conn);
+        handleWritable(conn);
+    }
+
+    void handleRequests(Connection &conn) {
+        size_t buffered = conn.getInput().size();
+        handler.handleIncomingConnection(conn, context);
+        if (conn.getInput().size() < buffered) { // The next request starts with what's left.
+            conn.requestStart = TimerWheel<Timer>::clockMs();
+        }
+        if (conn.upstream && !conn.upstream->isStarted()) {
+            conn.upstream->startedAt = WorkerMetrics::now();
+            conn.upstream->startedMs = TimerWheel<Timer>::clockMs();
+            if (!connectUpstream(conn)) {
+                failUpstream(conn, false);
+            }
+        }
+    }
+
+    /*
+     * Flushes queued responses. Once everything is written either the connection is closed
+     * or requests already buffered are handled and reading is resumed.
+     * */
+    void handleWritable(Connection &conn) {
+        int fd = conn.getSocket();
+        while (true) {
+            uint64_t start = WorkerMetrics::now();
+            bool flushed = conn.flush();
+            context.metrics.recordSince(WorkerMetrics::Phase::Send, start);
+            if (uint64_t sent = conn.takeSentBytes()) {
+                context.metrics.countSentBytes(sent);
+                conn.lastProgress = TimerWheel<Timer>::clockMs();
+            }
+            if (!flushed) {
+                closeConnection(fd, WorkerMetrics::CloseReason::WriteError);
+                return;
+            }
+            if (conn.isWaitingForFile()) {
+                setInterest(conn, 0);
+                updateDeadline(conn);
+                return;
+            }
+            if (conn.isWaitingForUpstream()) {
+                // More of the response is received only once the client has taken what's queued.
+                UpstreamExchange &exchange = *conn.upstream;
+                setInterest(conn, conn.hasPendingOutput() ? EPOLLOUT : 0);
+                setUpstreamInterest(exchange, exchange.wantsWrite() ? EPOLLOUT
+                                                                    : conn.hasPendingOutput() ? 0 : EPOLLIN);
+                updateDeadline(conn);
+                return;
+            }
+            if (conn.hasPendingOutput()) {
+                setInterest(conn, EPOLLOUT);
+                updateDeadline(conn);
+                return;
+            }
+            if (conn.shouldCloseAfterFlush()) {
+                closeConnection(fd, WorkerMetrics::CloseReason::Completed);
+                return;
+            }
+            handleRequests(conn);
+            if (!conn.hasPendingOutput() && !conn.isWaitingForUpstream()) {
+                break;
+            }
+        }
+        setInterest(conn, EPOLLIN);
+        updateDeadline(conn);
+    }
+
+    // Resumes sending responses of connections whose file reads have completed.
+    void handleFileReads() {
+        fileReader.processCompletions([this](const AsyncFileReader::Completion &read) {
+            context.metrics.recordSince(WorkerMetrics::Phase::DiskRead, read.requestedAt);
+            auto it = connections.find(read.socket);
+            if (it == connections.end() || it->second->id != read.connectionId) {
+                fileReader.release(read.buffer);
+                return;
+            }
+            if (!it->second->completeFileRead(read.buffer, read.result)) {
+                closeConnection(read.socket, WorkerMetrics::CloseReason::FileError);
+                return;
+            }
+            handleWritable(*it->second);
+        });
+    }
+
+    // Carries on the TLS handshake of a connection; it has to be done within the header timeout.
+    void continueHandshake(Connection &conn) {
+        TlsSession::Status status = conn.continueHandshake();
+        if (status == TlsSession::Status::Failed) {
+            closeConnection(conn.getSocket(), WorkerMetrics::CloseReason::TlsError);
+            return;
+        }
+        if (status == TlsSession::Status::Done) {
+            context.metrics.countTlsHandshake(conn.getTls()->isResumed(), conn.getTls()->sendsInKernel());
+            conn.lastProgress = TimerWheel<Timer>::clockMs();
+        }
+        setInterest(conn, status == TlsSession::Status::WantWrite ? EPOLLOUT : EPOLLIN);
+        updateDeadline(conn);
+    }
+
+    // Carries on the proxied request of a connection whose upstream socket is ready.
+    void handleUpstream(Connection &conn) {
+        UpstreamExchange &exchange = *conn.upstream;
+        std::string data;
+        UpstreamExchange::Status status = exchange.wantsWrite() ? exchange.handleWritable()
+                                                                : exchange.handleReadable(data);
+        if (status == UpstreamExchange::Status::Failed) {
+            if (failUpstream(conn, true)) {
+                handleWritable(conn);
+            }
+            return;
+        }
+        conn.lastProgress = TimerWheel<Timer>::clockMs();
+        if (!data.empty()) {
+            conn.queue(std::move(data));
+        }
+        if (status == UpstreamExchange::Status::Done) {
+            finishUpstream(conn);
+        }
+        handleWritable(conn);
+    }
+
+    // Sends the proxied request over an idle connection to the server, if there's one, or over a new one.
+    bool connectUpstream(Connection &conn) {
+        UpstreamExchange &exchange = *conn.upstream;
+        int pooled = takeIdleUpstream(exchange.getUpstream());
+        if (!exchange.start(pooled)) {
+            return false;
+        }
+        if (pooled >= 0) {
+            context.metrics.countReusedUpstreamConnection();
+        }
+        epoll_event ev{};
+        ev.events = EPOLLOUT;
+        ev.data.fd = exchange.getSocket();
+        if (epoll_ctl(epollFd, pooled >= 0 ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, exchange.getSocket(), &ev) < 0) {
+            return false;
+        }
+        exchange.pollEvents = EPOLLOUT;
+        upstreamClients[exchange.getSocket()] = conn.getSocket();
+        return true;
+    }
+
+    void finishUpstream(Connection &conn) {
+        UpstreamExchange &exchange = *conn.upstream;
+        context.metrics.recordSince(WorkerMetrics::Phase::Upstream, exchange.startedAt);
+        context.metrics.countUpstream(WorkerMetrics::UpstreamResult::Proxied);
+        context.metrics.countResponse(exchange.getStatusCode());
+        logProxied(exchange, exchange.getStatusCode(), exchange.getForwardedBytes());
+        upstreamClients.erase(exchange.getSocket());
+        if (exchange.closesClient()) {
+            conn.setCloseAfterFlush();
+        }
+        if (exchange.isReusable()) {
+            poolUpstream(exchange.getUpstream(), exchange.releaseSocket());
+        }
+        conn.upstream.reset();
+    }
+
+    /*
+     * Gives up on the proxied request of a connection. With retry, a reused connection which has
+     * failed before receiving anything, most likely closed by the server while idle, is replaced
+     * by another one. Otherwise the server is marked down, and the client gets the fallback response
+     * or, if a part of the response has been passed on already, is disconnected. Returns false if
+     * the client connection has been closed.
+     * */
+    bool failUpstream(Connection &conn, bool retry) {
+        UpstreamExchange &exchange = *conn.upstream;
+        upstreamClients.erase(exchange.getSocket());
+        if (retry && exchange.isReused() && !exchange.hasReceived() && connectUpstream(conn)) {
+            return true;
+        }
+        exchange.getUpstream().setHealthy(false);
+        context.metrics.countUpstream(WorkerMetrics::UpstreamResult::Failed);
+        if (exchange.hasForwarded()) {
+            closeConnection(conn.getSocket(), WorkerMetrics::CloseReason::UpstreamError);
+            return false;
+        }
+        context.metrics.countUpstream(WorkerMetrics::UpstreamResult::Fallback);
+        context.metrics.countResponse(exchange.getFallbackStatus());
+        logProxied(exchange, exchange.getFallbackStatus(), exchange.getFallback().size());
+        conn.queue(exchange.getFallback());
+        conn.upstream.reset();
+        return true;
+    }
+
+    // Proxied requests are logged once their exchange is over; status is empty if no response was completed.
+    void logProxied(const UpstreamExchange &exchange, std::string_view status, uint64_t bytes) {
+        context.logAccess(AccessEntry{exchange.getMethod(), exchange.getTarget(), status,
+                                      exchange.getUpstream().getName(), bytes, exchange.startedAt});
+    }
+
+    int takeIdleUpstream(const Upstream &upstream) {
+        auto it = idleUpstreams.find(&upstream);
+        if (it == idleUpstreams.end() || it->second.empty()) {
+            return -1;
+        }
+        int fd = it->second.back();
+        it->second.pop_back();
+        idleUpstreamSockets.erase(fd);
+        return fd;
+    }
+
+    // Keeps a connection for later requests. It's polled for input, which only arrives when it's closed.
+    void poolUpstream(const Upstream &upstream, int fd) {
+        std::vector<int> &idle = idleUpstreams[&upstream];
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (idle.size() >= maxIdleUpstreamSockets || epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev) < 0) {
+            close(fd);
+            return;
+        }
+        idle.push_back(fd);
+        idleUpstreamSockets[fd] = &upstream;
+    }
+
+    void dropIdleUpstream(int fd) {
+        std::vector<int> &idle = idleUpstreams[idleUpstreamSockets.at(fd)];
+        idle.erase(std::find(idle.begin(), idle.end(), fd));
+        idleUpstreamSockets.erase(fd);
+        close(fd);
+    }
+
+    void setUpstreamInterest(UpstreamExchange &exchange, uint32_t events) {
+        if (exchange.pollEvents == events) {
+            return;
+        }
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = exchange.getSocket();
+        exit_on_fail_with_errno(epoll_ctl(epollFd, EPOLL_CTL_MOD, exchange.getSocket(), &ev) >= 0,
+                                "Epoll_ctl() failed.");
+        exchange.pollEvents = events;
+    }
+
+    void setInterest(Connection &conn, uint32_t events) {
+        if (conn.pollEvents == events) {
+            return;
+        }
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.fd = conn.getSocket();
+        exit_on_fail_with_errno(epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.getSocket(), &ev) >= 0,
+                                "Epoll_ctl() failed.");
+        conn.pollEvents = events;
+    }
+
+    uint64_t deadlineOf(const Connection &conn) const {
+        if (conn.hasPendingOutput()) {
+            return conn.lastProgress + timeouts.writeMs;
+        }
+        if (conn.isHandshaking()) {
+            return conn.requestStart + timeouts.headerMs;
+        }
+        if (conn.upstream) {
+            return conn.upstream->isConnected() ? conn.lastProgress + timeouts.upstreamMs
+                                                : conn.upstream->startedMs + timeouts.upstreamConnectMs;
+        }
+        if (!conn.getInput().empty()) {
+            return conn.requestStart + timeouts.headerMs;
+        }
+        return conn.lastProgress + timeouts.idleMs;
+    }
+
+    /*
+     * Timers are never cancelled. A later deadline is picked up when the current timer fires,
+     * only an earlier one needs a new timer, which makes the old one stale.
+     * */
+    void updateDeadline(Connection &conn) {
+        uint64_t deadline = deadlineOf(conn);
+        if (conn.scheduledDeadline == 0 || deadline < conn.scheduledDeadline) {
+            conn.scheduledDeadline = deadline;
+            timers.schedule(deadline, Timer{conn.getSocket(), conn.id});
+        }
+    }
+
+    void handleTimeouts() {
+        uint64_t now = TimerWheel<Timer>::clockMs();
+        if (acceptResumeMs != 0 && now >= acceptResumeMs) {
+            acceptResumeMs = 0;
+            setListening(EPOLLIN);
+        }
+        timers.advance(now, [this, now](const Timer &timer, uint64_t deadline) {
+            auto it = connections.find(timer.fd);
+            if (it == connections.end() || it->second->id != timer.connectionId ||
+                it->second->scheduledDeadline != deadline) {
+                return;
+            }
+            Connection &conn = *it->second;
+            conn.scheduledDeadline = 0;
+            if (deadlineOf(conn) > now) {
+                updateDeadline(conn);
+                return;
+            }
+            if (conn.upstream && !conn.hasPendingOutput()) {
+                if (failUpstream(conn, false)) {
+                    handleWritable(conn);
+                }
+                return;
+            }
+            bool idle = conn.getInput().empty() && !conn.isHandshaking();
+            closeConnection(timer.fd, conn.hasPendingOutput() ? WorkerMetrics::CloseReason::WriteTimeout :
+                                      idle ? WorkerMetrics::CloseReason::IdleTimeout
+                                           : WorkerMetrics::CloseReason::HeaderTimeout);
+        });
+    }
+
+    void closeConnection(int fd, WorkerMetrics::CloseReason reason) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) {
+            return;
+        }
+        if (it->second->upstream) {
+            // The response has broken off, or the client has left before it came.
+            logProxied(*it->second->upstream, {}, it->second->upstream->getForwardedBytes());
+            upstreamClients.erase(it->second->upstream->getSocket());
+        }
+        // Closing the socket removes it from the epoll set, and so does destroying the upstream exchange.
+        connections.erase(it);
+        context.metrics.connectionClosed(reason);
+    }
+};
+
+#endif //ZALICZENIOWE1_EVENTLOOP_H
@@ -0,0 +1,457 @@
+#ifndef ZALICZENIOWE1_FILECACHE_H
+#define ZALICZENIOWE1_FILECACHE_H
+
+#include <algorithm>
+#include <filesystem>
+#include <fcntl.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "fileMetadata.h"
+
+/*
+ * Complete 200 response for a regular file: serialized status line with headers and the
+ * body, either copied into memory or, for bigger files, mapped from the page cache. Files
+ * too big to be mapped keep only their open descriptor, so they're sent with sendfile()
+ * without resolving the path again. Metadata is kept for conditional and range requests.
+ * Mapped bodies keep the descriptor of the file too: touching a mapping of a file truncated
+ * meanwhile raises SIGBUS, so whatever reads the body in userspace reads the file instead.
+ * */
+class CachedResponse {
+public:
+    // Marks a compressed variant which isn't available, so that it isn't looked for again.
+    CachedResponse() : missing(true) {}
+
+    CachedResponse(FileMetadata metadata, std::string body) :
+            metadata(std::move(metadata)), header(this->metadata.okHeader()), body(std::move(body)) {}
+
+    CachedResponse(FileMetadata metadata, void *mapping, size_t mappingSize, int mappedFd) :
+            metadata(std::move(metadata)), header(this->metadata.okHeader()), mapping(mapping),
+            mappingSize(mappingSize), mappedFd(mappedFd) {}
+
+    CachedResponse(FileMetadata metadata, int fileFd) :
+            metadata(std::move(metadata)), header(this->metadata.okHeader()), fileFd(fileFd) {}
+
+    // Body in memory kept alive by storage, e.g. a mapped content pack.
+    CachedResponse(FileMetadata metadata, std::shared_ptr<const void> storage, std::string_view body) :
+            metadata(std::move(metadata)), header(this->metadata.okHeader()), storage(std::move(storage)),
+            external(body) {}
+
+    CachedResponse(const CachedResponse &) = delete;
+
+    CachedResponse &operator=(const CachedResponse &) = delete;
+
+    ~CachedResponse() {
+        if (mapping != nullptr) {
+            munmap(mapping, mappingSize);
+            close(mappedFd);
+        }
+        if (fileFd >= 0) {
+            close(fileFd);
+        }
+    }
+
+    bool isMissing() const {
+        return missing;
+    }
+
+    // Descriptor the body has to be sent from, -1 if the body is in memory.
+    int getFileFd() const {
+        return fileFd;
+    }
+
+    // Descriptor of the file the body is mapped from, -1 if it isn't mapped.
+    int getMappedFd() const {
+        return mappedFd;
+    }
+
+    const FileMetadata &getMetadata() const {
+        return metadata;
+    }
+
+    std::string_view getHeader() const {
+        return header;
+    }
+
+    std::string_view getBody() const {
+        if (mapping != nullptr) {
+            return std::string_view(static_cast<const char *>(mapping), mappingSize);
+        }
+        if (storage) {
+            return external;
+        }
+        return body;
+    }
+
+private:
+    FileMetadata metadata;
+    std::string header;
+    std::string body;
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    int mappedFd = -1;
+    std::shared_ptr<const void> storage;
+    std::string_view external;
+    int fileFd = -1;
+    bool missing = false;
+};
+
+/*
+ * Size-bounded LRU cache of responses keyed by request target, owned by a single worker.
+ * A hit costs no filesystem syscalls, neither path resolution nor stat. Every directory
+ * between the served directory and a cached file is watched with inotify, and any change
+ * below it drops affected entries. Files reached through symlinks are never cached, as
+ * changes of the link target wouldn't be noticed. Compressed variants of a file are cached
+ * under their own keys and depend on the file, so they're dropped together with it.
+ * Every worker has its own cache, so the server's budgets are split between them.
+ * */
+class FileCache {
+public:
+    // Budgets of all workers' caches together: bytes of bodies, and descriptors of files too big to be loaded.
+    static constexpr size_t totalCapacityBytes = 64 << 20;
+    static constexpr size_t totalDescriptors = 256;
+    static constexpr size_t defaultMaxEntryBytes = 8 << 20;
+
+    // Cache of one of the given number of workers, with an equal share of the budgets.
+    static FileCache forWorker(const std::string &filesDirectory, unsigned workers) {
+        return FileCache(filesDirectory, totalCapacityBytes / workers, defaultMaxEntryBytes,
+                         totalDescriptors / workers);
+    }
+
+    FileCache(const std::string &filesDirectory, size_t capacityBytes = totalCapacityBytes,
+              size_t maxEntryBytes = defaultMaxEntryBytes, size_t maxDescriptors = totalDescriptors) :
+            capacityBytes(capacityBytes), maxEntryBytes(maxEntryBytes), maxDescriptors(maxDescriptors) {
+        std::error_code ec;
+        baseDir = std::filesystem::weakly_canonical(std::filesystem::absolute(filesDirectory, ec), ec).string();
+        if (!baseDir.empty() && baseDir.back() == '/') {
+            baseDir.pop_back();
+        }
+        notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+
+    FileCache(const FileCache &) = delete;
+
+    FileCache &operator=(const FileCache &) = delete;
+
+    ~FileCache() {
+        if (notifyFd >= 0) {
+            close(notifyFd);
+        }
+    }
+
+    // Descriptor which becomes readable when watched directories change, -1 if inotify is unavailable.
+    int getNotifyFd() const {
+        return notifyFd;
+    }
+
+    // Key of the variant of requestTarget with given content coding; ':' never appears in request targets.
+    static std::string variantKey(std::string_view requestTarget, std::string_view coding) {
+        return std::string(coding) + ":" + std::string(requestTarget);
+    }
+
+    // Lookups compose the key in a reused string, so finding a hot entry doesn't allocate.
+    std::shared_ptr<const CachedResponse> find(std::string_view key) {
+        lookupKey.assign(key);
+        return findLookupKey();
+    }
+
+    // Same as find(variantKey(requestTarget, coding)).
+    std::shared_ptr<const CachedResponse> findVariant(std::string_view requestTarget, std::string_view coding) {
+        lookupKey.assign(coding).append(":").append(requestTarget);
+        return findLookupKey();
+    }
+
+    /*
+     * Tries to cache the regular file fd described by metadata served under requestTarget. Files
+     * bigger than maxEntryBytes are cached by a duplicate of fd and don't count towards capacity.
+     * Returns cached response or nullptr if the file can't be cached.
+     * */
+    std::shared_ptr<const CachedResponse> insert(const std::string &requestTarget, int fd,
+                                                 const FileMetadata &metadata) {
+        return insert(requestTarget, {requestTarget}, fd, metadata);
+    }
+
+    /*
+     * Same, but caches the file under key and drops it whenever any of the files served under
+     * sources changes, e.g. a precompressed sibling together with the file it's made of.
+     * */
+    std::shared_ptr<const CachedResponse> insert(const std::string &key, const std::vector<std::string> &sources,
+                                                 int fd, const FileMetadata &metadata) {
+        size_t size = metadata.size;
+        bool byDescriptor = size > maxEntryBytes;
+        std::vector<std::string> paths;
+        if ((byDescriptor ? maxDescriptors == 0 : size > capacityBytes) || !watchSources(sources, paths)) {
+            return nullptr;
+        }
+        // Watches are installed before reading, so a concurrent modification still invalidates the entry.
+        std::shared_ptr<const CachedResponse> response = byDescriptor ? keepDescriptor(fd, metadata) : load(fd, metadata);
+        if (!response) {
+            return nullptr;
+        }
+        add(key, paths, response, byDescriptor);
+        return response;
+    }
+
+    /*
+     * Caches a response built in memory, e.g. a file compressed on the fly, or a missing variant
+     * marker, under key, depending on files served under sources. Returns whether it's been cached.
+     * */
+    bool insert(const std::string &key, const std::vector<std::string> &sources,
+                std::shared_ptr<const CachedResponse> response) {
+        std::vector<std::string> paths;
+        if (response->getBody().size() > std::min(maxEntryBytes, capacityBytes) || !watchSources(sources, paths)) {
+            return false;
+        }
+        add(key, paths, std::move(response), false);
+        return true;
+    }
+
+    /*
+     * Whether a response of up to bytes built in memory and depending on files served under sources
+     * could be cached, so that work which is only worth it once, like compression, can be skipped.
+     * */
+    bool accepts(const std::vector<std::string> &sources, size_t bytes) {
+        std::vector<std::string> paths;
+        return bytes <= std::min(maxEntryBytes, capacityBytes) && watchSources(sources, paths);
+    }
+
+    // Drops entries affected by changes reported by inotify.
+    void processEvents() {
+        alignas(inotify_event) char buffer[16 * 1024];
+        ssize_t len;
+        while ((len = read(notifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char *p = buffer; p < buffer + len;) {
+                auto *event = reinterpret_cast<inotify_event *>(p);
+                handleEvent(*event);
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+private:
+    static constexpr size_t mmapThreshold = 256 * 1024;
+    static constexpr uint32_t watchedEvents = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                                              IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+    struct Entry {
+        std::string key;
+        size_t size;
+        bool byDescriptor;
+        std::shared_ptr<const CachedResponse> response;
+        std::vector<std::multimap<std::string, std::string>::iterator> pathIndexIts;
+    };
+
+    std::string baseDir;
+    size_t capacityBytes;
+    size_t maxEntryBytes;
+    size_t maxDescriptors;
+    size_t usedBytes = 0;
+    size_t usedDescriptors = 0;
+    int notifyFd;
+    std::list<Entry> lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+    // Filesystem paths every entry depends on, sorted so that all entries below a directory form a range.
+    std::multimap<std::string, std::string> pathIndex;
+    std::unordered_map<int, std::string> watchedDirs;
+    std::unordered_map<std::string, int> watchDescriptors;
+    std::string lookupKey;
+
+    std::shared_ptr<const CachedResponse> findLookupKey() {
+        auto it = entries.find(lookupKey);
+        if (it == entries.end()) {
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        return it->second->response;
+    }
+
+    // Resolves request targets to paths and watches their directories; fails for paths through symlinks.
+    bool watchSources(const std::vector<std::string> &sources, std::vector<std::string> &paths) {
+        if (notifyFd < 0) {
+            return false;
+        }
+        for (const std::string &requestTarget : sources) {
+            std::string path = std::filesystem::path(baseDir + requestTarget).lexically_normal().string();
+            std::error_code ec;
+            if (std::filesystem::weakly_canonical(path, ec).string() != path || ec || !watchAncestors(path)) {
+                return false;
+            }
+            paths.push_back(std::move(path));
+        }
+        return true;
+    }
+
+    void add(const std::string &key, const std::vector<std::string> &paths,
+             std::shared_ptr<const CachedResponse> response, bool byDescriptor) {
+        erase(key);
+        size_t cost = byDescriptor ? 0 : response->getBody().size();
+        while (usedBytes + cost > capacityBytes) {
+            erase(lru.back().key);
+        }
+        while (byDescriptor && usedDescriptors >= maxDescriptors) {
+            auto oldest = std::find_if(lru.rbegin(), lru.rend(), [](const Entry &e) { return e.byDescriptor; });
+            erase(oldest->key);
+        }
+        std::vector<std::multimap<std::string, std::string>::iterator> pathIndexIts;
+        for (const std::string &path : paths) {
+            pathIndexIts.push_back(pathIndex.emplace(path, key));
+        }
+        lru.push_front(Entry{key, cost, byDescriptor, std::move(response), std::move(pathIndexIts)});
+        entries.emplace(key, lru.begin());
+        usedBytes += cost;
+        usedDescriptors += byDescriptor;
+    }
+
+    /*
+     * Reads without waiting for the disk, as the worker mustn't block on it: a file which isn't
+     * in the page cache yet isn't cached until serving it from the file has brought it there.
+     * */
+    static ssize_t readWithoutWaiting(int fd, char *buffer, size_t length, off_t offset) {
+        iovec iov{buffer, length};
+        ssize_t bytesRead = preadv2(fd, &iov, 1, offset, RWF_NOWAIT);
+        if (bytesRead < 0 && errno == EOPNOTSUPP) { // Filesystem can't tell.
+            return pread(fd, buffer, length, offset);
+        }
+        return bytesRead;
+    }
+
+    static std::shared_ptr<const CachedResponse> load(int fd, const FileMetadata &metadata) {
+        size_t size = metadata.size;
+        if (size > mmapThreshold) {
+            // Pages of the mapping are faulted in while sending, so the first and the last one are checked.
+            char byte;
+            if (readWithoutWaiting(fd, &byte, 1, 0) < 0 || readWithoutWaiting(fd, &byte, 1, size - 1) < 0) {
+                return nullptr;
+            }
+            // Mapped entries take at least mmapThreshold of capacity each, which bounds descriptors they keep.
+            int mappedFd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+            if (mappedFd < 0) {
+                return nullptr;
+            }
+            void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(mappedFd);
+                return nullptr;
+            }
+            return std::make_shared<const CachedResponse>(metadata, mapping, size, mappedFd);
+        }
+        std::string body(size, '\0');
+        size_t done = 0;
+        while (done < size) {
+            ssize_t bytesRead = readWithoutWaiting(fd, body.data() + done, size - done, done);
+            if (bytesRead <= 0) {
+                return nullptr;
+            }
+            done += bytesRead;
+        }
+        return std::make_shared<const CachedResponse>(metadata, std::move(body));
+    }
+
+    static std::shared_ptr<const CachedResponse> keepDescriptor(int fd, const FileMetadata &metadata) {
+        int kept = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (kept < 0) {
+            return nullptr;
+        }
+        return std::make_shared<const CachedResponse>(metadata, kept);
+    }
+
+    bool watchAncestors(const std::string &path) {
+        for (size_t slash = path.find('/', baseDir.size()); slash != std::string::npos;
+             slash = path.find('/', slash + 1)) {
+            std::string dir = path.substr(0, slash);
+            if (watchDescriptors.count(dir)) {
+                continue;
+            }
+            int wd = inotify_add_watch(notifyFd, dir.c_str(), watchedEvents | IN_ONLYDIR);
+            if (wd < 0 || watchedDirs.count(wd)) { // Same directory reachable by two paths.
+                return false;
+            }
+            watchedDirs.emplace(wd, dir);
+            watchDescriptors.emplace(dir, wd);
+        }
+        return true;
+    }
+
+    void handleEvent(const inotify_event &event) {
+        if (event.mask & IN_Q_OVERFLOW) {
+            clear();
+            return;
+        }
+        auto dir = watchedDirs.find(event.wd);
+        if (dir == watchedDirs.end()) {
+            return;
+        }
+        if (event.mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+            eraseBelow(dir->second);
+            watchDescriptors.erase(dir->second);
+            inotify_rm_watch(notifyFd, event.wd);
+            watchedDirs.erase(dir);
+            return;
+        }
+        if (event.len > 0) {
+            eraseBelow(dir->second + "/" + event.name);
+        }
+    }
+
+    // Erases entries of path itself and of everything below it if it's a directory.
+    void eraseBelow(const std::string &path) {
+        auto range = pathIndex.equal_range(path);
+        eraseRange(range.first, range.second);
+        const std::string prefix = path + "/";
+        auto it = pathIndex.lower_bound(prefix);
+        auto end = it;
+        while (end != pathIndex.end() && end->first.compare(0, prefix.size(), prefix) == 0) {
+            end++;
+        }
+        eraseRange(it, end);
+    }
+
+    void eraseRange(std::multimap<std::string, std::string>::iterator it,
+                    std::multimap<std::string, std::string>::iterator end) {
+        // Erasing an entry removes all of its paths, which may be next in the range.
+        std::vector<std::string> keys;
+        for (; it != end; it++) {
+            keys.push_back(it->second);
+        }
+        for (const std::string &key : keys) {
+            erase(key);
+        }
+    }
+
+    void erase(const std::string &key) {
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            return;
+        }
+        usedBytes -= it->second->size;
+        usedDescriptors -= it->second->byDescriptor;
+        for (auto pathIndexIt : it->second->pathIndexIts) {
+            pathIndex.erase(pathIndexIt);
+        }
+        lru.erase(it->second);
+        entries.erase(it);
+    }
+
+    void clear() {
+        lru.clear();
+        entries.clear();
+        pathIndex.clear();
+        usedBytes = 0;
+        usedDescriptors = 0;
+    }
+};
+
+#endif //ZALICZENIOWE1_FILECACHE_H
@@ -0,0 +1,77 @@
+#ifndef ZALICZENIOWE1_FILEMETADATA_H
+#define ZALICZENIOWE1_FILEMETADATA_H
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/stat.h>
+
+#include "../utils/httpParsers.h"
+#include "../utils/httpRanges.h"
+
+/*
+ * Size and validators of a served regular file. The entity tag is derived from inode
+ * metadata (inode number, size and modification time in nanoseconds), so it changes
+ * whenever the file is replaced or modified, without reading the content.
+ * Compressed variants of a file carry their content coding. Responses of a file which may be
+ * served compressed as well (negotiable) say they vary by Accept-Encoding, even uncompressed,
+ * so that shared caches don't hand one representation to clients asking for another.
+ * */
+struct FileMetadata {
+    uint64_t size = 0;
+    time_t lastModified = 0;
+    std::string etag;
+    std::string lastModifiedDate;
+    std::string contentCoding;
+    bool negotiable = false;
+
+    static FileMetadata of(const struct stat &st) {
+        FileMetadata metadata;
+        metadata.size = st.st_size;
+        metadata.lastModified = st.st_mtim.tv_sec;
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "\"%llx-%llx-%llx\"", (unsigned long long) st.st_ino,
+                 (unsigned long long) st.st_size,
+                 (unsigned long long) st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec);
+        metadata.etag = buffer;
+        metadata.lastModifiedDate = httpRanges::formatHttpDate(metadata.lastModified);
+        return metadata;
+    }
+
+    // Metadata of the file compressed with coding into encodedSize bytes, under its own entity tag.
+    FileMetadata encoded(std::string_view coding, uint64_t encodedSize) const {
+        FileMetadata metadata = *this;
+        metadata.size = encodedSize;
+        metadata.contentCoding = coding;
+        metadata.etag.insert(metadata.etag.size() - 1, "-" + metadata.contentCoding);
+        return metadata;
+    }
+
+    /*
+     * Appends header fields describing the file, shared by 200, 206 and 304 responses, each ended
+     * with \r\n. Appending to a string reused between responses doesn't allocate.
+     * */
+    void appendValidatorFields(std::string &header) const {
+        header.append("Accept-Ranges: bytes\r\nETag: ").append(etag);
+        header.append("\r\nLast-Modified: ").append(lastModifiedDate).append("\r\n");
+        if (!contentCoding.empty()) {
+            header.append("Content-Encoding: ").append(contentCoding).append("\r\n");
+        }
+        if (!contentCoding.empty() || negotiable) {
+            header.append("Vary: Accept-Encoding\r\n");
+        }
+    }
+
+    std::string okHeader() const {
+        std::string header = HttpMessage::generateResponseStatusLine("200", "OK") +
+                             "\r\nContent-Type: application/octet-stream\r\nContent-Length: " +
+                             std::to_string(size) + "\r\n";
+        appendValidatorFields(header);
+        return header + "\r\n";
+    }
+};
+
+#endif //ZALICZENIOWE1_FILEMETADATA_H
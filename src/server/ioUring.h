@@ -0,0 +1,218 @@
+#ifndef ZALICZENIOWE1_IOURING_H
+#define ZALICZENIOWE1_IOURING_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * Minimal io_uring instance driven by raw system calls, so that no library is needed to build
+ * the server. It only reads files: into registered buffers when they could be registered, and
+ * through registered (fixed) files when the kernel assigns files of linked requests at issue time.
+ * Completions are signalled through an eventfd, which lets the ring plug into an epoll loop.
+ * */
+class IoUring {
+public:
+    // user_data of internal requests, whose completions aren't reported.
+    static constexpr uint64_t internalRequest = UINT64_MAX;
+
+    IoUring(unsigned entries, int eventFd) {
+        io_uring_params params{};
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) {
+            return;
+        }
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mapRing(sqRingSize, IORING_OFF_SQ_RING);
+        cqRing = singleMmap ? sqRing : mapRing(cqRingSize, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(mapRing(sqesSize, IORING_OFF_SQES));
+        if (sqRing == nullptr || cqRing == nullptr || sqes == nullptr ||
+            syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_EVENTFD, &eventFd, 1) < 0) {
+            unmap();
+            close(ringFd);
+            ringFd = -1;
+            return;
+        }
+        auto *sq = static_cast<char *>(sqRing);
+        auto *cq = static_cast<char *>(cqRing);
+        sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        linkedFiles = params.features & IORING_FEAT_LINKED_FILE;
+    }
+
+    IoUring(const IoUring &) = delete;
+
+    IoUring &operator=(const IoUring &) = delete;
+
+    ~IoUring() {
+        if (ringFd >= 0) {
+            // Closing the ring cancels requests in flight.
+            close(ringFd);
+            unmap();
+        }
+    }
+
+    bool isValid() const {
+        return ringFd >= 0;
+    }
+
+    // Registration pins the buffers, so it fails beyond RLIMIT_MEMLOCK.
+    bool registerBuffers(const std::vector<iovec> &buffers) {
+        registeredBuffers = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, buffers.data(),
+                                    buffers.size()) >= 0;
+        return registeredBuffers;
+    }
+
+    // Registers a table of empty file slots, filled by linked requests right before reads which use them.
+    bool registerFileSlots(unsigned count) {
+        if (!linkedFiles) {
+            return false;
+        }
+        slotFds.assign(count, -1);
+        fixedFiles = syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES, slotFds.data(), count) >= 0;
+        return fixedFiles;
+    }
+
+    bool usesFixedFiles() const {
+        return fixedFiles;
+    }
+
+    /*
+     * Queues reading length bytes at offset of fd into buffer number slot, submitted with the next
+     * submit(). With fixed files the descriptor is put into the slot of the same number first and
+     * the slot is emptied after the read, so that it doesn't keep the file open.
+     * */
+    void prepareRead(unsigned slot, int fd, void *buffer, size_t length, off_t offset, uint64_t userData) {
+        if (fixedFiles) {
+            slotFds[slot] = fd;
+            io_uring_sqe &update = nextSqe();
+            update.opcode = IORING_OP_FILES_UPDATE;
+            update.fd = -1;
+            update.addr = reinterpret_cast<uint64_t>(&slotFds[slot]);
+            update.len = 1;
+            update.off = slot;
+            update.flags = IOSQE_IO_LINK;
+            update.user_data = internalRequest;
+        }
+        io_uring_sqe &read = nextSqe();
+        read.opcode = registeredBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        read.fd = fixedFiles ? static_cast<int>(slot) : fd;
+        read.flags = fixedFiles ? IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK : 0;
+        read.addr = reinterpret_cast<uint64_t>(buffer);
+        read.len = length;
+        read.off = offset;
+        read.buf_index = registeredBuffers ? slot : 0;
+        read.user_data = userData;
+        if (fixedFiles) {
+            io_uring_sqe &clear = nextSqe();
+            clear.opcode = IORING_OP_FILES_UPDATE;
+            clear.fd = -1;
+            clear.addr = reinterpret_cast<uint64_t>(&emptySlot);
+            clear.len = 1;
+            clear.off = slot;
+            clear.user_data = internalRequest;
+        }
+    }
+
+    // Submits all queued requests with a single system call. Returns false on failure.
+    bool submit() {
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        while (submittedTail != localTail) {
+            long submitted = syscall(__NR_io_uring_enter, ringFd, localTail - submittedTail, 0, 0, nullptr, 0);
+            if (submitted < 0) {
+                return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+            }
+            submittedTail += submitted;
+        }
+        return true;
+    }
+
+    // Calls onCompletion(userData, result) for every completed request but the internal ones.
+    template<typename OnCompletion>
+    void reap(OnCompletion onCompletion) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            uint64_t userData = cqe.user_data;
+            int result = cqe.res;
+            // Entry may be overwritten once head is published, so it's done before the callback.
+            __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            if (userData != internalRequest) {
+                onCompletion(userData, result);
+            }
+        }
+    }
+
+private:
+    int ringFd = -1;
+    void *sqRing = nullptr;
+    void *cqRing = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+    // Tail of queued entries, published to the kernel by submit(), and of those it has taken.
+    unsigned localTail = 0;
+    unsigned submittedTail = 0;
+    bool linkedFiles = false;
+    bool registeredBuffers = false;
+    bool fixedFiles = false;
+    std::vector<int> slotFds;
+    const int emptySlot = -1;
+
+    void *mapRing(size_t size, off_t offset) const {
+        void *ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        return ring == MAP_FAILED ? nullptr : ring;
+    }
+
+    void unmap() {
+        if (sqes != nullptr) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing != nullptr && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != nullptr) {
+            munmap(sqRing, sqRingSize);
+        }
+    }
+
+    io_uring_sqe &nextSqe() {
+        unsigned index = localTail & sqMask;
+        io_uring_sqe &sqe = sqes[index];
+        memset(&sqe, 0, sizeof(sqe));
+        sqArray[index] = index;
+        localTail++;
+        return sqe;
+    }
+};
+
+#endif //ZALICZENIOWE1_IOURING_H
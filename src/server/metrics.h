@@ -0,0 +1,436 @@
+#ifndef ZALICZENIOWE1_METRICS_H
+#define ZALICZENIOWE1_METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <time.h>
+
+#include "../utils/httpEncodings.h"
+
+/*
+ * Latency histogram with HDR-style log-linear buckets: every power of two is split into
+ * 8 sub-buckets, so any recorded value is known with at most 12.5% relative error.
+ * Values are nanoseconds. Written by one thread, readable from any other without locks.
+ * */
+class LatencyHistogram {
+public:
+    static constexpr size_t subBuckets = 8;
+    static constexpr size_t bucketsNum = 320;
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < 2 * subBuckets) {
+            return value;
+        }
+        int shift = 63 - __builtin_clzll(value) - 3;
+        return std::min(bucketsNum - 1, shift * subBuckets + (value >> shift));
+    }
+
+    // Smallest value falling into the bucket after the given one.
+    static uint64_t bucketEnd(size_t bucket) {
+        if (bucket < 2 * subBuckets) {
+            return bucket + 1;
+        }
+        size_t shift = bucket / subBuckets - 1;
+        return (uint64_t) (bucket % subBuckets + subBuckets + 1) << shift;
+    }
+
+    void record(uint64_t value) {
+        increment(buckets[bucketOf(value)], 1);
+        increment(sum, value);
+    }
+
+    uint64_t count(size_t bucket) const {
+        return buckets[bucket].load(std::memory_order_relaxed);
+    }
+
+    uint64_t getSum() const {
+        return sum.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, bucketsNum> buckets{};
+    std::atomic<uint64_t> sum{0};
+
+    // Only the owning thread writes, so a plain load and store replace the locked add.
+    static void increment(std::atomic<uint64_t> &counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    friend class WorkerMetrics;
+};
+
+/*
+ * Counters of a single worker. Only the worker updates them, with relaxed atomic stores,
+ * so serving never waits for anybody; readers sum them up over all workers.
+ * */
+class WorkerMetrics {
+public:
+    enum class Phase {
+        Parse, FileLookup, RedirectLookup, Compress, DiskRead, Upstream, Send
+    };
+    static constexpr size_t phasesNum = 7;
+    static constexpr std::array<std::string_view, 9> statusCodes = {"200", "206", "302", "304", "400", "404",
+                                                                    "416", "431", "501"};
+
+    // Why a connection has been closed; everything but Completed and PeerClosed is an error.
+    enum class CloseReason {
+        Completed, PeerClosed, Reset, ReadError, WriteError, FileError, UpstreamError, HeaderTimeout, IdleTimeout,
+        WriteTimeout, TlsError
+    };
+    static constexpr std::array<std::string_view, 11> closeReasons = {
+            "completed", "peer_closed", "reset", "read_error", "write_error", "file_error", "upstream_error",
+            "header_timeout", "idle_timeout", "write_timeout", "tls_error"};
+
+    // Outcome of a request for a resource of a correlated server in proxy mode.
+    enum class UpstreamResult {
+        Proxied, Fallback, Failed
+    };
+    static constexpr std::array<std::string_view, 3> upstreamResults = {"proxied", "fallback", "failed"};
+
+    // Answer of the target filter for a file lookup: certainly missing, found, or missing after all.
+    enum class FilterResult {
+        Rejected, Found, FalsePositive
+    };
+    static constexpr std::array<std::string_view, 3> filterResults = {"rejected", "found", "false_positive"};
+
+    static uint64_t now() {
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    void recordSince(Phase phase, uint64_t start) {
+        histograms[static_cast<size_t>(phase)].record(now() - start);
+    }
+
+    void countResponse(std::string_view statusCode) {
+        size_t i = 0;
+        while (i < statusCodes.size() && statusCodes[i] != statusCode) {
+            i++;
+        }
+        LatencyHistogram::increment(responses[i], 1);
+    }
+
+    void connectionOpened() {
+        LatencyHistogram::increment(accepted, 1);
+        LatencyHistogram::increment(active, 1);
+    }
+
+    void connectionClosed(CloseReason reason) {
+        LatencyHistogram::increment(active, -1);
+        LatencyHistogram::increment(closed[static_cast<size_t>(reason)], 1);
+    }
+
+    void countAcceptError(bool backedOff) {
+        LatencyHistogram::increment(acceptErrors, 1);
+        LatencyHistogram::increment(acceptBackoffs, backedOff);
+    }
+
+    // Counts a response with a body compressed with one of httpEncodings::supportedCodings.
+    void countEncodedResponse(std::string_view coding) {
+        for (size_t i = 0; i < encodedResponses.size(); i++) {
+            if (httpEncodings::supportedCodings[i].name == coding) {
+                LatencyHistogram::increment(encodedResponses[i], 1);
+            }
+        }
+    }
+
+    void countUpstream(UpstreamResult result) {
+        LatencyHistogram::increment(upstreamRequests[static_cast<size_t>(result)], 1);
+    }
+
+    void countReusedUpstreamConnection() {
+        LatencyHistogram::increment(reusedUpstreamConnections, 1);
+    }
+
+    void countFilterLookup(FilterResult result) {
+        LatencyHistogram::increment(filterLookups[static_cast<size_t>(result)], 1);
+    }
+
+    // Completed TLS handshake; resumed if it's reused an earlier session, offloaded if the kernel encrypts records.
+    void countTlsHandshake(bool resumed, bool offloaded) {
+        LatencyHistogram::increment(tlsHandshakes[resumed ? 1 : 0], 1);
+        if (offloaded) {
+            LatencyHistogram::increment(offloadedTlsConnections, 1);
+        }
+    }
+
+    void countDroppedAccessRecord() {
+        LatencyHistogram::increment(droppedAccessRecords, 1);
+    }
+
+    void countSentBytes(uint64_t bytes) {
+        LatencyHistogram::increment(sentBytes, bytes);
+    }
+
+    const LatencyHistogram &getHistogram(Phase phase) const {
+        return histograms[static_cast<size_t>(phase)];
+    }
+
+    // Index statusCodes.size() counts responses with any other status code.
+    uint64_t getResponses(size_t statusIndex) const {
+        return responses[statusIndex].load(std::memory_order_relaxed);
+    }
+
+    uint64_t getAccepted() const {
+        return accepted.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getActive() const {
+        return active.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getSentBytes() const {
+        return sentBytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getClosed(CloseReason reason) const {
+        return closed[static_cast<size_t>(reason)].load(std::memory_order_relaxed);
+    }
+
+    uint64_t getAcceptErrors() const {
+        return acceptErrors.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getEncodedResponses(size_t codingIndex) const {
+        return encodedResponses[codingIndex].load(std::memory_order_relaxed);
+    }
+
+    uint64_t getAcceptBackoffs() const {
+        return acceptBackoffs.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getUpstreamRequests(UpstreamResult result) const {
+        return upstreamRequests[static_cast<size_t>(result)].load(std::memory_order_relaxed);
+    }
+
+    uint64_t getReusedUpstreamConnections() const {
+        return reusedUpstreamConnections.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getFilterLookups(FilterResult result) const {
+        return filterLookups[static_cast<size_t>(result)].load(std::memory_order_relaxed);
+    }
+
+    uint64_t getTlsHandshakes(bool resumed) const {
+        return tlsHandshakes[resumed ? 1 : 0].load(std::memory_order_relaxed);
+    }
+
+    uint64_t getOffloadedTlsConnections() const {
+        return offloadedTlsConnections.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getDroppedAccessRecords() const {
+        return droppedAccessRecords.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::array<LatencyHistogram, phasesNum> histograms;
+    std::array<std::atomic<uint64_t>, statusCodes.size() + 1> responses{};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> active{0};
+    std::atomic<uint64_t> sentBytes{0};
+    std::array<std::atomic<uint64_t>, closeReasons.size()> closed{};
+    std::atomic<uint64_t> acceptErrors{0};
+    std::atomic<uint64_t> acceptBackoffs{0};
+    std::array<std::atomic<uint64_t>, httpEncodings::supportedCodings.size()> encodedResponses{};
+    std::array<std::atomic<uint64_t>, upstreamResults.size()> upstreamRequests{};
+    std::atomic<uint64_t> reusedUpstreamConnections{0};
+    std::array<std::atomic<uint64_t>, filterResults.size()> filterLookups{};
+    std::array<std::atomic<uint64_t>, 2> tlsHandshakes{};
+    std::atomic<uint64_t> offloadedTlsConnections{0};
+    std::atomic<uint64_t> droppedAccessRecords{0};
+};
+
+/*
+ * Metrics of all workers, rendered in the Prometheus text exposition format.
+ * Workers are added before serving starts; rendering only reads their counters.
+ * */
+class Metrics {
+public:
+    WorkerMetrics &addWorker() {
+        return workers.emplace_back();
+    }
+
+    std::string renderPrometheus() const {
+        std::string out;
+        out += "# HELP serwer_responses_total Responses sent, by status code.\n"
+               "# TYPE serwer_responses_total counter\n";
+        for (size_t i = 0; i <= WorkerMetrics::statusCodes.size(); i++) {
+            std::string code = i < WorkerMetrics::statusCodes.size() ? std::string(WorkerMetrics::statusCodes[i])
+                                                                      : "other";
+            appendSample(out, "serwer_responses_total{code=\"" + code + "\"}",
+                         sum([i](const WorkerMetrics &w) { return w.getResponses(i); }));
+        }
+        out += "# HELP serwer_connections_active Connections currently open.\n"
+               "# TYPE serwer_connections_active gauge\n";
+        appendSample(out, "serwer_connections_active", sum([](const WorkerMetrics &w) { return w.getActive(); }));
+        out += "# HELP serwer_connections_accepted_total Connections accepted.\n"
+               "# TYPE serwer_connections_accepted_total counter\n";
+        appendSample(out, "serwer_connections_accepted_total",
+                     sum([](const WorkerMetrics &w) { return w.getAccepted(); }));
+        out += "# HELP serwer_connections_closed_total Connections closed, by reason.\n"
+               "# TYPE serwer_connections_closed_total counter\n";
+        for (size_t i = 0; i < WorkerMetrics::closeReasons.size(); i++) {
+            auto reason = static_cast<WorkerMetrics::CloseReason>(i);
+            appendSample(out, "serwer_connections_closed_total{reason=\"" +
+                              std::string(WorkerMetrics::closeReasons[i]) + "\"}",
+                         sum([reason](const WorkerMetrics &w) { return w.getClosed(reason); }));
+        }
+        out += "# HELP serwer_accept_errors_total Failed accept() calls.\n"
+               "# TYPE serwer_accept_errors_total counter\n";
+        appendSample(out, "serwer_accept_errors_total", sum([](const WorkerMetrics &w) { return w.getAcceptErrors(); }));
+        out += "# HELP serwer_accept_backoffs_total Pauses of accepting caused by exhausted descriptors or memory.\n"
+               "# TYPE serwer_accept_backoffs_total counter\n";
+        appendSample(out, "serwer_accept_backoffs_total",
+                     sum([](const WorkerMetrics &w) { return w.getAcceptBackoffs(); }));
+        out += "# HELP serwer_sent_bytes_total Bytes written to client sockets.\n"
+               "# TYPE serwer_sent_bytes_total counter\n";
+        appendSample(out, "serwer_sent_bytes_total", sum([](const WorkerMetrics &w) { return w.getSentBytes(); }));
+        out += "# HELP serwer_encoded_responses_total Responses with a compressed body, by content coding.\n"
+               "# TYPE serwer_encoded_responses_total counter\n";
+        for (size_t i = 0; i < httpEncodings::supportedCodings.size(); i++) {
+            appendSample(out, "serwer_encoded_responses_total{coding=\"" +
+                              std::string(httpEncodings::supportedCodings[i].name) + "\"}",
+                         sum([i](const WorkerMetrics &w) { return w.getEncodedResponses(i); }));
+        }
+        out += "# HELP serwer_upstream_requests_total Requests for resources of correlated servers in proxy mode, "
+               "by outcome.\n"
+               "# TYPE serwer_upstream_requests_total counter\n";
+        for (size_t i = 0; i < WorkerMetrics::upstreamResults.size(); i++) {
+            auto result = static_cast<WorkerMetrics::UpstreamResult>(i);
+            appendSample(out, "serwer_upstream_requests_total{result=\"" +
+                              std::string(WorkerMetrics::upstreamResults[i]) + "\"}",
+                         sum([result](const WorkerMetrics &w) { return w.getUpstreamRequests(result); }));
+        }
+        out += "# HELP serwer_upstream_connections_reused_total Proxied requests sent over idle pooled connections.\n"
+               "# TYPE serwer_upstream_connections_reused_total counter\n";
+        appendSample(out, "serwer_upstream_connections_reused_total",
+                     sum([](const WorkerMetrics &w) { return w.getReusedUpstreamConnections(); }));
+        out += "# HELP serwer_target_filter_lookups_total File lookups answered by the target filter, by outcome; "
+               "false_positive / (false_positive + rejected) is its false positive rate.\n"
+               "# TYPE serwer_target_filter_lookups_total counter\n";
+        for (size_t i = 0; i < WorkerMetrics::filterResults.size(); i++) {
+            auto result = static_cast<WorkerMetrics::FilterResult>(i);
+            appendSample(out, "serwer_target_filter_lookups_total{result=\"" +
+                              std::string(WorkerMetrics::filterResults[i]) + "\"}",
+                         sum([result](const WorkerMetrics &w) { return w.getFilterLookups(result); }));
+        }
+        out += "# HELP serwer_tls_handshakes_total Completed TLS handshakes, by whether a session was resumed.\n"
+               "# TYPE serwer_tls_handshakes_total counter\n";
+        appendSample(out, "serwer_tls_handshakes_total{session=\"full\"}",
+                     sum([](const WorkerMetrics &w) { return w.getTlsHandshakes(false); }));
+        appendSample(out, "serwer_tls_handshakes_total{session=\"resumed\"}",
+                     sum([](const WorkerMetrics &w) { return w.getTlsHandshakes(true); }));
+        out += "# HELP serwer_tls_kernel_offload_total TLS connections whose records are encrypted by the kernel.\n"
+               "# TYPE serwer_tls_kernel_offload_total counter\n";
+        appendSample(out, "serwer_tls_kernel_offload_total",
+                     sum([](const WorkerMetrics &w) { return w.getOffloadedTlsConnections(); }));
+        out += "# HELP serwer_access_log_dropped_total Access log records dropped because the log writer fell behind.\n"
+               "# TYPE serwer_access_log_dropped_total counter\n";
+        appendSample(out, "serwer_access_log_dropped_total",
+                     sum([](const WorkerMetrics &w) { return w.getDroppedAccessRecords(); }));
+        renderHistograms(out);
+        return out;
+    }
+
+private:
+    static constexpr std::array<std::string_view, WorkerMetrics::phasesNum> phaseNames = {
+            "parse", "file_lookup", "redirect_lookup", "compress", "disk_read", "upstream", "send"};
+    // Upper bounds of exported buckets, in nanoseconds.
+    static constexpr std::array<uint64_t, 16> exportedBounds = {
+            1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000,
+            10000000, 100000000, 1000000000, 10000000000};
+
+    std::deque<WorkerMetrics> workers;
+
+    template<typename Getter>
+    uint64_t sum(Getter getter) const {
+        uint64_t total = 0;
+        for (const WorkerMetrics &w : workers) {
+            total += getter(w);
+        }
+        return total;
+    }
+
+    static void appendSample(std::string &out, const std::string &name, uint64_t value) {
+        out.append(name).append(" ").append(std::to_string(value)).append("\n");
+    }
+
+    static void appendSample(std::string &out, const std::string &name, double value) {
+        out.append(name).append(" ").append(formatDouble(value)).append("\n");
+    }
+
+    static std::string formatDouble(double value) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return buffer;
+    }
+
+    /*
+     * Exports the fine buckets merged into fixed cumulative ones, as Prometheus expects stable
+     * bucket bounds, and the quantiles computed from the fine buckets as a separate gauge.
+     * */
+    void renderHistograms(std::string &out) const {
+        out += "# HELP serwer_phase_duration_seconds Time spent in a phase of serving a request.\n"
+               "# TYPE serwer_phase_duration_seconds histogram\n";
+        std::string quantiles = "# HELP serwer_phase_duration_quantile_seconds Quantiles of phase durations.\n"
+                                "# TYPE serwer_phase_duration_quantile_seconds gauge\n";
+        for (size_t phase = 0; phase < WorkerMetrics::phasesNum; phase++) {
+            std::array<uint64_t, LatencyHistogram::bucketsNum> merged{};
+            uint64_t total = 0, totalNs = 0;
+            for (const WorkerMetrics &w : workers) {
+                const LatencyHistogram &h = w.getHistogram(static_cast<WorkerMetrics::Phase>(phase));
+                for (size_t b = 0; b < merged.size(); b++) {
+                    merged[b] += h.count(b);
+                }
+                totalNs += h.getSum();
+            }
+            for (uint64_t count : merged) {
+                total += count;
+            }
+            const std::string label = "{phase=\"" + std::string(phaseNames[phase]) + "\"";
+            size_t bucket = 0;
+            uint64_t cumulative = 0;
+            for (uint64_t bound : exportedBounds) {
+                for (; bucket < merged.size() && LatencyHistogram::bucketEnd(bucket) <= bound + 1; bucket++) {
+                    cumulative += merged[bucket];
+                }
+                appendSample(out, "serwer_phase_duration_seconds_bucket" + label + ",le=\"" +
+                                  formatDouble(bound / 1e9) + "\"}", cumulative);
+            }
+            appendSample(out, "serwer_phase_duration_seconds_bucket" + label + ",le=\"+Inf\"}", total);
+            appendSample(out, "serwer_phase_duration_seconds_sum" + label + "}", totalNs / 1e9);
+            appendSample(out, "serwer_phase_duration_seconds_count" + label + "}", total);
+            for (double q : {0.5, 0.99, 0.999}) {
+                appendSample(quantiles, "serwer_phase_duration_quantile_seconds" + label + ",quantile=\"" +
+                                        formatDouble(q) + "\"}", quantile(merged, total, q) / 1e9);
+            }
+        }
+        out += quantiles;
+    }
+
+    // Upper bound of the bucket holding the q-th value.
+    static double quantile(const std::array<uint64_t, LatencyHistogram::bucketsNum> &buckets, uint64_t total,
+                           double q) {
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, q * total + 0.5), seen = 0;
+        for (size_t b = 0; b < buckets.size(); b++) {
+            seen += buckets[b];
+            if (seen >= rank) {
+                return LatencyHistogram::bucketEnd(b) - 1;
+            }
+        }
+        return LatencyHistogram::bucketEnd(buckets.size() - 1);
+    }
+};
+
+#endif //ZALICZENIOWE1_METRICS_H
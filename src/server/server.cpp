@@ -1,9 +1,31 @@
 /*
  * Base server implementation.
- * Server establishes TCP connection with at most one client at the time.
- * Usage: ./server directory_with_files correlated_servers_file [port_num]
- * where default value of port_num is 8080
+ * Server serves many clients at the time. Each worker thread runs its own epoll based
+ * event loop on its own SO_REUSEPORT listening socket, so the kernel spreads incoming
+ * connections between workers. Workers share read-only ConnectionHandler, and each caches
+ * files in memory within an equal share of the server's 64 MiB cache budget.
+ * Correlated servers file is reloaded in the background on SIGHUP or when it changes.
+ * With -m, metrics of all workers are served in Prometheus text format on a separate port.
+ * With -p, resources of correlated servers are fetched from them and passed on instead of redirecting
+ * clients; the servers' health is checked in the background, and while one is down its resources
+ * are answered with a redirect or 404, as chosen by the option's value.
+ * With -k, files packed by ./content_packer are served from the pack, loaded into memory at startup;
+ * files missing from it are looked for in the directory.
+ * With -l, requests are logged in a binary format by a background thread to the given file, rotated
+ * as it grows; ./access_log_decoder prints the records. Records the writer can't keep up with are dropped.
+ * With -n, targets in the files directory are kept in a filter watched with inotify, so requests for
+ * files that certainly don't exist skip the filesystem.
+ * With -s, HTTPS is served on the given port too, with the PEM certificate chain of -c and private key of -y.
+ * Records are encrypted by the kernel when it supports kernel TLS, so files are still sent with sendfile().
+ * Usage: ./server [-w workers_num] [-m metrics_port] [-p redirect|404] [-k content_pack] [-l access_log] [-n]
+ *        [-s https_port -c certificate_file -y private_key_file]
+ *        directory_with_files correlated_servers_file [port_num]
+ * where default value of port_num is 8080 and default value of workers_num is the number of cores;
+ * workers_num is at most 1024.
  * */
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <inttypes.h>
 #include <iostream>
 #include <netinet/in.h>
@@ -11,49 +33,236 @@
 #include <filesystem>
 #include <unistd.h>
 #include <csignal>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "../utils/serverAssertions.h"
 #include "connectionHandler.h"
+#include "eventLoop.h"
 
-void startServer(uint16_t portnum, const std::string &filesDirectory, const std::string &correlatedServersFile) {
-    signal(SIGPIPE, SIG_IGN);
+int createListeningSocket(uint16_t portnum) {
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     exit_on_fail_with_errno(sockfd >= 0, "Socket() failed.");
+    int enable = 1;
+    exit_on_fail_with_errno(setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) >= 0,
+                            "Setsockopt() failed.");
     sockaddr_in address;
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(portnum);
 
-    ConnectionHandler ch(filesDirectory, correlatedServersFile);
     exit_on_fail_with_errno(bind(sockfd, (sockaddr *) &address, sizeof(address)) >= 0, "Bind() error.");
-    exit_on_fail(listen(sockfd, 5) >= 0, "Listen() failed");
+    exit_on_fail(listen(sockfd, SOMAXCONN) >= 0, "Listen() failed");
+    return sockfd;
+}
 
+/*
+ * Answers every connection to the admin socket with current metrics and closes it.
+ * Scrapes are rare, so connections are simply handled one by one. While descriptors or
+ * memory run out, accepting is retried after a pause, like event loops do.
+ * */
+void serveMetrics(int sockfd, const Metrics &metrics) {
+    constexpr std::chrono::milliseconds acceptBackoff(100);
     while (true) {
-        sockaddr_in client_address;
-        socklen_t client_address_len = sizeof(client_address);
-        // Get client connection from the socket.
-        int msg_sock = accept(sockfd, (struct sockaddr *) &client_address, &client_address_len);
-        exit_on_fail_with_errno(msg_sock >= 0, "Accept() error.");
-        ch.handleIncomingConnection(msg_sock);
-        exit_on_fail_with_errno(close(msg_sock) >= 0, "Close(socket) failed.");
+        int msg_sock = accept4(sockfd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (msg_sock < 0) {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // The pending connection would be reported again immediately.
+                std::this_thread::sleep_for(acceptBackoff);
+                continue;
+            }
+            // Interrupted, or the connection failed before it was accepted (EPROTO for an aborted handshake).
+            exit_on_fail_with_errno(errno == EINTR || errno == ECONNABORTED || errno == EPROTO,
+                                    "Accepting metrics connection failed.");
+            continue;
+        }
+        // Request is read only so that closing the socket doesn't reset the connection.
+        timeval timeout{1, 0};
+        setsockopt(msg_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        std::string request;
+        char buffer[4096];
+        ssize_t len;
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 64 * 1024 &&
+               (len = read(msg_sock, buffer, sizeof(buffer))) > 0) {
+            request.append(buffer, len);
+        }
+        std::string body = metrics.renderPrometheus();
+        std::string response = HttpMessage::generateHttpString({HttpMessage::generateResponseStatusLine("200", "OK"),
+                                                                "Content-Type: text/plain; version=0.0.4",
+                                                                "Content-Length: " + std::to_string(body.size()),
+                                                                "Connection: close"}) + body;
+        for (size_t done = 0; done < response.size();) {
+            ssize_t written = send(msg_sock, response.data() + done, response.size() - done, MSG_NOSIGNAL);
+            if (written <= 0) {
+                break;
+            }
+            done += written;
+        }
+        close(msg_sock);
+    }
+}
+
+// HTTPS listener; there's none if port is -1.
+struct HttpsOptions {
+    int port = -1;
+    std::string certificateFile;
+    std::string privateKeyFile;
+};
+
+void startServer(uint16_t portnum, const std::string &filesDirectory, const std::string &correlatedServersFile,
+                 unsigned workersNum, int metricsPort, CorrelatedMode correlatedMode,
+                 const std::string &contentPackFile, const std::string &accessLogFile, bool filterTargets,
+                 const HttpsOptions &https) {
+    signal(SIGPIPE, SIG_IGN);
+    // SIGHUP is blocked in every thread and consumed through signalfd by the reloading thread.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    std::shared_ptr<const ContentPack> contentPack;
+    if (!contentPackFile.empty()) {
+        contentPack = ContentPack::fromFile(contentPackFile, true);
+    }
+    std::shared_ptr<TargetFilter> targetFilter;
+    std::thread filterWatcher;
+    if (filterTargets) {
+        targetFilter = std::make_shared<TargetFilter>(filesDirectory);
+        if (!targetFilter->isEnabled()) {
+            std::cerr << "Can't watch the files directory, target filter disabled." << std::endl;
+        }
+        filterWatcher = std::thread([&targetFilter = *targetFilter]() { targetFilter.watchForChanges(); });
+    }
+    ConnectionHandler ch(filesDirectory, correlatedServersFile, correlatedMode, std::move(contentPack), targetFilter);
+    std::thread reloader([&ch]() { ch.getCorrelatedTable().watchForChanges(); });
+    std::thread healthChecker;
+    if (correlatedMode != CorrelatedMode::Redirect) {
+        healthChecker = std::thread([&ch = std::as_const(ch)]() { ch.getUpstreams().runHealthChecks(); });
+    }
+    // All sockets are bound before any worker starts, so a bind error is reported at startup.
+    std::vector<int> sockets;
+    std::vector<int> tlsSockets;
+    for (unsigned i = 0; i < workersNum; i++) {
+        sockets.push_back(createListeningSocket(portnum));
+        tlsSockets.push_back(https.port >= 0 ? createListeningSocket(https.port) : -1);
+    }
+    std::shared_ptr<const TlsContext> tlsContext;
+    if (https.port >= 0) {
+        tlsContext = TlsContext::fromFiles(https.certificateFile, https.privateKeyFile);
+    }
+    std::unique_ptr<AccessLog> accessLog;
+    if (!accessLogFile.empty()) {
+        accessLog = std::make_unique<AccessLog>(accessLogFile);
+        exit_on_fail_with_errno(accessLog->drain(), "Can't open access log.");
+    }
+    // Every worker is registered before the metrics endpoint and the log writer start reading them.
+    Metrics metrics;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < sockets.size(); i++) {
+        AccessLogRing *accessLogRing = accessLog ? &accessLog->addWorker() : nullptr;
+        workers.emplace_back([sockfd = sockets[i], tlsSocket = tlsSockets[i], &tlsContext, &ch = std::as_const(ch),
+                                     &workerMetrics = metrics.addWorker(), accessLogRing, workersNum]() {
+            EventLoop loop(sockfd, ch, workerMetrics, workersNum);
+            if (tlsSocket >= 0) {
+                loop.listenTls(tlsSocket, tlsContext);
+            }
+            loop.setAccessLog(accessLogRing);
+            loop.run();
+        });
+    }
+    if (accessLog) {
+        workers.emplace_back([&accessLog = *accessLog]() { accessLog.run(); });
+    }
+    if (metricsPort >= 0) {
+        int metricsSocket = createListeningSocket(metricsPort);
+        workers.emplace_back([metricsSocket, &metrics = std::as_const(metrics)]() {
+            serveMetrics(metricsSocket, metrics);
+        });
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    reloader.join();
+    if (healthChecker.joinable()) {
+        healthChecker.join();
+    }
+    if (filterWatcher.joinable()) {
+        filterWatcher.join();
     }
 }
 
 int main(int argc, char **argv) {
-    exit_on_fail(argc >= 3 && argc < 5, "Usage: ./server directory_with_files correlated_servers_file [port_num]");
+    const std::string usage = "Usage: ./server [-w workers_num] [-m metrics_port] [-p redirect|404] "
+                              "[-k content_pack] [-l access_log] [-n] "
+                              "[-s https_port -c certificate_file -y private_key_file] "
+                              "directory_with_files correlated_servers_file [port_num]";
+    // Every worker binds its own listening sockets, so their number is bounded.
+    constexpr unsigned long maxWorkers = 1024;
+    unsigned workers_num = std::clamp(std::thread::hardware_concurrency(), 1u, static_cast<unsigned>(maxWorkers));
+    int metrics_port = -1;
+    CorrelatedMode correlated_mode = CorrelatedMode::Redirect;
+    std::string content_pack;
+    std::string access_log;
+    bool filter_targets = false;
+    HttpsOptions https;
+    int opt;
+    while ((opt = getopt(argc, argv, "w:m:p:k:l:ns:c:y:")) != -1) {
+        exit_on_fail(opt == 'w' || opt == 'm' || opt == 'p' || opt == 'k' || opt == 'l' || opt == 'n' ||
+                     opt == 's' || opt == 'c' || opt == 'y', usage);
+        try {
+            if (opt == 's') {
+                https.port = std::stoi(optarg);
+                exit_on_fail(https.port >= 0 && https.port <= UINT16_MAX, usage);
+            } else if (opt == 'c') {
+                https.certificateFile = optarg;
+            } else if (opt == 'y') {
+                https.privateKeyFile = optarg;
+            } else if (opt == 'n') {
+                filter_targets = true;
+            } else if (opt == 'k') {
+                content_pack = optarg;
+            } else if (opt == 'l') {
+                access_log = optarg;
+            } else if (opt == 'p') {
+                const std::string fallback = optarg;
+                exit_on_fail(fallback == "redirect" || fallback == "404", usage);
+                correlated_mode = fallback == "redirect" ? CorrelatedMode::ProxyElseRedirect
+                                                         : CorrelatedMode::ProxyElseNotFound;
+            } else if (opt == 'w') {
+                // std::stoul() would take "-1" and wrap it around, so only digits are accepted.
+                const std::string value = optarg;
+                exit_on_fail(!value.empty() && std::all_of(value.begin(), value.end(),
+                                                               [](unsigned char c) { return std::isdigit(c); }), usage);
+                unsigned long parsed = std::stoul(value);
+                exit_on_fail(parsed > 0 && parsed <= maxWorkers, usage);
+                workers_num = parsed;
+            } else {
+                metrics_port = std::stoi(optarg);
+                exit_on_fail(metrics_port >= 0 && metrics_port <= UINT16_MAX, usage);
+            }
+        } catch (const std::logic_error &e) {
+            exit_on_fail(false, e.what());
+        }
+    }
+    exit_on_fail((https.port >= 0) == !https.certificateFile.empty() &&
+                 (https.port >= 0) == !https.privateKeyFile.empty(), usage);
+    const std::vector<std::string> args(argv + optind, argv + argc);
+    exit_on_fail(args.size() >= 2 && args.size() < 4, usage);
     uint16_t port_num = 8080;
-    if (argc == 4) {
+    if (args.size() == 3) {
         try {
-            port_num = std::stoi(argv[3]);
+            port_num = std::stoi(args[2]);
         } catch (const std::invalid_argument &e) {
             exit_on_fail(false, e.what());
         } catch (const std::out_of_range &e) {
             exit_on_fail(false, e.what());
         }
     }
-    exit_on_fail(std::filesystem::exists(argv[1]) && std::filesystem::is_directory(argv[1]),
+    exit_on_fail(std::filesystem::exists(args[0]) && std::filesystem::is_directory(args[0]),
                  "Server's files directory doesn't exists.");
-    exit_on_fail(std::filesystem::exists(argv[2]) && std::filesystem::is_regular_file(argv[2]),
+    exit_on_fail(std::filesystem::exists(args[1]) && std::filesystem::is_regular_file(args[1]),
                  "Correlated servers file doesn't exists.");
-    startServer(port_num, argv[1], argv[2]);
+    startServer(port_num, args[0], args[1], workers_num, metrics_port, correlated_mode, content_pack, access_log,
+                filter_targets, https);
 }
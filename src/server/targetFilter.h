@@ -0,0 +1,254 @@
+#ifndef ZALICZENIOWE1_TARGETFILTER_H
+#define ZALICZENIOWE1_TARGETFILTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Bloom filter of request targets naming something in the served directory tree, built at
+ * startup, so that requests for targets which certainly don't exist skip opening them. Every
+ * directory of the tree is watched with inotify and created entries are added by a background
+ * thread (watchForChanges()); removed ones stay, which only costs false positives. Targets below
+ * symlinks and unreadable directories can't be listed, so those are marked as opaque: anything
+ * below them may exist. Targets which aren't plain ("//", "." or ".." components) always may exist.
+ * If a directory can't be watched, the filter gives up and answers that every target may exist.
+ *
+ * Blocked layout: all bits of a key are in one cache line, so a lookup costs one cache miss at most.
+ * Bits are only ever set, with atomic or, so workers read the filter while it's being updated.
+ * */
+class TargetFilter {
+public:
+    explicit TargetFilter(const std::string &filesDirectory) {
+        std::error_code ec;
+        baseDir = std::filesystem::absolute(filesDirectory, ec).string();
+        if (!baseDir.empty() && baseDir.back() == '/') {
+            baseDir.pop_back();
+        }
+        notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        std::vector<std::string> targets;
+        std::vector<std::string> opaque;
+        bool watched = notifyFd >= 0 && addTree("", targets, opaque);
+        size_t keys = std::max(2 * (targets.size() + opaque.size()), minCapacity);
+        blocksNum = 1;
+        while (blocksNum * blockBits < keys * bitsPerKey) {
+            blocksNum *= 2;
+        }
+        blocks = std::make_unique<Block[]>(blocksNum);
+        insert(targets, opaque);
+        enabled.store(watched, std::memory_order_relaxed);
+    }
+
+    TargetFilter(const TargetFilter &) = delete;
+
+    TargetFilter &operator=(const TargetFilter &) = delete;
+
+    ~TargetFilter() {
+        if (notifyFd >= 0) {
+            close(notifyFd);
+        }
+    }
+
+    // False only if there's certainly nothing at target, so opening it would fail with ENOENT or ENOTDIR.
+    bool mayContain(std::string_view target) const {
+        if (!enabled.load(std::memory_order_relaxed) || target.size() < 2 || target[0] != '/') {
+            return true;
+        }
+        for (size_t begin = 1; begin <= target.size();) {
+            size_t end = std::min(target.find('/', begin), target.size());
+            std::string_view component = target.substr(begin, end - begin);
+            if (component.empty() || component == "." || component == "..") {
+                return true;
+            }
+            if (end == target.size()) {
+                break;
+            }
+            if (test(opaqueHash(target.substr(0, end)))) {
+                return true;
+            }
+            begin = end + 1;
+        }
+        return test(targetHash(target));
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    // Descriptor which becomes readable when watched directories change, -1 if inotify is unavailable.
+    int getNotifyFd() const {
+        return notifyFd;
+    }
+
+    // Adds entries created since the last call, as reported by inotify.
+    void processEvents() {
+        alignas(inotify_event) char buffer[16 * 1024];
+        ssize_t len;
+        bool rewatch = false;
+        std::vector<std::string> targets;
+        std::vector<std::string> opaque;
+        while ((len = read(notifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char *p = buffer; p < buffer + len;) {
+                auto *event = reinterpret_cast<inotify_event *>(p);
+                rewatch = handleEvent(*event, targets, opaque) || rewatch;
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+        if (rewatch) {
+            // A directory has moved, so paths of the watches below it are stale; the tree is listed again.
+            for (const auto &watch : watchedDirs) {
+                inotify_rm_watch(notifyFd, watch.first);
+            }
+            watchedDirs.clear();
+            if (!addTree("", targets, opaque)) {
+                enabled.store(false, std::memory_order_relaxed);
+            }
+        }
+        insert(targets, opaque);
+    }
+
+    // Processes inotify events as they come, forever. Meant to be run by a background thread.
+    void watchForChanges() {
+        pollfd fd{notifyFd, POLLIN, 0};
+        while (notifyFd >= 0 && isEnabled()) {
+            if (poll(&fd, 1, -1) > 0) {
+                processEvents();
+            }
+        }
+    }
+
+private:
+    static constexpr size_t blockBits = 512;
+    static constexpr size_t bitsPerKey = 16;
+    static constexpr unsigned probes = 7;
+    static constexpr size_t minCapacity = 4096;
+    static constexpr uint64_t opaqueSeed = 0x6f70617175652121;
+    static constexpr uint32_t watchedEvents = IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM | IN_MOVE_SELF | IN_ONLYDIR;
+
+    struct alignas(64) Block {
+        std::atomic<uint64_t> words[blockBits / 64]{};
+    };
+
+    std::string baseDir;
+    int notifyFd;
+    std::atomic<bool> enabled{false};
+    std::unique_ptr<Block[]> blocks;
+    size_t blocksNum;
+    // Target of every watched directory, "" for the served one.
+    std::unordered_map<int, std::string> watchedDirs;
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+    static uint64_t targetHash(std::string_view target) {
+        return mix(std::hash<std::string_view>()(target));
+    }
+
+    static uint64_t opaqueHash(std::string_view target) {
+        return mix(std::hash<std::string_view>()(target) ^ opaqueSeed);
+    }
+
+    // Low bits of the hash choose the block, the bits of its mix the probed bits within it.
+    bool test(uint64_t hash) const {
+        const Block &block = blocks[hash & (blocksNum - 1)];
+        uint64_t bits = mix(hash);
+        for (unsigned i = 0; i < probes; i++, bits >>= 9) {
+            size_t bit = bits & (blockBits - 1);
+            if (!(block.words[bit / 64].load(std::memory_order_relaxed) & (1ull << (bit % 64)))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void set(uint64_t hash) {
+        Block &block = blocks[hash & (blocksNum - 1)];
+        uint64_t bits = mix(hash);
+        for (unsigned i = 0; i < probes; i++, bits >>= 9) {
+            size_t bit = bits & (blockBits - 1);
+            block.words[bit / 64].fetch_or(1ull << (bit % 64), std::memory_order_relaxed);
+        }
+    }
+
+    void insert(const std::vector<std::string> &targets, const std::vector<std::string> &opaque) {
+        for (const std::string &target : targets) {
+            set(targetHash(target));
+        }
+        for (const std::string &target : opaque) {
+            set(opaqueHash(target));
+        }
+    }
+
+    /*
+     * Watches the directory at target and every directory below it, collecting their entries.
+     * The watch is added before listing, so entries created meanwhile are reported by inotify.
+     * Returns false if the directory can't be watched.
+     * */
+    bool addTree(const std::string &target, std::vector<std::string> &targets, std::vector<std::string> &opaque) {
+        const std::string path = baseDir + target;
+        int wd = inotify_add_watch(notifyFd, path.c_str(), watchedEvents);
+        if (wd < 0) {
+            return false;
+        }
+        watchedDirs[wd] = target;
+        std::error_code ec;
+        for (auto it = std::filesystem::directory_iterator(path, ec);
+             !ec && it != std::filesystem::directory_iterator(); it.increment(ec)) {
+            addEntry(target + "/" + it->path().filename().string(), targets, opaque);
+        }
+        if (ec) {
+            opaque.push_back(target);
+        }
+        return true;
+    }
+
+    void addEntry(const std::string &target, std::vector<std::string> &targets, std::vector<std::string> &opaque) {
+        targets.push_back(target);
+        struct stat st{};
+        if (lstat((baseDir + target).c_str(), &st) < 0 || S_ISLNK(st.st_mode)) {
+            opaque.push_back(target);
+        } else if (S_ISDIR(st.st_mode) && !addTree(target, targets, opaque)) {
+            opaque.push_back(target);
+        }
+    }
+
+    // Returns true if the watched tree has to be listed again.
+    bool handleEvent(const inotify_event &event, std::vector<std::string> &targets, std::vector<std::string> &opaque) {
+        if (event.mask & IN_Q_OVERFLOW) {
+            return true;
+        }
+        auto dir = watchedDirs.find(event.wd);
+        if (dir == watchedDirs.end()) {
+            return false;
+        }
+        if (event.mask & IN_IGNORED) {
+            watchedDirs.erase(dir);
+            return false;
+        }
+        if (event.mask & IN_MOVE_SELF || (event.mask & IN_ISDIR && event.mask & IN_MOVED_FROM)) {
+            return true;
+        }
+        if (event.len > 0 && event.mask & (IN_CREATE | IN_MOVED_TO)) {
+            addEntry(dir->second + "/" + event.name, targets, opaque);
+        }
+        return false;
+    }
+};
+
+#endif //ZALICZENIOWE1_TARGETFILTER_H
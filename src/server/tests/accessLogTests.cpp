@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <sys/socket.h>
+#include "../connectionHandler.h"
+
+namespace {
+    const std::string logPath = "/tmp/accessLogTests.log";
+
+    std::vector<DecodedAccessRecord> drainRing(AccessLogRing &ring, std::string &bytes) {
+        bytes.clear();
+        ring.drain([&bytes](std::string_view first, std::string_view second) {
+            bytes.append(first);
+            bytes.append(second);
+        });
+        std::vector<DecodedAccessRecord> records;
+        std::string_view data(bytes);
+        while (auto decoded = AccessLog::decode(data)) {
+            records.push_back(*decoded);
+        }
+        EXPECT_TRUE(data.empty());
+        return records;
+    }
+
+    std::string readFile(const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        return contents.str();
+    }
+
+    void removeLogs() {
+        std::filesystem::remove(logPath);
+        for (int i = 1; i <= 3; i++) {
+            std::filesystem::remove(logPath + "." + std::to_string(i));
+        }
+    }
+}
+
+TEST(access_log, ring_wraps_around_and_drops_when_full) {
+    AccessLogRing ring(256);
+    AccessEntry entry{"GET", "/some/file.txt", "200", "10.0.0.1:8080", 123, WorkerMetrics::now()};
+    size_t recordSize = sizeof(AccessRecord) + entry.target.size() + entry.upstream.size();
+    std::string bytes;
+    for (int round = 0; round < 10; round++) {
+        size_t fitting = 256 / recordSize;
+        for (size_t i = 0; i < fitting; i++) {
+            ASSERT_TRUE(ring.record(entry, WorkerMetrics::now()));
+        }
+        ASSERT_FALSE(ring.record(entry, WorkerMetrics::now()));
+        std::vector<DecodedAccessRecord> records = drainRing(ring, bytes);
+        ASSERT_EQ(records.size(), fitting);
+        for (const DecodedAccessRecord &r : records) {
+            ASSERT_EQ(r.record.method, AccessRecord::Method::Get);
+            ASSERT_EQ(r.record.status, 200);
+            ASSERT_EQ(r.record.bytes, 123);
+            ASSERT_EQ(r.target, "/some/file.txt");
+            ASSERT_EQ(r.upstream, "10.0.0.1:8080");
+        }
+        // Records of the next round start elsewhere in the ring, so they get split at its end.
+        ASSERT_TRUE(ring.record(AccessEntry{"BREW", "/x", "", "", 0, 0}, WorkerMetrics::now()));
+        records = drainRing(ring, bytes);
+        ASSERT_EQ(records.size(), 1);
+        ASSERT_EQ(records[0].record.method, AccessRecord::Method::Other);
+        ASSERT_EQ(records[0].record.status, 0);
+    }
+}
+
+TEST(access_log, writes_and_rotates_files) {
+    removeLogs();
+    AccessLog log(logPath, 1000, 2);
+    AccessLogRing &first = log.addWorker();
+    AccessLogRing &second = log.addWorker();
+    ASSERT_TRUE(log.drain());
+    ASSERT_EQ(readFile(logPath), AccessLog::fileMagic);
+
+    ASSERT_TRUE(first.record(AccessEntry{"GET", "/a", "200", "", 5, WorkerMetrics::now()}, WorkerMetrics::now()));
+    ASSERT_TRUE(second.record(AccessEntry{"HEAD", "/b", "302", "10.0.0.1:80", 0, WorkerMetrics::now()},
+                              WorkerMetrics::now()));
+    ASSERT_TRUE(log.drain());
+    std::string file = readFile(logPath);
+    std::string_view data(file);
+    ASSERT_EQ(data.substr(0, AccessLog::fileMagic.size()), AccessLog::fileMagic);
+    data.remove_prefix(AccessLog::fileMagic.size());
+    auto a = AccessLog::decode(data);
+    auto b = AccessLog::decode(data);
+    ASSERT_TRUE(a && b);
+    ASSERT_EQ(a->target, "/a");
+    ASSERT_EQ(a->record.bytes, 5);
+    ASSERT_EQ(b->record.method, AccessRecord::Method::Head);
+    ASSERT_EQ(b->record.status, 302);
+    ASSERT_EQ(b->upstream, "10.0.0.1:80");
+    ASSERT_FALSE(AccessLog::decode(data));
+
+    // Files over the limit are rotated away before the next batch; only two old ones are kept.
+    const std::string target(600, 't');
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(first.record(AccessEntry{"GET", target, "200", "", 0, 0}, WorkerMetrics::now()));
+        ASSERT_TRUE(first.record(AccessEntry{"GET", target, "200", "", 0, 0}, WorkerMetrics::now()));
+        ASSERT_TRUE(log.drain());
+    }
+    ASSERT_TRUE(std::filesystem::exists(logPath + ".1"));
+    ASSERT_TRUE(std::filesystem::exists(logPath + ".2"));
+    ASSERT_FALSE(std::filesystem::exists(logPath + ".3"));
+    for (const std::string &path : {logPath, logPath + ".1", logPath + ".2"}) {
+        file = readFile(path);
+        data = file;
+        data.remove_prefix(AccessLog::fileMagic.size());
+        size_t records = 0;
+        while (auto decoded = AccessLog::decode(data)) {
+            ASSERT_EQ(decoded->target, target);
+            records++;
+        }
+        ASSERT_EQ(records, 2);
+        ASSERT_TRUE(data.empty());
+    }
+    removeLogs();
+}
+
+TEST(access_log, logs_handled_requests) {
+    const std::string correlated = "/tmp/accessLogTests_correlated.txt";
+    std::ofstream(correlated) << "/accessLogTests-remote\t10.0.0.1\t8080\n";
+    std::ofstream("/tmp/accessLogTests-file.txt") << "hello";
+    ConnectionHandler ch("/tmp", correlated);
+    WorkerMetrics metrics;
+    WorkerContext context(ch.getFilesDirectory(), metrics);
+    AccessLogRing ring;
+    context.accessLog = &ring;
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    Connection conn(fds[0]);
+    conn.getInput().append("GET /accessLogTests-file.txt HTTP/1.1\r\n\r\n"
+                           "HEAD /accessLogTests-remote HTTP/1.1\r\n\r\n"
+                           "GET /accessLogTests-missing HTTP/1.1\r\n\r\n"
+                           "DELETE /accessLogTests-file.txt HTTP/1.1\r\n\r\n");
+    ch.handleIncomingConnection(conn, context);
+    uint64_t queued = conn.bytesQueuedSince(0);
+    ASSERT_TRUE(conn.flush());
+    ASSERT_EQ(conn.takeSentBytes(), queued);
+    close(fds[0]);
+    close(fds[1]);
+
+    std::string bytes;
+    std::vector<DecodedAccessRecord> records = drainRing(ring, bytes);
+    ASSERT_EQ(records.size(), 4);
+    ASSERT_EQ(records[0].target, "/accessLogTests-file.txt");
+    ASSERT_EQ(records[0].record.status, 200);
+    ASSERT_EQ(records[0].upstream, "");
+    ASSERT_EQ(records[1].record.method, AccessRecord::Method::Head);
+    ASSERT_EQ(records[1].record.status, 302);
+    ASSERT_EQ(records[1].upstream, "10.0.0.1:8080");
+    ASSERT_EQ(records[2].record.status, 404);
+    ASSERT_EQ(records[3].record.method, AccessRecord::Method::Other);
+    ASSERT_EQ(records[3].record.status, 501);
+    uint64_t total = 0;
+    for (const DecodedAccessRecord &r : records) {
+        ASSERT_GT(r.record.bytes, 0);
+        total += r.record.bytes;
+    }
+    ASSERT_EQ(total, queued);
+    ASSERT_EQ(metrics.getDroppedAccessRecords(), 0);
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "../connectionHandler.h"
+
+namespace {
+    std::atomic<bool> countingAllocations{false};
+    std::atomic<size_t> allocations{0};
+}
+
+// Replaced for the whole test binary; allocations are only counted while a test asks for it.
+void *operator new(size_t size) {
+    if (countingAllocations.load(std::memory_order_relaxed)) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (void *p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+    // Handles requests arriving in one read and sends the responses; returns number of allocations made meanwhile.
+    size_t countAllocations(const ConnectionHandler &ch, WorkerContext &context, Connection &conn, int peer,
+                            const std::string &requests, std::string &responses) {
+        allocations = 0;
+        countingAllocations = true;
+        conn.getInput().append(requests);
+        ch.handleIncomingConnection(conn, context);
+        bool flushed = conn.flush();
+        countingAllocations = false;
+        EXPECT_TRUE(flushed);
+        EXPECT_FALSE(conn.hasPendingOutput());
+        responses.clear();
+        char buffer[64 * 1024];
+        ssize_t len;
+        while ((len = recv(peer, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+            responses.append(buffer, len);
+        }
+        return allocations;
+    }
+}
+
+TEST(request_allocations, steady_state_requests_do_not_allocate) {
+    const std::string path = "/tmp/allocationTests-file.txt";
+    std::string content;
+    for (int i = 0; i < 100; i++) {
+        content += "line " + std::to_string(i) + " of a file worth compressing\n";
+    }
+    std::ofstream(path) << content;
+    struct stat st{};
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    const std::string etag = FileMetadata::of(st).etag;
+    const std::string correlated = "/tmp/allocationTests_correlated.txt";
+    std::ofstream(correlated) << "/allocationTests-remote\t10.0.0.1\t8080\n";
+
+    ConnectionHandler ch("/tmp", correlated);
+    WorkerMetrics metrics;
+    WorkerContext context(ch.getFilesDirectory(), metrics);
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int bufferSize = 1 << 20;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    Connection conn(fds[0]);
+
+    const std::string requests = "GET /allocationTests-file.txt HTTP/1.1\r\nUser-Agent: test\r\n\r\n"
+                                 "HEAD /allocationTests-file.txt HTTP/1.1\r\n\r\n"
+                                 "GET /allocationTests-file.txt HTTP/1.1\r\nAccept-Encoding: gzip, br\r\n\r\n"
+                                 "GET /allocationTests-file.txt HTTP/1.1\r\nIf-None-Match: " + etag + "\r\n\r\n"
+                                 "GET /allocationTests-remote HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+                                 "GET /allocationTests-missing HTTP/1.1\r\n\r\n";
+    std::string responses;
+    // The first rounds fill the cache and grow the connection's buffers, arena and output slots.
+    ASSERT_GT(countAllocations(ch, context, conn, fds[1], requests, responses), 0);
+    for (int round = 0; round < 2; round++) {
+        countAllocations(ch, context, conn, fds[1], requests, responses);
+    }
+    ASSERT_EQ(countAllocations(ch, context, conn, fds[1], requests, responses), 0);
+    ASSERT_NE(responses.find("HTTP/1.1 200 OK\r\n"), std::string::npos);
+    ASSERT_NE(responses.find("Content-Encoding: gzip\r\n"), std::string::npos);
+    ASSERT_NE(responses.find("HTTP/1.1 304 Not Modified\r\n"), std::string::npos);
+    ASSERT_NE(responses.find("HTTP/1.1 302 Redirected\r\n"), std::string::npos);
+    ASSERT_NE(responses.find("HTTP/1.1 404 Not found\r\n"), std::string::npos);
+    close(fds[1]);
+}
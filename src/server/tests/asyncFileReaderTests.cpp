@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <fstream>
+#include <poll.h>
+#include <sys/socket.h>
+#include "../connection.h"
+
+namespace {
+    const std::string readerFile = "/tmp/asyncFileReaderTests.bin";
+
+    std::string writeFile(size_t size) {
+        std::string content;
+        for (size_t i = 0; i < size; i++) {
+            content += static_cast<char>('a' + i % 26);
+        }
+        std::ofstream(readerFile) << content;
+        return content;
+    }
+
+    // Drops the file from the page cache, so that reading it has to wait for the disk.
+    void evict(int fd) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+
+    std::vector<AsyncFileReader::Completion> waitForCompletions(AsyncFileReader &reader, size_t count) {
+        std::vector<AsyncFileReader::Completion> completions;
+        while (completions.size() < count) {
+            pollfd pfd{reader.getEventFd(), POLLIN, 0};
+            EXPECT_EQ(poll(&pfd, 1, 5000), 1);
+            reader.processCompletions([&completions](const AsyncFileReader::Completion &c) {
+                completions.push_back(c);
+            });
+        }
+        return completions;
+    }
+
+    void checkReads(AsyncFileReader &reader) {
+        std::string content = writeFile(3 * AsyncFileReader::bufferSize);
+        int fd = open(readerFile.c_str(), O_RDONLY);
+        ASSERT_TRUE(reader.read(fd, 0, AsyncFileReader::bufferSize, 7, 1));
+        ASSERT_TRUE(reader.read(fd, 2 * AsyncFileReader::bufferSize + 10, AsyncFileReader::bufferSize, 8, 2));
+        ASSERT_FALSE(reader.read(fd, 0, 1, 9, 3)); // Both buffers are busy.
+        reader.submit();
+        std::vector<AsyncFileReader::Completion> completions = waitForCompletions(reader, 2);
+        std::sort(completions.begin(), completions.end(), [](const auto &a, const auto &b) {
+            return a.connectionId < b.connectionId;
+        });
+        ASSERT_EQ(completions[0].socket, 7);
+        ASSERT_EQ(completions[0].result, (ssize_t) AsyncFileReader::bufferSize);
+        ASSERT_EQ(reader.data(completions[0].buffer, completions[0].result),
+                  content.substr(0, AsyncFileReader::bufferSize));
+        ASSERT_EQ(completions[1].socket, 8);
+        ASSERT_EQ(completions[1].result, (ssize_t) AsyncFileReader::bufferSize - 10); // Short read at the end.
+        ASSERT_EQ(reader.data(completions[1].buffer, completions[1].result),
+                  content.substr(2 * AsyncFileReader::bufferSize + 10));
+        reader.release(completions[0].buffer);
+        ASSERT_TRUE(reader.read(fd, 0, 1, 9, 3));
+        reader.submit();
+        AsyncFileReader::Completion last = waitForCompletions(reader, 1)[0];
+        ASSERT_EQ(last.result, 1);
+        reader.release(last.buffer);
+
+        // The descriptor is kept open by its owner until the read completes, though no one else holds it.
+        std::shared_ptr<const void> owner(nullptr, [fd](const void *) { close(fd); });
+        std::weak_ptr<const void> held = owner;
+        ASSERT_TRUE(reader.read(fd, 1, 1, 9, 4, std::move(owner)));
+        ASSERT_FALSE(held.expired());
+        reader.submit();
+        last = waitForCompletions(reader, 1)[0];
+        ASSERT_EQ(reader.data(last.buffer, last.result), "b");
+        ASSERT_TRUE(held.expired());
+        std::remove(readerFile.c_str());
+    }
+}
+
+TEST(async_file_reader, reads_with_io_uring_or_threads) {
+    AsyncFileReader reader(2);
+    checkReads(reader);
+}
+
+TEST(async_file_reader, reads_with_threads) {
+    AsyncFileReader reader(2, false);
+    ASSERT_FALSE(reader.usesIoUring());
+    checkReads(reader);
+}
+
+TEST(async_file_reader, connection_waits_for_cold_file) {
+    for (bool useIoUring : {true, false}) {
+        AsyncFileReader reader(4, useIoUring);
+        std::string content = writeFile(AsyncFileReader::bufferSize + 1000);
+        int fd = open(readerFile.c_str(), O_RDONLY);
+        evict(fd);
+        if (AsyncFileReader::residencyOf(fd, content.size() - 1) != AsyncFileReader::Residency::Cold) {
+            GTEST_SKIP() << "Page cache can't be dropped here.";
+        }
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        int size = 1 << 20;
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        {
+            Connection conn(fds[0]);
+            conn.id = 5;
+            conn.setFileReader(&reader);
+            conn.queue("header");
+            conn.queueFile(fd, 0, content.size());
+            ASSERT_TRUE(conn.flush());
+            ASSERT_TRUE(conn.isWaitingForFile());
+            reader.submit();
+            while (conn.hasPendingOutput()) {
+                for (const AsyncFileReader::Completion &read : waitForCompletions(reader, 1)) {
+                    ASSERT_EQ(read.socket, fds[0]);
+                    ASSERT_EQ(read.connectionId, 5u);
+                    ASSERT_TRUE(conn.completeFileRead(read.buffer, read.result));
+                }
+                ASSERT_TRUE(conn.flush());
+                reader.submit();
+            }
+        }
+        std::string received;
+        char buffer[64 * 1024];
+        ssize_t len;
+        while ((len = read(fds[1], buffer, sizeof(buffer))) > 0) {
+            received.append(buffer, len);
+        }
+        close(fds[1]);
+        ASSERT_EQ(received, "header" + content);
+    }
+    std::remove(readerFile.c_str());
+}
@@ -0,0 +1,275 @@
+#include <gtest/gtest.h>
+#include <deque>
+#include <fstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "../connectionHandler.h"
+
+namespace {
+    std::string handleAndCollect(const ConnectionHandler &ch, const std::vector<std::string> &reads) {
+        int fds[2];
+        EXPECT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        std::string result;
+        {
+            WorkerMetrics metrics;
+            WorkerContext context(ch.getFilesDirectory(), metrics);
+            Connection conn(fds[0]);
+            for (const std::string &chunk : reads) {
+                conn.getInput().append(chunk);
+                ch.handleIncomingConnection(conn, context);
+                EXPECT_TRUE(conn.flush());
+            }
+        }
+        char buffer[4096];
+        ssize_t len;
+        while ((len = read(fds[1], buffer, sizeof(buffer))) > 0) {
+            result.append(buffer, len);
+        }
+        close(fds[1]);
+        return result;
+    }
+
+    ConnectionHandler makeHandler() {
+        const std::string correlated = "/tmp/connectionTests_correlated.txt";
+        std::ofstream(correlated) << "/remote\t10.0.0.1\t8080\n";
+        return ConnectionHandler("/tmp", correlated);
+    }
+}
+
+TEST(connection_framing, pipelined_requests) {
+    ConnectionHandler ch = makeHandler();
+    std::string out = handleAndCollect(ch, {"GET /remote HTTP/1.1\r\n\r\nHEAD /remote HTTP/1.1\r\n\r\n"});
+    ASSERT_EQ(out, "HTTP/1.1 302 Redirected\r\nLocation: http://10.0.0.1:8080/remote\r\n\r\n"
+                   "HTTP/1.1 302 Redirected\r\nLocation: http://10.0.0.1:8080/remote\r\n\r\n");
+}
+
+TEST(connection_framing, request_split_between_reads) {
+    ConnectionHandler ch = makeHandler();
+    std::string out = handleAndCollect(ch, {"GET /rem", "ote HTTP/1.1\r", "\n", "\r", "\n"});
+    ASSERT_EQ(out, "HTTP/1.1 302 Redirected\r\nLocation: http://10.0.0.1:8080/remote\r\n\r\n");
+}
+
+TEST(connection_framing, pipelined_requests_split_anywhere) {
+    ConnectionHandler ch = makeHandler();
+    const std::string requests = "GET /remote HTTP/1.1\r\nConnection: keep-alive\r\n\r\nHEAD /remote HTTP/1.1\r\n\r\n";
+    const std::string redirect = "HTTP/1.1 302 Redirected\r\nLocation: http://10.0.0.1:8080/remote\r\n\r\n";
+    for (size_t split = 0; split <= requests.size(); split++) {
+        std::string out = handleAndCollect(ch, {requests.substr(0, split), requests.substr(split)});
+        ASSERT_EQ(out, redirect + redirect) << split;
+    }
+}
+
+TEST(connection_framing, empty_lines_before_request) {
+    ConnectionHandler ch = makeHandler();
+    std::string out = handleAndCollect(ch, {"\r\n\r\n"});
+    ASSERT_EQ(out, "HTTP/1.1 400 Bad syntax\r\nConnection: close\r\n\r\n");
+}
+
+TEST(connection_framing, stops_after_close) {
+    ConnectionHandler ch = makeHandler();
+    std::string out = handleAndCollect(ch, {"PUT /remote HTTP/1.1\r\n\r\nGET /remote HTTP/1.1\r\n\r\n"});
+    ASSERT_EQ(out, "HTTP/1.1 501 Not implemented\r\nConnection: close\r\n\r\n");
+}
+
+TEST(connection_output, short_writes_are_resumed) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    int bufferSize = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufferSize, sizeof(bufferSize));
+    std::string expected;
+    {
+        Connection conn(fds[0]);
+        const std::string body(100 * 1000, 'x');
+        std::deque<std::string> headers;
+        for (int i = 0; i < 200; i++) {
+            const std::string &header = headers.emplace_back("response " + std::to_string(i) + "\r\n");
+            expected += header;
+            conn.queue(header);
+            if (i % 2 == 0) {
+                conn.queueShared(nullptr, header, body);
+                expected += header + body;
+            }
+        }
+        std::string received;
+        char buffer[64 * 1024];
+        while (conn.hasPendingOutput()) {
+            ASSERT_TRUE(conn.flush());
+            ssize_t len;
+            while ((len = read(fds[1], buffer, sizeof(buffer))) > 0) {
+                received.append(buffer, len);
+            }
+        }
+        ASSERT_EQ(received, expected);
+    }
+    close(fds[1]);
+}
+
+TEST(connection_ranges, partial_and_conditional_responses) {
+    ConnectionHandler ch = makeHandler();
+    const std::string file = "/connectionTests-range.bin";
+    std::ofstream("/tmp" + file) << "0123456789";
+    struct stat st{};
+    ASSERT_EQ(stat(("/tmp" + file).c_str(), &st), 0);
+    FileMetadata metadata = FileMetadata::of(st);
+    const std::string validators = "Accept-Ranges: bytes\r\nETag: " + metadata.etag + "\r\nLast-Modified: " +
+                                   metadata.lastModifiedDate + "\r\nVary: Accept-Encoding\r\n";
+
+    // Twice, so that both the first, uncached response and a cached one are checked.
+    for (int i = 0; i < 2; i++) {
+        ASSERT_EQ(handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nRange: bytes=2-4\r\n\r\n"}),
+                  "HTTP/1.1 206 Partial Content\r\nContent-Type: application/octet-stream\r\n"
+                  "Content-Range: bytes 2-4/10\r\nContent-Length: 3\r\n" + validators + "\r\n234");
+    }
+    std::string multipart = handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nRange: bytes=0-0,-2\r\n\r\n"});
+    ASSERT_EQ(multipart.find("HTTP/1.1 206 Partial Content\r\nContent-Type: multipart/byteranges; boundary="), 0u);
+    size_t bodyStart = multipart.find("\r\n\r\n") + 4;
+    ASSERT_NE(multipart.find("Content-Length: " + std::to_string(multipart.size() - bodyStart)), std::string::npos);
+    ASSERT_NE(multipart.find("Content-Range: bytes 0-0/10\r\n\r\n0\r\n--"), std::string::npos);
+    ASSERT_NE(multipart.find("Content-Range: bytes 8-9/10\r\n\r\n89\r\n--"), std::string::npos);
+
+    ASSERT_EQ(handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nRange: bytes=10-\r\n\r\n"}),
+              "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */10\r\nContent-Length: 0\r\n\r\n");
+    ASSERT_EQ(handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nIf-None-Match: " + metadata.etag + "\r\n\r\n"}),
+              "HTTP/1.1 304 Not Modified\r\n" + validators + "\r\n");
+    // The field is a list, so repeating it extends the list of tags.
+    ASSERT_EQ(handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nIf-None-Match: \"old\"\r\nIf-None-Match: " +
+                                    metadata.etag + "\r\n\r\n"}),
+              "HTTP/1.1 304 Not Modified\r\n" + validators + "\r\n");
+    ASSERT_EQ(handleAndCollect(ch, {"HEAD " + file + " HTTP/1.1\r\nIf-Modified-Since: " +
+                                    metadata.lastModifiedDate + "\r\n\r\n"}),
+              "HTTP/1.1 304 Not Modified\r\n" + validators + "\r\n");
+    // Range of an outdated copy is ignored and the whole file is sent.
+    std::string full = handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nRange: bytes=2-4\r\nIf-Range: \"old\"\r\n\r\n"});
+    ASSERT_EQ(full.find("HTTP/1.1 200 OK\r\n"), 0u);
+    ASSERT_EQ(full.substr(full.size() - 10), "0123456789");
+    std::remove(("/tmp" + file).c_str());
+}
+
+TEST(connection_encodings, compressed_variants) {
+    ConnectionHandler ch = makeHandler();
+    const std::string file = "/connectionTests-text.txt";
+    std::string text;
+    for (int i = 0; i < 200; i++) {
+        text += "line " + std::to_string(i % 7) + " of text\n";
+    }
+    std::ofstream("/tmp" + file) << text;
+
+    std::string identity = handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\n\r\n"});
+    ASSERT_EQ(identity.find("Content-Encoding"), std::string::npos);
+    ASSERT_NE(identity.find("\r\nVary: Accept-Encoding\r\n"), std::string::npos);
+    ASSERT_EQ(identity.substr(identity.size() - text.size()), text);
+
+    // Compressed on the fly.
+    std::string gzipped = handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nAccept-Encoding: gzip, br\r\n\r\n"});
+    size_t bodyStart = gzipped.find("\r\n\r\n") + 4;
+    ASSERT_NE(gzipped.find("\r\nContent-Encoding: gzip\r\nVary: Accept-Encoding\r\n"), std::string::npos);
+    ASSERT_NE(gzipped.find("Content-Length: " + std::to_string(gzipped.size() - bodyStart) + "\r\n"),
+              std::string::npos);
+    ASSERT_LT(gzipped.size() - bodyStart, text.size() / 2);
+    ASSERT_EQ(gzipped.substr(bodyStart, 2), "\x1f\x8b");
+    // The field is a list, so repeating it extends the list of codings.
+    std::string repeated = handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nAccept-Encoding: br\r\n"
+                                                 "Accept-Encoding: gzip\r\n\r\n"});
+    ASSERT_EQ(repeated, gzipped);
+
+    // Precompressed siblings are sent as they are, in the order of client's preference.
+    std::ofstream("/tmp" + file + ".gz") << "gzip sibling";
+    std::ofstream("/tmp" + file + ".zst") << "zstd sibling";
+    std::string sibling = handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nAccept-Encoding: gzip;q=0.5, zstd\r\n\r\n"});
+    ASSERT_NE(sibling.find("Content-Encoding: zstd\r\n"), std::string::npos);
+    ASSERT_EQ(sibling.substr(sibling.size() - 12), "zstd sibling");
+    sibling = handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nAccept-Encoding: gzip, zstd;q=0\r\n\r\n"});
+    ASSERT_NE(sibling.find("Content-Encoding: gzip\r\n"), std::string::npos);
+    ASSERT_EQ(sibling.substr(sibling.size() - 12), "gzip sibling");
+    std::remove(("/tmp" + file + ".gz").c_str());
+    std::remove(("/tmp" + file + ".zst").c_str());
+
+    // A file reached through a symlink can't be cached, so it isn't compressed again for every request.
+    const std::string link = "/connectionTests-text-link.txt";
+    std::remove(("/tmp" + link).c_str());
+    ASSERT_EQ(symlink(file.substr(1).c_str(), ("/tmp" + link).c_str()), 0);
+    identity = handleAndCollect(ch, {"GET " + link + " HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n"});
+    ASSERT_EQ(identity.find("Content-Encoding"), std::string::npos);
+    ASSERT_NE(identity.find("\r\nVary: Accept-Encoding\r\n"), std::string::npos);
+    ASSERT_EQ(identity.substr(identity.size() - text.size()), text);
+    std::remove(("/tmp" + link).c_str());
+    std::remove(("/tmp" + file).c_str());
+}
+
+TEST(connection_encodings, truncated_mapped_file_is_not_compressed) {
+    ConnectionHandler ch = makeHandler();
+    const std::string file = "/connectionTests-mapped.txt";
+    std::ofstream("/tmp" + file) << std::string(512 * 1024, 'a');
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    {
+        WorkerMetrics metrics;
+        WorkerContext context(ch.getFilesDirectory(), metrics);
+        Connection conn(fds[0]);
+        // Cached, mapped, then truncated behind the cache's back; compressing it mustn't touch the mapping.
+        conn.getInput().append("HEAD " + file + " HTTP/1.1\r\n\r\n");
+        ch.handleIncomingConnection(conn, context);
+        ASSERT_EQ(truncate(("/tmp" + file).c_str(), 0), 0);
+        conn.getInput().append("HEAD " + file + " HTTP/1.1\r\nAccept-Encoding: gzip\r\nConnection: close\r\n\r\n");
+        ch.handleIncomingConnection(conn, context);
+        ASSERT_TRUE(conn.flush());
+    }
+    std::string out;
+    char buffer[4096];
+    ssize_t len;
+    while ((len = read(fds[1], buffer, sizeof(buffer))) > 0) {
+        out.append(buffer, len);
+    }
+    close(fds[1]);
+    ASSERT_EQ(out.find("Content-Encoding"), std::string::npos);
+    ASSERT_NE(out.find("Content-Length: " + std::to_string(512 * 1024)), std::string::npos);
+    std::remove(("/tmp" + file).c_str());
+}
+
+TEST(connection_files, special_files_are_not_found) {
+    ConnectionHandler ch = makeHandler();
+    const std::string fifo = "/connectionTests-fifo";
+    std::remove(("/tmp" + fifo).c_str());
+    ASSERT_EQ(mkfifo(("/tmp" + fifo).c_str(), 0644), 0);
+    // Opening the FIFO mustn't wait for a writer which never comes.
+    ASSERT_EQ(handleAndCollect(ch, {"GET " + fifo + " HTTP/1.1\r\n\r\n"}),
+              "HTTP/1.1 404 Not found\r\n\r\n");
+
+    // Nor opening a FIFO in place of a precompressed sibling; the file is compressed on the fly instead.
+    const std::string file = "/connectionTests-fifo-sibling.txt";
+    std::ofstream("/tmp" + file) << std::string(4096, 'a');
+    std::remove(("/tmp" + file + ".gz").c_str());
+    ASSERT_EQ(mkfifo(("/tmp" + file + ".gz").c_str(), 0644), 0);
+    std::string gzipped = handleAndCollect(ch, {"GET " + file + " HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n"});
+    ASSERT_NE(gzipped.find("Content-Encoding: gzip\r\n"), std::string::npos);
+    std::remove(("/tmp" + file + ".gz").c_str());
+    std::remove(("/tmp" + file).c_str());
+    std::remove(("/tmp" + fifo).c_str());
+}
+
+TEST(connection_framing, header_limits) {
+    ConnectionHandler ch = makeHandler();
+    const std::string tooLarge = "HTTP/1.1 431 Header too large\r\nConnection: close\r\n\r\n";
+    // Header lines without the empty one ending them, sent in pieces.
+    std::vector<std::string> reads = {"GET /remote HTTP/1.1\r\n"};
+    for (int i = 0; i < 40; i++) {
+        reads.push_back("X-Filler: " + std::string(1000, 'x') + "\r\n");
+    }
+    ASSERT_EQ(handleAndCollect(ch, reads), tooLarge);
+    // A single line which never ends.
+    ASSERT_EQ(handleAndCollect(ch, {"GET /remote HTTP/1.1\r\nX-Long: " + std::string(10000, 'x'),
+                                    std::string(10000, 'x')}), tooLarge);
+    // Too many short lines.
+    std::string manyLines = "GET /remote HTTP/1.1\r\n";
+    for (int i = 0; i < 101; i++) {
+        manyLines += "X: y\r\n";
+    }
+    ASSERT_EQ(handleAndCollect(ch, {manyLines + "\r\n"}), tooLarge);
+    // Within the limits, requests are served.
+    std::string fitting = "GET /remote HTTP/1.1\r\n";
+    for (int i = 0; i < 15; i++) {
+        fitting += "X-Filler: " + std::string(1000, 'x') + "\r\n";
+    }
+    ASSERT_EQ(handleAndCollect(ch, {fitting + "\r\n"}),
+              "HTTP/1.1 302 Redirected\r\nLocation: http://10.0.0.1:8080/remote\r\n\r\n");
+}
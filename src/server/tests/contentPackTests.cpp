@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "../connectionHandler.h"
+
+namespace {
+    const std::string packedDir = "/tmp/contentPackTests";
+    const std::string packPath = "/tmp/contentPackTests.pack";
+
+    void writeFile(const std::string &path, const std::string &content) {
+        std::ofstream(path, std::ios::binary) << content;
+    }
+
+    std::shared_ptr<const ContentPack> buildPack() {
+        std::filesystem::remove_all(packedDir);
+        std::filesystem::create_directories(packedDir + "/sub");
+        writeFile(packedDir + "/a.txt", "hello");
+        writeFile(packedDir + "/a.txt.gz", "compressed");
+        writeFile(packedDir + "/sub/b.bin", std::string(100000, 'b'));
+        writeFile(packedDir + "/empty", "");
+        std::string error;
+        EXPECT_TRUE(ContentPack::build(packedDir, packPath, error)) << error;
+        std::shared_ptr<const ContentPack> pack = ContentPack::tryFromFile(packPath, false, error);
+        EXPECT_TRUE(pack) << error;
+        return pack;
+    }
+
+    std::string etagOf(const std::string &path) {
+        struct stat st{};
+        EXPECT_EQ(stat(path.c_str(), &st), 0);
+        return FileMetadata::of(st).etag;
+    }
+}
+
+TEST(content_pack, finds_packed_files) {
+    std::shared_ptr<const ContentPack> pack = buildPack();
+    ASSERT_EQ(pack->size(), 4);
+    ASSERT_EQ(pack->find("/a.txt")->getBody(), "hello");
+    ASSERT_EQ(pack->find("/a.txt")->getMetadata().etag, etagOf(packedDir + "/a.txt"));
+    ASSERT_EQ(pack->find("/sub/b.bin")->getBody(), std::string(100000, 'b'));
+    ASSERT_EQ(pack->find("/empty")->getBody(), "");
+    ASSERT_EQ(pack->find("/sub"), nullptr);
+    ASSERT_EQ(pack->find("/missing"), nullptr);
+    ASSERT_EQ(pack->find("a.txt"), nullptr);
+
+    const CachedResponse *variant = pack->findVariant("/a.txt", "gzip");
+    ASSERT_NE(variant, nullptr);
+    ASSERT_EQ(variant->getBody(), "compressed");
+    ASSERT_EQ(variant->getMetadata().contentCoding, "gzip");
+    ASSERT_EQ(pack->findVariant("/a.txt", "zstd"), nullptr);
+    ASSERT_EQ(pack->findVariant("/sub/b.bin", "gzip"), nullptr);
+}
+
+TEST(content_pack, skips_symlinks_leading_outside) {
+    buildPack();
+    writeFile("/tmp/contentPackTests-outside.txt", "secret");
+    std::filesystem::create_symlink("/tmp/contentPackTests-outside.txt", packedDir + "/outside");
+    std::filesystem::create_symlink("../a.txt", packedDir + "/sub/inside");
+    std::string error;
+    ASSERT_TRUE(ContentPack::build(packedDir, packPath, error)) << error;
+    std::shared_ptr<const ContentPack> pack = ContentPack::tryFromFile(packPath, false, error);
+    ASSERT_TRUE(pack) << error;
+    // Served from the directory, the former is 404 and the latter the file linked.
+    ASSERT_EQ(pack->find("/outside"), nullptr);
+    ASSERT_EQ(pack->find("/sub/inside")->getBody(), "hello");
+    std::remove("/tmp/contentPackTests-outside.txt");
+}
+
+TEST(content_pack, rejects_malformed_packs) {
+    buildPack();
+    std::string error;
+    std::filesystem::resize_file(packPath, std::filesystem::file_size(packPath) - 1);
+    ASSERT_FALSE(ContentPack::tryFromFile(packPath, false, error));
+    ASSERT_EQ(error, "Bad content pack format.");
+    writeFile(packPath, "not a content pack at all");
+    ASSERT_FALSE(ContentPack::tryFromFile(packPath, false, error));
+    ASSERT_FALSE(ContentPack::tryFromFile("/tmp/contentPackTests-missing.pack", false, error));
+}
+
+TEST(content_pack, serves_files_without_touching_directory) {
+    std::shared_ptr<const ContentPack> pack = buildPack();
+    const std::string correlated = "/tmp/contentPackTests_correlated.txt";
+    std::ofstream(correlated) << "/remote\t10.0.0.1\t8080\n";
+    ConnectionHandler ch(packedDir, correlated, CorrelatedMode::Redirect, pack);
+    // Packed files are served as they were packed, unpacked ones from the directory.
+    writeFile(packedDir + "/a.txt", "changed");
+    writeFile(packedDir + "/new.txt", "new");
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    {
+        WorkerMetrics metrics;
+        WorkerContext context(ch.getFilesDirectory(), metrics);
+        Connection conn(fds[0]);
+        conn.getInput().append("GET /a.txt HTTP/1.1\r\n\r\n"
+                               "GET /a.txt HTTP/1.1\r\nAccept-Encoding: gzip\r\n\r\n"
+                               "GET /new.txt HTTP/1.1\r\n\r\n"
+                               "GET /empty HTTP/1.1\r\nConnection: close\r\n\r\n");
+        ch.handleIncomingConnection(conn, context);
+        ASSERT_TRUE(conn.flush());
+    }
+    std::string out;
+    char buffer[4096];
+    ssize_t len;
+    while ((len = read(fds[1], buffer, sizeof(buffer))) > 0) {
+        out.append(buffer, len);
+    }
+    close(fds[1]);
+
+    size_t first = out.find("Vary: Accept-Encoding\r\n\r\nhello");
+    ASSERT_NE(first, std::string::npos);
+    size_t second = out.find("Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n\r\ncompressed", first);
+    ASSERT_NE(second, std::string::npos);
+    ASSERT_NE(out.find("\r\n\r\nnew", second), std::string::npos);
+    ASSERT_NE(out.find("Content-Length: 0\r\n"), std::string::npos);
+    ASSERT_EQ(out.find("changed"), std::string::npos);
+}
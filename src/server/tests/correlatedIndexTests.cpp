@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <thread>
+#include "../correlatedTable.h"
+
+TEST(correlated_index, lookup) {
+    CorrelatedIndex index({CorrelatedFile("/a\t127.0.0.1\t8080"),
+                           CorrelatedFile("/b\t10.0.0.1\t80"),
+                           CorrelatedFile("/a\t10.0.0.2\t80")});
+    ASSERT_EQ(index.size(), 3);
+    ASSERT_EQ(index.find("/a")->ipAddress, "127.0.0.1");
+    ASSERT_EQ(*index.findRedirect("/b"), "HTTP/1.1 302 Redirected\r\nLocation: http://10.0.0.1:80/b\r\n\r\n");
+    ASSERT_EQ(index.find("/a")->port, "8080");
+    ASSERT_EQ(index.find("/b")->resource, "/b");
+    ASSERT_FALSE(index.find("/c"));
+    ASSERT_FALSE(index.findRedirect("/"));
+}
+
+TEST(correlated_index, empty) {
+    CorrelatedIndex index(std::vector<CorrelatedFile>{});
+    ASSERT_FALSE(index.find("/a"));
+}
+
+TEST(correlated_index, from_file_in_parallel_chunks) {
+    const std::string path = "/tmp/correlatedIndexTests.txt";
+    {
+        std::ofstream os(path);
+        for (int i = 0; i < 1000; i++) {
+            os << "/file" << i << "\t10.0.0." << i % 7 << "\t" << 8000 + i << "\n";
+        }
+        os << "/file0\t10.0.0.99\t1";
+    }
+    for (unsigned threads : {1u, 3u, 16u}) {
+        CorrelatedIndex index = CorrelatedIndex::fromFile(path, threads);
+        ASSERT_EQ(index.size(), 1001);
+        ASSERT_EQ(index.find("/file0")->ipAddress, "10.0.0.0");
+        ASSERT_EQ(index.find("/file999")->port, "8999");
+        ASSERT_EQ(*index.findRedirect("/file500"), "HTTP/1.1 302 Redirected\r\nLocation: http://10.0.0.3:8500/file500\r\n\r\n");
+    }
+}
+
+TEST(correlated_index_death, bad_line) {
+    const std::string path = "/tmp/correlatedIndexTests_bad.txt";
+    std::ofstream(path) << "/a\t1.1.1.1\t80\n\n/b\t1.1.1.1\t80\n";
+    ASSERT_DEATH(CorrelatedIndex::fromFile(path, 2), "Bad servers file format");
+}
+
+TEST(correlated_table, reload_publishes_new_snapshot) {
+    const std::string path = "/tmp/correlatedTableTests.txt";
+    std::ofstream(path) << "/a\t1.1.1.1\t80\n";
+    CorrelatedTable table(path);
+    CorrelatedSnapshot snapshot;
+    std::shared_ptr<const CorrelatedIndex> old = snapshot.get(table);
+    ASSERT_EQ(old->find("/a")->ipAddress, "1.1.1.1");
+
+    std::ofstream(path) << "/a\t2.2.2.2\t80\n/b\t3.3.3.3\t80\n";
+    ASSERT_TRUE(table.reload());
+    ASSERT_EQ(snapshot.get(table)->find("/a")->ipAddress, "2.2.2.2");
+    ASSERT_TRUE(snapshot.get(table)->find("/b"));
+    // Snapshot taken before the reload stays valid.
+    ASSERT_EQ(old->find("/a")->ipAddress, "1.1.1.1");
+
+    std::ofstream(path) << "broken line\n";
+    ASSERT_FALSE(table.reload());
+    ASSERT_EQ(snapshot.get(table)->find("/a")->ipAddress, "2.2.2.2");
+}
+
+TEST(correlated_table, snapshots_race_with_publishing) {
+    const std::string path = "/tmp/correlatedTableTests.txt";
+    std::ofstream(path) << "/a\t1.1.1.1\t80\n";
+    CorrelatedTable table(path);
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&table, &done]() {
+            while (!done) {
+                ASSERT_TRUE(table.snapshot()->find("/a"));
+            }
+        });
+    }
+    // Every publish frees the previous pointer while readers keep copying the current one.
+    auto index = std::make_shared<const CorrelatedIndex>(CorrelatedIndex::fromFile(path));
+    for (int i = 0; i < 200; i++) {
+        table.publish(index);
+    }
+    done = true;
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(table.snapshot()->find("/a")->ipAddress, "1.1.1.1");
+}
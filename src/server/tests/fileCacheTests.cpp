@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include "../fileCache.h"
+
+namespace {
+    const std::string cacheDir = "/tmp/fileCacheTests";
+
+    void writeFile(const std::string &target, const std::string &content) {
+        std::ofstream(cacheDir + target) << content;
+    }
+
+    std::shared_ptr<const CachedResponse> load(FileCache &cache, const std::string &target) {
+        int fd = open((cacheDir + target).c_str(), O_RDONLY);
+        struct stat st{};
+        fstat(fd, &st);
+        auto response = cache.insert(target, fd, FileMetadata::of(st));
+        close(fd);
+        return response;
+    }
+
+    void resetDirectory() {
+        std::filesystem::remove_all(cacheDir);
+        std::filesystem::create_directories(cacheDir + "/sub");
+    }
+}
+
+TEST(file_cache, serves_prebuilt_response) {
+    resetDirectory();
+    writeFile("/a", "hello");
+    FileCache cache(cacheDir);
+    ASSERT_FALSE(cache.find("/a"));
+    ASSERT_TRUE(load(cache, "/a"));
+    auto cached = cache.find("/a");
+    ASSERT_TRUE(cached);
+    const FileMetadata &metadata = cached->getMetadata();
+    ASSERT_EQ(cached->getHeader(), "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                                   "Content-Length: 5\r\nAccept-Ranges: bytes\r\nETag: " + metadata.etag +
+                                   "\r\nLast-Modified: " + metadata.lastModifiedDate + "\r\n\r\n");
+    ASSERT_EQ(cached->getBody(), "hello");
+}
+
+TEST(file_cache, invalidated_on_change) {
+    resetDirectory();
+    writeFile("/a", "hello");
+    writeFile("/sub/b", "world");
+    FileCache cache(cacheDir);
+    ASSERT_TRUE(load(cache, "/a"));
+    ASSERT_TRUE(load(cache, "/sub/b"));
+    writeFile("/a", "changed");
+    cache.processEvents();
+    ASSERT_FALSE(cache.find("/a"));
+    ASSERT_TRUE(cache.find("/sub/b"));
+    std::filesystem::rename(cacheDir + "/sub", cacheDir + "/moved");
+    cache.processEvents();
+    ASSERT_FALSE(cache.find("/sub/b"));
+}
+
+TEST(file_cache, evicts_least_recently_used) {
+    resetDirectory();
+    writeFile("/a", "aaaa");
+    writeFile("/b", "bbbb");
+    writeFile("/c", "cccc");
+    FileCache cache(cacheDir, 8, 8);
+    ASSERT_TRUE(load(cache, "/a"));
+    ASSERT_TRUE(load(cache, "/b"));
+    ASSERT_TRUE(cache.find("/a"));
+    ASSERT_TRUE(load(cache, "/c"));
+    ASSERT_TRUE(cache.find("/a"));
+    ASSERT_FALSE(cache.find("/b"));
+    ASSERT_TRUE(cache.find("/c"));
+}
+
+TEST(file_cache, keeps_descriptors_of_big_files) {
+    resetDirectory();
+    writeFile("/a", "aaaa");
+    writeFile("/b", "bbbb");
+    FileCache cache(cacheDir, 8, 2, 1);
+    auto cached = load(cache, "/a");
+    ASSERT_TRUE(cached);
+    ASSERT_GE(cached->getFileFd(), 0);
+    ASSERT_EQ(cached->getMetadata().size, 4u);
+    ASSERT_EQ(cached->getBody(), "");
+    ASSERT_TRUE(load(cache, "/b"));
+    ASSERT_FALSE(cache.find("/a"));
+    ASSERT_TRUE(cache.find("/b"));
+    writeFile("/b", "changed");
+    cache.processEvents();
+    ASSERT_FALSE(cache.find("/b"));
+}
+
+TEST(file_cache, budget_is_split_between_workers) {
+    resetDirectory();
+    writeFile("/a", std::string(3 << 20, 'a'));
+    FileCache whole = FileCache::forWorker(cacheDir, 1);
+    ASSERT_TRUE(load(whole, "/a"));
+    FileCache share = FileCache::forWorker(cacheDir, 32);
+    ASSERT_FALSE(load(share, "/a"));
+}
+
+TEST(file_cache, variants_depend_on_their_sources) {
+    resetDirectory();
+    writeFile("/a", "hello");
+    writeFile("/b", "world");
+    FileCache cache(cacheDir);
+    const std::string gzipKey = FileCache::variantKey("/a", "gzip");
+    const std::string zstdKey = FileCache::variantKey("/a", "zstd");
+    FileMetadata metadata = load(cache, "/a")->getMetadata();
+    ASSERT_TRUE(cache.insert(gzipKey, {"/a", "/a.gz"},
+                             std::make_shared<const CachedResponse>(metadata.encoded("gzip", 3), "abc")));
+    ASSERT_TRUE(cache.insert(zstdKey, {"/a", "/a.zst"}, std::make_shared<const CachedResponse>()));
+    ASSERT_TRUE(load(cache, "/b"));
+    ASSERT_EQ(cache.find(gzipKey)->getBody(), "abc");
+    ASSERT_NE(cache.find(gzipKey)->getMetadata().etag, metadata.etag);
+    ASSERT_TRUE(cache.find(zstdKey)->isMissing());
+
+    // Creating a sibling drops only the variant made without it.
+    writeFile("/a.zst", "zstd");
+    cache.processEvents();
+    ASSERT_FALSE(cache.find(zstdKey));
+    ASSERT_TRUE(cache.find(gzipKey));
+    // Changing the file drops the file and all of its variants.
+    writeFile("/a", "changed");
+    cache.processEvents();
+    ASSERT_FALSE(cache.find("/a"));
+    ASSERT_FALSE(cache.find(gzipKey));
+    ASSERT_TRUE(cache.find("/b"));
+}
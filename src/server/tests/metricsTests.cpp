@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+#include <set>
+#include "../metrics.h"
+
+TEST(latency_histogram, buckets_are_precise) {
+    size_t previous = 0;
+    for (uint64_t value = 0; value < (1ull << 40); value = value * 5 / 4 + 1) {
+        size_t bucket = LatencyHistogram::bucketOf(value);
+        ASSERT_GE(bucket, previous) << value;
+        ASSERT_LT(value, LatencyHistogram::bucketEnd(bucket)) << value;
+        ASSERT_LE(LatencyHistogram::bucketEnd(bucket), value + value / 8 + 1) << value;
+        ASSERT_EQ(LatencyHistogram::bucketOf(LatencyHistogram::bucketEnd(bucket)), bucket + 1) << value;
+        previous = bucket;
+    }
+}
+
+TEST(metrics, aggregates_workers) {
+    Metrics metrics;
+    WorkerMetrics &first = metrics.addWorker();
+    WorkerMetrics &second = metrics.addWorker();
+    first.countResponse("200");
+    second.countResponse("200");
+    second.countResponse("404");
+    second.countResponse("418");
+    first.connectionOpened();
+    second.connectionOpened();
+    second.connectionClosed(WorkerMetrics::CloseReason::HeaderTimeout);
+    first.countSentBytes(100);
+    second.countSentBytes(23);
+    for (int i = 0; i < 1000; i++) {
+        first.recordSince(WorkerMetrics::Phase::Parse, WorkerMetrics::now());
+    }
+
+    std::string out = metrics.renderPrometheus();
+    EXPECT_NE(out.find("serwer_responses_total{code=\"200\"} 2\n"), std::string::npos) << out;
+    EXPECT_NE(out.find("serwer_responses_total{code=\"404\"} 1\n"), std::string::npos);
+    EXPECT_NE(out.find("serwer_responses_total{code=\"other\"} 1\n"), std::string::npos);
+    EXPECT_NE(out.find("serwer_connections_active 1\n"), std::string::npos);
+    EXPECT_NE(out.find("serwer_connections_accepted_total 2\n"), std::string::npos);
+    EXPECT_NE(out.find("serwer_sent_bytes_total 123\n"), std::string::npos);
+    EXPECT_NE(out.find("serwer_connections_closed_total{reason=\"header_timeout\"} 1\n"), std::string::npos);
+    EXPECT_NE(out.find("serwer_phase_duration_seconds_count{phase=\"parse\"} 1000\n"), std::string::npos);
+    EXPECT_NE(out.find("serwer_phase_duration_seconds_bucket{phase=\"parse\",le=\"+Inf\"} 1000\n"),
+              std::string::npos);
+    EXPECT_NE(out.find("serwer_phase_duration_seconds_count{phase=\"send\"} 0\n"), std::string::npos);
+}
+
+TEST(metrics, bucket_bounds_are_exact) {
+    Metrics metrics;
+    metrics.addWorker().recordSince(WorkerMetrics::Phase::Parse, WorkerMetrics::now());
+    std::string out = metrics.renderPrometheus();
+    const std::string prefix = "serwer_phase_duration_seconds_bucket{phase=\"parse\",le=\"";
+    std::vector<std::string> bounds;
+    for (size_t pos = out.find(prefix); pos != std::string::npos; pos = out.find(prefix, pos + 1)) {
+        size_t begin = pos + prefix.size();
+        bounds.push_back(out.substr(begin, out.find('"', begin) - begin));
+    }
+    ASSERT_EQ(std::set<std::string>(bounds.begin(), bounds.end()).size(), bounds.size());
+    ASSERT_EQ(std::vector<std::string>(bounds.begin(), bounds.begin() + 3),
+              std::vector<std::string>({"1e-06", "2.5e-06", "5e-06"}));
+    ASSERT_EQ(bounds.back(), "+Inf");
+    for (size_t i = 1; i + 1 < bounds.size(); i++) {
+        ASSERT_LT(std::stod(bounds[i - 1]), std::stod(bounds[i]));
+    }
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <sys/socket.h>
+#include "../connectionHandler.h"
+
+namespace {
+    const std::string filteredDir = "/tmp/targetFilterTests";
+
+    void createTree() {
+        std::filesystem::remove_all(filteredDir);
+        std::filesystem::create_directories(filteredDir + "/sub/deeper");
+        std::ofstream(filteredDir + "/a.txt") << "a";
+        std::ofstream(filteredDir + "/sub/deeper/b.txt") << "b";
+        std::filesystem::create_directory_symlink("sub/deeper", filteredDir + "/link");
+    }
+}
+
+TEST(target_filter, rules_out_only_missing_targets) {
+    createTree();
+    TargetFilter filter(filteredDir);
+    ASSERT_TRUE(filter.isEnabled());
+    for (const char *target : {"/a.txt", "/sub", "/sub/deeper", "/sub/deeper/b.txt", "/link"}) {
+        ASSERT_TRUE(filter.mayContain(target)) << target;
+    }
+    // Whatever is below a symlink, and targets which aren't plain, are never ruled out.
+    for (const char *target : {"/link/b.txt", "/link/missing", "/", "/sub/", "//a.txt", "/sub/../a.txt",
+                               "/./a.txt"}) {
+        ASSERT_TRUE(filter.mayContain(target)) << target;
+    }
+    size_t ruledOut = 0;
+    for (int i = 0; i < 1000; i++) {
+        ruledOut += !filter.mayContain("/missing-" + std::to_string(i));
+    }
+    ASSERT_GT(ruledOut, 990);
+    ASSERT_FALSE(filter.mayContain("/a.txt/x"));
+    ASSERT_FALSE(filter.mayContain("/sub/deeper/c.txt"));
+}
+
+TEST(target_filter, adds_created_entries) {
+    createTree();
+    TargetFilter filter(filteredDir);
+    ASSERT_FALSE(filter.mayContain("/new.txt"));
+    ASSERT_FALSE(filter.mayContain("/sub/deeper/new/d.txt"));
+    std::ofstream(filteredDir + "/new.txt") << "new";
+    std::filesystem::create_directories(filteredDir + "/sub/deeper/new");
+    std::ofstream(filteredDir + "/sub/deeper/new/d.txt") << "d";
+    filter.processEvents();
+    ASSERT_TRUE(filter.mayContain("/new.txt"));
+    ASSERT_TRUE(filter.mayContain("/sub/deeper/new/d.txt"));
+
+    // Files below a moved directory are found under its new name.
+    std::filesystem::rename(filteredDir + "/sub", filteredDir + "/moved");
+    filter.processEvents();
+    std::ofstream(filteredDir + "/moved/deeper/e.txt") << "e";
+    filter.processEvents();
+    ASSERT_TRUE(filter.mayContain("/moved/deeper/b.txt"));
+    ASSERT_TRUE(filter.mayContain("/moved/deeper/e.txt"));
+}
+
+TEST(target_filter, serves_missing_targets_without_opening) {
+    createTree();
+    const std::string correlated = "/tmp/targetFilterTests_correlated.txt";
+    std::ofstream(correlated) << "/remote\t10.0.0.1\t8080\n";
+    auto filter = std::make_shared<TargetFilter>(filteredDir);
+    ConnectionHandler ch(filteredDir, correlated, CorrelatedMode::Redirect, nullptr, filter);
+    WorkerMetrics metrics;
+    WorkerContext context(ch.getFilesDirectory(), metrics);
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    Connection conn(fds[0]);
+    conn.getInput().append("GET /a.txt HTTP/1.1\r\n\r\n"
+                           "GET /missing HTTP/1.1\r\n\r\n"
+                           "GET /remote HTTP/1.1\r\n\r\n"
+                           "GET /link/b.txt HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ch.handleIncomingConnection(conn, context);
+    ASSERT_TRUE(conn.flush());
+    close(fds[0]);
+    std::string out;
+    char buffer[4096];
+    ssize_t len;
+    while ((len = read(fds[1], buffer, sizeof(buffer))) > 0) {
+        out.append(buffer, len);
+    }
+    close(fds[1]);
+
+    size_t first = out.find("HTTP/1.1 200 OK");
+    size_t second = out.find("HTTP/1.1 404 Not found", first);
+    size_t third = out.find("HTTP/1.1 302 Redirected", second);
+    size_t fourth = out.find("HTTP/1.1 200 OK", third);
+    ASSERT_NE(fourth, std::string::npos);
+    ASSERT_EQ(out.substr(out.size() - 1), "b");
+    // "/missing" and "/remote" are ruled out; the latter is then found among correlated resources.
+    ASSERT_EQ(metrics.getFilterLookups(WorkerMetrics::FilterResult::Rejected), 2);
+    ASSERT_EQ(metrics.getFilterLookups(WorkerMetrics::FilterResult::Found), 2);
+}
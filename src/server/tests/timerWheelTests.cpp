@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include "../timerWheel.h"
+
+TEST(timer_wheel, fires_after_deadline) {
+    TimerWheel<int> wheel(100, 8, 1000);
+    wheel.schedule(1250, 1);
+    wheel.schedule(1100, 2);
+    wheel.schedule(5000, 3); // Several turns of the wheel ahead.
+    std::vector<int> fired;
+    auto collect = [&fired](int value, uint64_t) { fired.push_back(value); };
+
+    wheel.advance(1199, collect);
+    ASSERT_EQ(fired, std::vector<int>({2}));
+    wheel.advance(1249, collect);
+    ASSERT_EQ(fired, std::vector<int>({2}));
+    wheel.advance(1300, collect);
+    ASSERT_EQ(fired, std::vector<int>({2, 1}));
+    wheel.advance(4999, collect);
+    ASSERT_EQ(fired.size(), 2u);
+    ASSERT_EQ(wheel.size(), 1u);
+    wheel.advance(5000, collect);
+    ASSERT_EQ(fired, std::vector<int>({2, 1, 3}));
+    ASSERT_EQ(wheel.size(), 0u);
+}
+
+TEST(timer_wheel, long_pause_and_past_deadlines) {
+    TimerWheel<int> wheel(10, 4, 0);
+    for (int i = 0; i < 100; i++) {
+        wheel.schedule(i * 7, i);
+    }
+    size_t fired = 0;
+    wheel.advance(1000000, [&fired, &wheel](int value, uint64_t deadline) {
+        fired++;
+        if (value == 0) { // Rescheduling from the callback.
+            wheel.schedule(deadline, -1);
+        }
+    });
+    ASSERT_EQ(fired, 100u);
+    ASSERT_EQ(wheel.size(), 1u);
+    wheel.advance(1000010, [&fired](int value, uint64_t) { fired += value == -1; });
+    ASSERT_EQ(fired, 101u);
+}
@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <fstream>
+#include <thread>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include "../eventLoop.h"
+
+namespace {
+    const std::string certificateFile = "/tmp/tlsTests-cert.pem";
+    const std::string privateKeyFile = "/tmp/tlsTests-key.pem";
+
+    // Writes a self-signed certificate for localhost, with a P-256 key.
+    void createCertificate() {
+        EVP_PKEY *key = EVP_EC_gen("P-256");
+        ASSERT_NE(key, nullptr);
+        X509 *certificate = X509_new();
+        ASSERT_NE(certificate, nullptr);
+        ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+        X509_gmtime_adj(X509_getm_notBefore(certificate), -60);
+        X509_gmtime_adj(X509_getm_notAfter(certificate), 24 * 60 * 60);
+        X509_NAME *name = X509_get_subject_name(certificate);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("localhost"),
+                                   -1, -1, 0);
+        X509_set_issuer_name(certificate, name);
+        X509_set_pubkey(certificate, key);
+        ASSERT_GT(X509_sign(certificate, key, EVP_sha256()), 0);
+
+        FILE *out = fopen(certificateFile.c_str(), "w");
+        PEM_write_X509(out, certificate);
+        fclose(out);
+        out = fopen(privateKeyFile.c_str(), "w");
+        PEM_write_PrivateKey(out, key, nullptr, nullptr, 0, nullptr, nullptr);
+        fclose(out);
+        X509_free(certificate);
+        EVP_PKEY_free(key);
+    }
+
+    int listenOnLoopback() {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        EXPECT_EQ(bind(fd, (sockaddr *) &address, sizeof(address)), 0);
+        EXPECT_EQ(listen(fd, SOMAXCONN), 0);
+        return fd;
+    }
+
+    uint16_t portOf(int fd) {
+        sockaddr_in address{};
+        socklen_t length = sizeof(address);
+        getsockname(fd, (sockaddr *) &address, &length);
+        return ntohs(address.sin_port);
+    }
+
+    int connectTo(uint16_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        EXPECT_EQ(connect(fd, (sockaddr *) &address, sizeof(address)), 0);
+        return fd;
+    }
+
+    std::string readAll(int fd) {
+        std::string out;
+        char buffer[64 * 1024];
+        ssize_t len;
+        while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+            out.append(buffer, len);
+        }
+        return out;
+    }
+
+    /*
+     * Sends requests over TLS and reads the response until the server closes the connection.
+     * The session is resumed if given, and the one negotiated is stored in it.
+     * */
+    std::string fetchOverTls(SSL_CTX *clientContext, uint16_t port, const std::string &requests,
+                             SSL_SESSION *&session, bool &resumed) {
+        int fd = connectTo(port);
+        SSL *ssl = SSL_new(clientContext);
+        SSL_set_fd(ssl, fd);
+        if (session != nullptr) {
+            SSL_set_session(ssl, session);
+        }
+        std::string out;
+        if (SSL_connect(ssl) == 1 && SSL_write(ssl, requests.data(), static_cast<int>(requests.size())) > 0) {
+            char buffer[64 * 1024];
+            int len;
+            while ((len = SSL_read(ssl, buffer, sizeof(buffer))) > 0) {
+                out.append(buffer, len);
+            }
+        }
+        resumed = SSL_session_reused(ssl) == 1;
+        SSL_SESSION_free(session);
+        session = SSL_get1_session(ssl);
+        SSL_shutdown(ssl); // Otherwise the session is marked as not resumable.
+        SSL_free(ssl);
+        close(fd);
+        return out;
+    }
+
+    // Runs an event loop listening for plain and TLS connections until client returns.
+    void serve(const ConnectionHandler &ch, WorkerMetrics &metrics,
+               const std::function<void(uint16_t plainPort, uint16_t tlsPort)> &client) {
+        createCertificate();
+        std::shared_ptr<const TlsContext> tlsContext = TlsContext::fromFiles(certificateFile, privateKeyFile);
+        int listenFd = listenOnLoopback();
+        int tlsListenFd = listenOnLoopback();
+        uint16_t plainPort = portOf(listenFd);
+        uint16_t tlsPort = portOf(tlsListenFd);
+        {
+            EventLoop loop(listenFd, ch, metrics);
+            loop.listenTls(tlsListenFd, tlsContext);
+            std::atomic<bool> done{false};
+            std::thread clientThread([&]() {
+                client(plainPort, tlsPort);
+                done = true;
+                close(connectTo(plainPort)); // Wakes the loop up.
+            });
+            while (!done) {
+                loop.runOnce();
+            }
+            clientThread.join();
+        }
+        close(listenFd);
+        close(tlsListenFd);
+    }
+}
+
+TEST(tls, serves_files_alongside_plain_connections) {
+    const std::string big(3 << 20, 'x');
+    std::ofstream("/tmp/tlsTests-big.txt") << big;
+    std::ofstream("/tmp/tlsTests-small.txt") << "hello";
+    ConnectionHandler ch("/tmp", "/dev/null");
+    WorkerMetrics metrics;
+    const std::string requests = "GET /tlsTests-small.txt HTTP/1.1\r\n\r\n"
+                                 "GET /tlsTests-big.txt HTTP/1.1\r\n\r\n"
+                                 "GET /tlsTests-missing HTTP/1.1\r\nConnection: close\r\n\r\n";
+    std::string secure;
+    std::string plain;
+    serve(ch, metrics, [&](uint16_t plainPort, uint16_t tlsPort) {
+        SSL_CTX *clientContext = SSL_CTX_new(TLS_client_method());
+        SSL_SESSION *session = nullptr;
+        bool resumed;
+        secure = fetchOverTls(clientContext, tlsPort, requests, session, resumed);
+        SSL_SESSION_free(session);
+        SSL_CTX_free(clientContext);
+
+        int fd = connectTo(plainPort);
+        ASSERT_EQ(write(fd, requests.data(), requests.size()), requests.size());
+        plain = readAll(fd);
+        close(fd);
+    });
+    ASSERT_NE(plain.find(big), std::string::npos);
+    ASSERT_NE(plain.find("HTTP/1.1 404 Not found"), std::string::npos);
+    ASSERT_TRUE(secure == plain);
+    ASSERT_EQ(metrics.getTlsHandshakes(false), 1);
+    ASSERT_EQ(metrics.getTlsHandshakes(true), 0);
+}
+
+TEST(tls, resumes_sessions) {
+    std::ofstream("/tmp/tlsTests-small.txt") << "hello";
+    ConnectionHandler ch("/tmp", "/dev/null");
+    WorkerMetrics metrics;
+    std::vector<bool> resumptions;
+    serve(ch, metrics, [&](uint16_t, uint16_t tlsPort) {
+        SSL_CTX *clientContext = SSL_CTX_new(TLS_client_method());
+        SSL_SESSION *session = nullptr;
+        for (int version : {TLS1_3_VERSION, TLS1_2_VERSION}) {
+            // Tickets with TLS 1.3, the server's session cache with TLS 1.2.
+            SSL_CTX_set_max_proto_version(clientContext, version);
+            SSL_CTX_set_options(clientContext, version == TLS1_2_VERSION ? SSL_OP_NO_TICKET : 0);
+            SSL_SESSION_free(session);
+            session = nullptr;
+            for (int i = 0; i < 2; i++) {
+                bool resumed;
+                std::string out = fetchOverTls(clientContext, tlsPort,
+                                               "GET /tlsTests-small.txt HTTP/1.1\r\nConnection: close\r\n\r\n",
+                                               session, resumed);
+                EXPECT_EQ(out.substr(out.size() - 5), "hello");
+                resumptions.push_back(resumed);
+            }
+        }
+        SSL_SESSION_free(session);
+        SSL_CTX_free(clientContext);
+    });
+    ASSERT_EQ(resumptions, std::vector<bool>({false, true, false, true}));
+    ASSERT_EQ(metrics.getTlsHandshakes(false), 2);
+    ASSERT_EQ(metrics.getTlsHandshakes(true), 2);
+}
+
+TEST(tls, closes_connections_failing_handshake) {
+    ConnectionHandler ch("/tmp", "/dev/null");
+    WorkerMetrics metrics;
+    std::string out;
+    serve(ch, metrics, [&](uint16_t, uint16_t tlsPort) {
+        int fd = connectTo(tlsPort);
+        const std::string request = "GET /tlsTests-small.txt HTTP/1.1\r\n\r\n";
+        ASSERT_EQ(write(fd, request.data(), request.size()), request.size());
+        out = readAll(fd);
+        close(fd);
+    });
+    // Whatever comes back is a TLS alert, not a response.
+    ASSERT_EQ(out.find("HTTP/1.1"), std::string::npos);
+    ASSERT_EQ(metrics.getClosed(WorkerMetrics::CloseReason::TlsError), 1);
+    ASSERT_EQ(metrics.getTlsHandshakes(false), 0);
+}
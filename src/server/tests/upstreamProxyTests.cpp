@@ -0,0 +1,231 @@
+#include <gtest/gtest.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "../eventLoop.h"
+
+namespace {
+    int listenOnLoopback(bool startListening = true) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        EXPECT_EQ(bind(fd, (sockaddr *) &address, sizeof(address)), 0);
+        if (startListening) {
+            EXPECT_EQ(listen(fd, SOMAXCONN), 0);
+        }
+        return fd;
+    }
+
+    uint16_t portOf(int fd) {
+        sockaddr_in address{};
+        socklen_t length = sizeof(address);
+        getsockname(fd, (sockaddr *) &address, &length);
+        return ntohs(address.sin_port);
+    }
+
+    int connectTo(uint16_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        EXPECT_EQ(connect(fd, (sockaddr *) &address, sizeof(address)), 0);
+        return fd;
+    }
+
+    void writeAll(int fd, const std::string &data) {
+        for (size_t done = 0; done < data.size();) {
+            ssize_t written = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (written <= 0) {
+                return;
+            }
+            done += written;
+        }
+    }
+
+    /*
+     * Correlated server standing in for a real one: answers requests for known targets with
+     * canned responses, without the body for HEAD, on any number of keep-alive connections.
+     * */
+    class StandInServer {
+    public:
+        explicit StandInServer(std::map<std::string, std::string> responses, bool closeAfterResponse = false) :
+                responses(std::move(responses)), closeAfterResponse(closeAfterResponse) {
+            listenFd = listenOnLoopback();
+            port = portOf(listenFd);
+            acceptor = std::thread([this]() {
+                int fd;
+                while ((fd = accept(listenFd, nullptr, nullptr)) >= 0) {
+                    accepted++;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    connections.emplace_back([this, fd]() { serve(fd); });
+                }
+            });
+        }
+
+        ~StandInServer() {
+            shutdown(listenFd, SHUT_RDWR); // Wakes the acceptor up.
+            acceptor.join();
+            for (std::thread &connection : connections) {
+                connection.join();
+            }
+            close(listenFd);
+        }
+
+        uint16_t port;
+        std::atomic<int> accepted{0};
+
+    private:
+        std::map<std::string, std::string> responses;
+        bool closeAfterResponse;
+        int listenFd;
+        std::thread acceptor;
+        std::mutex mutex;
+        std::vector<std::thread> connections;
+
+        void serve(int fd) {
+            std::string input;
+            char buffer[4096];
+            ssize_t len;
+            while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+                input.append(buffer, len);
+                size_t end;
+                while ((end = input.find("\r\n\r\n")) != std::string::npos) {
+                    std::string requestLine = input.substr(0, input.find("\r\n"));
+                    input.erase(0, end + 4);
+                    size_t space = requestLine.find(' ');
+                    std::string target = requestLine.substr(space + 1, requestLine.find(' ', space + 1) - space - 1);
+                    std::string response = responses.count(target) > 0 ? responses[target]
+                                                                        : "HTTP/1.1 404 Not Found\r\n\r\n";
+                    if (requestLine.compare(0, 5, "HEAD ") == 0) {
+                        response = response.substr(0, response.find("\r\n\r\n") + 4);
+                    }
+                    writeAll(fd, response);
+                    if (closeAfterResponse) {
+                        close(fd);
+                        return;
+                    }
+                }
+            }
+            close(fd);
+        }
+    };
+
+    ConnectionHandler makeHandler(uint16_t upstreamPort, CorrelatedMode mode) {
+        const std::string correlated = "/tmp/upstreamProxyTests_correlated.txt";
+        std::ofstream(correlated) << "/upstreamProxyTests-a\t127.0.0.1\t" << upstreamPort << "\n"
+                                  << "/upstreamProxyTests-b\t127.0.0.1\t" << upstreamPort << "\n"
+                                  << "/upstreamProxyTests-big\t127.0.0.1\t" << upstreamPort << "\n";
+        return ConnectionHandler("/tmp", correlated, mode);
+    }
+
+    // Serves a single client connection sending requests, which the server closes once done.
+    std::string serve(const ConnectionHandler &ch, WorkerMetrics &metrics, const std::string &requests) {
+        int listenFd = listenOnLoopback();
+        uint16_t port = portOf(listenFd);
+        std::string response;
+        {
+            EventLoop loop(listenFd, ch, metrics);
+            std::atomic<bool> done{false};
+            std::thread client([&]() {
+                int fd = connectTo(port);
+                writeAll(fd, requests);
+                char buffer[64 * 1024];
+                ssize_t len;
+                while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+                    response.append(buffer, len);
+                }
+                close(fd);
+                done = true;
+                close(connectTo(port)); // Wakes the loop up.
+            });
+            while (!done) {
+                loop.runOnce();
+            }
+            client.join();
+        }
+        close(listenFd);
+        return response;
+    }
+}
+
+TEST(upstream_proxy, streams_responses_over_pooled_connection) {
+    const std::string big(1 << 20, 'x');
+    StandInServer upstream({
+            {"/upstreamProxyTests-a", "HTTP/1.1 200 OK\r\nConnection: keep-alive\r\nContent-Length: 5\r\n\r\nhello"},
+            {"/upstreamProxyTests-b", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nworld\r\n0\r\n\r\n"},
+            {"/upstreamProxyTests-big", "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(big.size()) +
+                                        "\r\n\r\n" + big}});
+    ConnectionHandler ch = makeHandler(upstream.port, CorrelatedMode::ProxyElseRedirect);
+    WorkerMetrics metrics;
+    std::string out = serve(ch, metrics, "GET /upstreamProxyTests-a HTTP/1.1\r\n\r\n"
+                                         "GET /upstreamProxyTests-b HTTP/1.1\r\n\r\n"
+                                         "HEAD /upstreamProxyTests-a HTTP/1.1\r\n\r\n"
+                                         "GET /upstreamProxyTests-big HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(out, "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello"
+                   "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nworld\r\n0\r\n\r\n"
+                   "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n"
+                   "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(big.size()) + "\r\n\r\n" + big);
+    ASSERT_EQ(upstream.accepted, 1);
+    ASSERT_EQ(metrics.getReusedUpstreamConnections(), 3);
+    ASSERT_EQ(metrics.getUpstreamRequests(WorkerMetrics::UpstreamResult::Proxied), 4);
+    ASSERT_EQ(metrics.getResponses(0), 4);
+}
+
+TEST(upstream_proxy, replaces_connections_closed_by_server) {
+    StandInServer upstream({{"/upstreamProxyTests-a", "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"}}, true);
+    ConnectionHandler ch = makeHandler(upstream.port, CorrelatedMode::ProxyElseNotFound);
+    WorkerMetrics metrics;
+    std::string out = serve(ch, metrics, "GET /upstreamProxyTests-a HTTP/1.1\r\n\r\n"
+                                         "GET /upstreamProxyTests-a HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(out, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"
+                   "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok");
+    ASSERT_EQ(upstream.accepted, 2);
+    ASSERT_EQ(metrics.getUpstreamRequests(WorkerMetrics::UpstreamResult::Failed), 0);
+}
+
+TEST(upstream_proxy, falls_back_while_server_is_down) {
+    // Bound but not listening, so connecting is refused.
+    int downFd = listenOnLoopback(false);
+    uint16_t downPort = portOf(downFd);
+    const std::string redirect = "HTTP/1.1 302 Redirected\r\nLocation: http://127.0.0.1:" +
+                                 std::to_string(downPort) + "/upstreamProxyTests-a\r\n\r\n";
+
+    ConnectionHandler redirecting = makeHandler(downPort, CorrelatedMode::ProxyElseRedirect);
+    WorkerMetrics metrics;
+    std::string out = serve(redirecting, metrics, "GET /upstreamProxyTests-a HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(out, redirect);
+    ASSERT_EQ(metrics.getUpstreamRequests(WorkerMetrics::UpstreamResult::Failed), 1);
+    // The server is known to be down now, so it isn't even tried.
+    out = serve(redirecting, metrics, "GET /upstreamProxyTests-a HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(out, redirect);
+    ASSERT_EQ(metrics.getUpstreamRequests(WorkerMetrics::UpstreamResult::Failed), 1);
+    ASSERT_EQ(metrics.getUpstreamRequests(WorkerMetrics::UpstreamResult::Fallback), 2);
+
+    ConnectionHandler notFound = makeHandler(downPort, CorrelatedMode::ProxyElseNotFound);
+    out = serve(notFound, metrics, "HEAD /upstreamProxyTests-a HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ASSERT_EQ(out, "HTTP/1.1 404 Not found\r\n\r\n");
+    close(downFd);
+}
+
+TEST(upstream_health, checks_mark_servers_down_and_up) {
+    UpstreamRegistry registry;
+    int fd = listenOnLoopback(false);
+    std::shared_ptr<Upstream> upstream = registry.get("127.0.0.1", std::to_string(portOf(fd)));
+    std::shared_ptr<Upstream> unresolved = registry.get("localhost", "80");
+    ASSERT_TRUE(upstream->isHealthy());
+    ASSERT_FALSE(unresolved->isHealthy());
+    ASSERT_EQ(registry.get("127.0.0.1", std::to_string(portOf(fd))), upstream);
+
+    registry.checkHealth(UpstreamRegistry::checkTimeoutMs);
+    ASSERT_FALSE(upstream->isHealthy());
+    ASSERT_EQ(listen(fd, SOMAXCONN), 0);
+    registry.checkHealth(UpstreamRegistry::checkTimeoutMs);
+    ASSERT_TRUE(upstream->isHealthy());
+    ASSERT_FALSE(unresolved->isHealthy());
+    close(fd);
+}
@@ -0,0 +1,83 @@
+#ifndef ZALICZENIOWE1_TIMERWHEEL_H
+#define ZALICZENIOWE1_TIMERWHEEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <time.h>
+
+/*
+ * Hashed timing wheel: timers are appended to the slot of their deadline tick and slots
+ * are swept as time passes, so scheduling is O(1) and cancelling is free (stale timers are
+ * recognized and dropped by the owner when they fire). Timers further away than one turn
+ * of the wheel stay in their slot until the round they belong to.
+ * */
+template<typename T>
+class TimerWheel {
+public:
+    TimerWheel(uint64_t tickMs, size_t slotsNum, uint64_t nowMs) :
+            tickMs(tickMs), slots(slotsNum), currentTick(nowMs / tickMs) {}
+
+    // Cheap monotonic clock with a few milliseconds resolution, good enough for timeouts.
+    static uint64_t clockMs() {
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+    }
+
+    void schedule(uint64_t deadlineMs, T value) {
+        uint64_t tick = std::max(currentTick + 1, (deadlineMs + tickMs - 1) / tickMs);
+        slots[tick % slots.size()].push_back(Timer{deadlineMs, std::move(value)});
+        count++;
+    }
+
+    /*
+     * Moves the wheel to nowMs and calls onExpired(value, deadlineMs) for every timer with
+     * a deadline which has passed. The callback may schedule new timers.
+     * */
+    template<typename OnExpired>
+    void advance(uint64_t nowMs, OnExpired onExpired) {
+        uint64_t targetTick = nowMs / tickMs;
+        std::vector<Timer> expired;
+        // Sweeping more than one turn would only visit the same slots again.
+        uint64_t firstTick = std::max(currentTick + 1, targetTick >= slots.size() ? targetTick - slots.size() + 1 : 0);
+        for (uint64_t tick = firstTick; tick <= targetTick; tick++) {
+            std::vector<Timer> &slot = slots[tick % slots.size()];
+            for (size_t i = 0; i < slot.size();) {
+                if (slot[i].deadlineMs <= nowMs) {
+                    expired.push_back(std::move(slot[i]));
+                    slot[i] = std::move(slot.back());
+                    slot.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+        currentTick = std::max(currentTick, targetTick);
+        count -= expired.size();
+        for (Timer &timer : expired) {
+            onExpired(timer.value, timer.deadlineMs);
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    uint64_t getTickMs() const {
+        return tickMs;
+    }
+
+private:
+    struct Timer {
+        uint64_t deadlineMs;
+        T value;
+    };
+
+    uint64_t tickMs;
+    std::vector<std::vector<Timer>> slots;
+    uint64_t currentTick;
+    size_t count = 0;
+};
+
+#endif //ZALICZENIOWE1_TIMERWHEEL_H
@@ -0,0 +1,215 @@
+#ifndef ZALICZENIOWE1_TLSSESSION_H
+#define ZALICZENIOWE1_TLSSESSION_H
+
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <sys/types.h>
+
+#include "../utils/serverAssertions.h"
+
+/*
+ * Server side TLS configuration: certificate chain, private key, and the session cache and ticket
+ * keys. It's shared by all workers, so a session established with one resumes on any other.
+ * Kernel TLS is asked for: once a handshake is done, OpenSSL hands the keys over to the kernel
+ * if it supports the negotiated cipher, and records are then encrypted by the kernel.
+ * */
+class TlsContext {
+public:
+    TlsContext(const TlsContext &) = delete;
+
+    TlsContext &operator=(const TlsContext &) = delete;
+
+    ~TlsContext() {
+        SSL_CTX_free(ctx);
+    }
+
+    // Returns nullptr with error set if the certificate or the key can't be loaded.
+    static std::shared_ptr<const TlsContext> tryFromFiles(const std::string &certificateFile,
+                                                          const std::string &privateKeyFile, std::string &error) {
+        SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+        if (ctx == nullptr) {
+            error = "Can't create TLS context: " + lastError();
+            return nullptr;
+        }
+        std::shared_ptr<TlsContext> context(new TlsContext(ctx));
+        SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+        uint64_t options = SSL_OP_NO_RENEGOTIATION | SSL_OP_IGNORE_UNEXPECTED_EOF;
+#ifdef SSL_OP_ENABLE_KTLS
+        options |= SSL_OP_ENABLE_KTLS;
+#endif
+        SSL_CTX_set_options(ctx, options);
+        // Output is written from queued chunks which may be resent from elsewhere, and in parts.
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, sessionCacheSize);
+        SSL_CTX_set_session_id_context(ctx, reinterpret_cast<const unsigned char *>(sessionIdContext),
+                                       sizeof(sessionIdContext) - 1);
+        SSL_CTX_set_num_tickets(ctx, 1);
+        if (SSL_CTX_use_certificate_chain_file(ctx, certificateFile.c_str()) != 1 ||
+            SSL_CTX_use_PrivateKey_file(ctx, privateKeyFile.c_str(), SSL_FILETYPE_PEM) != 1 ||
+            SSL_CTX_check_private_key(ctx) != 1) {
+            error = "Can't load TLS certificate or key: " + lastError();
+            return nullptr;
+        }
+        return context;
+    }
+
+    static std::shared_ptr<const TlsContext> fromFiles(const std::string &certificateFile,
+                                                       const std::string &privateKeyFile) {
+        std::string error;
+        std::shared_ptr<const TlsContext> context = tryFromFiles(certificateFile, privateKeyFile, error);
+        exit_on_fail(context != nullptr, error);
+        return context;
+    }
+
+    SSL_CTX *get() const {
+        return ctx;
+    }
+
+private:
+    static constexpr long sessionCacheSize = 20000;
+    static constexpr char sessionIdContext[] = "zaliczeniowe1";
+
+    SSL_CTX *ctx;
+
+    explicit TlsContext(SSL_CTX *ctx) : ctx(ctx) {}
+
+    static std::string lastError() {
+        char buffer[256];
+        ERR_error_string_n(ERR_get_error(), buffer, sizeof(buffer));
+        ERR_clear_error();
+        return buffer;
+    }
+};
+
+/*
+ * TLS state of one client connection on a non-blocking socket. Reading and writing behave like
+ * read() and send(): they return -1 with errno set to EAGAIN when the socket isn't ready, and
+ * reading returns 0 once the client has closed the connection.
+ * */
+class TlsSession {
+public:
+    enum class Status {
+        Done, WantRead, WantWrite, Failed
+    };
+
+    TlsSession(const TlsContext &context, int socket) : ssl(SSL_new(context.get())) {
+        if (ssl != nullptr && SSL_set_fd(ssl, socket) != 1) {
+            SSL_free(ssl);
+            ssl = nullptr;
+        }
+    }
+
+    TlsSession(const TlsSession &) = delete;
+
+    TlsSession &operator=(const TlsSession &) = delete;
+
+    // Sends close_notify, if it can be sent right away, so that clients can tell the end of a response.
+    ~TlsSession() {
+        if (ssl == nullptr) {
+            return;
+        }
+        if (established && !failed) {
+            ERR_clear_error();
+            SSL_shutdown(ssl);
+        }
+        SSL_free(ssl);
+        ERR_clear_error();
+    }
+
+    // Whether the session could be set up for the socket at all.
+    bool isValid() const {
+        return ssl != nullptr;
+    }
+
+    // Carries on with the handshake as far as the socket allows.
+    Status handshake() {
+        ERR_clear_error();
+        int result = SSL_accept(ssl);
+        if (result == 1) {
+            established = true;
+            return Status::Done;
+        }
+        switch (SSL_get_error(ssl, result)) {
+            case SSL_ERROR_WANT_READ:
+                return Status::WantRead;
+            case SSL_ERROR_WANT_WRITE:
+                return Status::WantWrite;
+            default:
+                failed = true;
+                ERR_clear_error();
+                return Status::Failed;
+        }
+    }
+
+    bool isEstablished() const {
+        return established;
+    }
+
+    bool isResumed() const {
+        return SSL_session_reused(ssl) == 1;
+    }
+
+    /*
+     * Whether records are sent by the kernel, so that plain writes and sendfile() on the socket
+     * are encrypted on their way out.
+     * */
+    bool sendsInKernel() const {
+#ifndef OPENSSL_NO_KTLS
+        return BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0;
+#else
+        return false;
+#endif
+    }
+
+    // Whether decrypted bytes are buffered by OpenSSL, which polling the socket wouldn't report.
+    bool hasPendingInput() const {
+        return SSL_pending(ssl) > 0;
+    }
+
+    ssize_t read(char *buffer, size_t length) {
+        ERR_clear_error();
+        size_t done = 0;
+        int result = SSL_read_ex(ssl, buffer, length, &done);
+        return result == 1 ? static_cast<ssize_t>(done) : failure(result, true);
+    }
+
+    /*
+     * Writes in records of at most 16 KiB and returns how much has been written. After EAGAIN,
+     * the same bytes have to be written again, as part of them may be encrypted already.
+     * */
+    ssize_t write(const char *data, size_t length) {
+        ERR_clear_error();
+        size_t done = 0;
+        int result = SSL_write_ex(ssl, data, length, &done);
+        return result == 1 ? static_cast<ssize_t>(done) : failure(result, false);
+    }
+
+private:
+    SSL *ssl;
+    bool established = false;
+    bool failed = false;
+
+    ssize_t failure(int result, bool reading) {
+        int error = SSL_get_error(ssl, result);
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (error == SSL_ERROR_ZERO_RETURN && reading) {
+            return 0;
+        }
+        if (error != SSL_ERROR_SYSCALL || errno == 0) {
+            errno = EIO;
+        }
+        failed = true;
+        ERR_clear_error();
+        return -1;
+    }
+};
+
+#endif //ZALICZENIOWE1_TLSSESSION_H
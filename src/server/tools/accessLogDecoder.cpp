@@ -0,0 +1,69 @@
+/*
+ * Prints records of access logs written by ./serwer -l, one request per line:
+ * time, method, target, status, bytes, handling time in microseconds and the correlated server,
+ * with "-" for no status or server. Rotated files are best given oldest first.
+ * Usage: ./access_log_decoder access_log...
+ * */
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../../utils/serverAssertions.h"
+#include "../accessLog.h"
+
+namespace {
+    std::string_view methodName(AccessRecord::Method method) {
+        switch (method) {
+            case AccessRecord::Method::Get:
+                return "GET";
+            case AccessRecord::Method::Head:
+                return "HEAD";
+            default:
+                return "OTHER";
+        }
+    }
+
+    // UTC time with milliseconds, e.g. 2024-01-31T12:00:00.123Z.
+    std::string formatTime(uint64_t timestampNs) {
+        time_t seconds = timestampNs / 1000000000;
+        tm utc{};
+        gmtime_r(&seconds, &utc);
+        char buffer[64];
+        size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utc);
+        snprintf(buffer + length, sizeof(buffer) - length, ".%03uZ",
+                 static_cast<unsigned>(timestampNs / 1000000 % 1000));
+        return buffer;
+    }
+}
+
+int main(int argc, char **argv) {
+    exit_on_fail(argc >= 2, "Usage: ./access_log_decoder access_log...");
+    for (int i = 1; i < argc; i++) {
+        std::ifstream in(argv[i], std::ios::binary);
+        exit_on_fail(in.good(), std::string("Can't open ") + argv[i] + ".");
+        std::stringstream contents;
+        contents << in.rdbuf();
+        const std::string file = contents.str();
+        std::string_view data(file);
+        exit_on_fail(data.substr(0, AccessLog::fileMagic.size()) == AccessLog::fileMagic,
+                     std::string(argv[i]) + " isn't an access log.");
+        data.remove_prefix(AccessLog::fileMagic.size());
+        while (std::optional<DecodedAccessRecord> decoded = AccessLog::decode(data)) {
+            const AccessRecord &record = decoded->record;
+            std::cout << formatTime(record.timestampNs) << ' ' << methodName(record.method) << ' '
+                      << decoded->target << ' ';
+            if (record.status == 0) {
+                std::cout << '-';
+            } else {
+                std::cout << record.status;
+            }
+            std::cout << ' ' << record.bytes << ' ' << record.durationNs / 1000 << ' '
+                      << (decoded->upstream.empty() ? "-" : decoded->upstream) << '\n';
+        }
+        if (!data.empty()) {
+            std::cerr << argv[i] << ": " << data.size() << " trailing bytes aren't a complete record." << std::endl;
+        }
+    }
+}
@@ -0,0 +1,18 @@
+/*
+ * Packs a directory with files into a content pack, which ./serwer -k serves from memory.
+ * The pack is a snapshot; it has to be rebuilt, and the server restarted, when files change.
+ * Usage: ./content_packer directory_with_files content_pack
+ * */
+#include <iostream>
+#include <string>
+
+#include "../../utils/serverAssertions.h"
+#include "../contentPack.h"
+
+int main(int argc, char **argv) {
+    exit_on_fail(argc == 3, "Usage: ./content_packer directory_with_files content_pack");
+    std::string error;
+    exit_on_fail(ContentPack::build(argv[1], argv[2], error), error);
+    // Loaded back, so that a pack the server would reject is noticed right away.
+    std::cout << "Packed " << ContentPack::fromFile(argv[2], false)->size() << " files into " << argv[2] << std::endl;
+}
@@ -0,0 +1,238 @@
+#ifndef ZALICZENIOWE1_UPSTREAMEXCHANGE_H
+#define ZALICZENIOWE1_UPSTREAMEXCHANGE_H
+
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../utils/httpResponses.h"
+#include "upstreams.h"
+
+/*
+ * Single request proxied to a correlated server: the request is sent over a new connection or an
+ * idle keep-alive one, and the response is handed over for the client piece by piece, as it arrives.
+ * Until the first piece is handed over the exchange may still give up, and the client gets the
+ * fallback response prepared with it instead. The event loop does the polling.
+ * */
+class UpstreamExchange {
+public:
+    enum class Status {
+        InProgress, Done, Failed
+    };
+
+    UpstreamExchange(std::shared_ptr<Upstream> upstream, std::string request, bool headRequest,
+                     std::string fallback, std::string fallbackStatus) :
+            upstream(std::move(upstream)), request(std::move(request)), headRequest(headRequest),
+            fallback(std::move(fallback)), fallbackStatus(std::move(fallbackStatus)) {}
+
+    UpstreamExchange(const UpstreamExchange &) = delete;
+
+    UpstreamExchange &operator=(const UpstreamExchange &) = delete;
+
+    ~UpstreamExchange() {
+        if (socket >= 0) {
+            close(socket);
+        }
+    }
+
+    /*
+     * Sends the request over pooledSocket, an idle connection to the server, or over a new
+     * connection if it's -1. Returns false if connecting has failed right away.
+     * */
+    bool start(int pooledSocket) {
+        if (socket >= 0) {
+            close(socket);
+        }
+        started = true;
+        reused = pooledSocket >= 0;
+        socket = reused ? pooledSocket : upstream->connect();
+        connected = reused;
+        requestOffset = 0;
+        return socket >= 0;
+    }
+
+    bool isStarted() const {
+        return started;
+    }
+
+    // Whether the socket came from the pool; a failure of such a connection says little about the server.
+    bool isReused() const {
+        return reused;
+    }
+
+    bool isConnected() const {
+        return connected;
+    }
+
+    // Whether anything has been received; only then a failure of a reused connection means more than its age.
+    bool hasReceived() const {
+        return received;
+    }
+
+    // Whether a part of the response has been handed over, so that the fallback can't be sent anymore.
+    bool hasForwarded() const {
+        return forwarded;
+    }
+
+    bool wantsWrite() const {
+        return started && requestOffset < request.size();
+    }
+
+    int getSocket() const {
+        return socket;
+    }
+
+    Upstream &getUpstream() const {
+        return *upstream;
+    }
+
+    std::string_view getMethod() const {
+        return headRequest ? "HEAD" : "GET";
+    }
+
+    // Target requested from the server, the same the client has requested.
+    std::string_view getTarget() const {
+        std::string_view target(request);
+        target.remove_prefix(getMethod().size() + 1);
+        return target.substr(0, target.find(' '));
+    }
+
+    // Bytes of the response handed over for the client so far.
+    uint64_t getForwardedBytes() const {
+        return forwardedBytes;
+    }
+
+    const std::string &getStatusCode() const {
+        return statusCode;
+    }
+
+    const std::string &getFallback() const {
+        return fallback;
+    }
+
+    const std::string &getFallbackStatus() const {
+        return fallbackStatus;
+    }
+
+    // Whether the response is delimited by closing the connection, which the client's one has to follow.
+    bool closesClient() const {
+        return framing.getKind() == httpResponses::BodyFraming::Kind::UntilClose;
+    }
+
+    // Whether the connection may carry another request once the response is complete.
+    bool isReusable() const {
+        return keepAlive && framing.isDone();
+    }
+
+    // Gives the connection away, e.g. back to the pool.
+    int releaseSocket() {
+        return std::exchange(socket, -1);
+    }
+
+    // Finishes connecting and sends the request.
+    Status handleWritable() {
+        if (!connected) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+                return Status::Failed;
+            }
+            connected = true;
+        }
+        ssize_t sent = send(socket, request.data() + requestOffset, request.size() - requestOffset, MSG_NOSIGNAL);
+        if (sent < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? Status::InProgress : Status::Failed;
+        }
+        requestOffset += sent;
+        return Status::InProgress;
+    }
+
+    // Reads what the server has sent. Bytes of the response to pass on are appended to out.
+    Status handleReadable(std::string &out) {
+        size_t previous = out.size();
+        out.resize(previous + readChunkSize);
+        ssize_t len = read(socket, &out[previous], readChunkSize);
+        out.resize(previous + std::max<ssize_t>(len, 0));
+        if (len < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? Status::InProgress : Status::Failed;
+        }
+        if (len == 0) {
+            keepAlive = false;
+            return !statusCode.empty() && closesClient() ? Status::Done : Status::Failed;
+        }
+        received = true;
+        std::string_view data(out.data() + previous, len);
+        std::string body;
+        bool inHead = !head.empty() || statusCode.empty();
+        if (inHead) {
+            // Head of the response is collected until it's complete.
+            head.append(data);
+            out.resize(previous);
+            size_t end = head.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                return head.size() > maxHeadSize ? Status::Failed : Status::InProgress;
+            }
+            std::optional<httpResponses::ResponseHead> parsed = httpResponses::parseHead(
+                    std::string_view(head).substr(0, end + 4), headRequest);
+            if (!parsed) {
+                return Status::Failed;
+            }
+            statusCode = parsed->statusCode;
+            keepAlive = parsed->keepAlive;
+            framing = parsed->framing;
+            out += parsed->forwarded;
+            body = head.substr(end + 4);
+            head.clear();
+            data = body;
+        }
+        size_t used = framing.consume(data);
+        if (framing.isInvalid()) {
+            return Status::Failed;
+        }
+        // Anything after the response is unexpected; the connection can't be trusted with another request.
+        keepAlive = keepAlive && used == data.size();
+        if (inHead) {
+            out.append(data.substr(0, used));
+        } else {
+            out.resize(previous + used);
+        }
+        forwarded = forwarded || out.size() > previous;
+        forwardedBytes += out.size() - previous;
+        return framing.isDone() ? Status::Done : Status::InProgress;
+    }
+
+    // Events the event loop waits for on the socket, and WorkerMetrics::now() and TimerWheel::clockMs() of the start.
+    uint32_t pollEvents = 0;
+    uint64_t startedAt = 0;
+    uint64_t startedMs = 0;
+
+private:
+    static constexpr size_t readChunkSize = 64 * 1024;
+    static constexpr size_t maxHeadSize = 16 * 1024;
+
+    std::shared_ptr<Upstream> upstream;
+    std::string request;
+    bool headRequest;
+    std::string fallback;
+    std::string fallbackStatus;
+    int socket = -1;
+    bool started = false;
+    bool reused = false;
+    bool connected = false;
+    bool received = false;
+    bool forwarded = false;
+    uint64_t forwardedBytes = 0;
+    size_t requestOffset = 0;
+    std::string head;
+    std::string statusCode;
+    bool keepAlive = false;
+    httpResponses::BodyFraming framing{httpResponses::BodyFraming::Kind::Length, 0};
+};
+
+#endif //ZALICZENIOWE1_UPSTREAMEXCHANGE_H
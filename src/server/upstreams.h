@@ -0,0 +1,159 @@
+#ifndef ZALICZENIOWE1_UPSTREAMS_H
+#define ZALICZENIOWE1_UPSTREAMS_H
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../utils/httpRanges.h"
+
+/*
+ * Correlated server which resources are fetched from in proxy mode. Its health is shared by all
+ * workers, which read it with a single atomic load. It's updated by background health checks and
+ * by requests which have failed. Only numeric IPv4 addresses are supported; a server with any other
+ * address is never healthy, so its resources are served as in the absence of the proxy mode.
+ * */
+class Upstream {
+public:
+    Upstream(std::string_view ipAddress, std::string_view port) :
+            name(std::string(ipAddress) + ":" + std::string(port)) {
+        uint64_t portNum = 0;
+        address.sin_family = AF_INET;
+        valid = httpRanges::parseNumber(port, portNum) && portNum > 0 && portNum <= UINT16_MAX &&
+                inet_pton(AF_INET, std::string(ipAddress).c_str(), &address.sin_addr) == 1;
+        address.sin_port = htons(portNum);
+        healthy = valid;
+    }
+
+    Upstream(const Upstream &) = delete;
+
+    Upstream &operator=(const Upstream &) = delete;
+
+    // "ip:port", also the Host of requests sent to the server.
+    const std::string &getName() const {
+        return name;
+    }
+
+    bool isHealthy() const {
+        return healthy.load(std::memory_order_relaxed);
+    }
+
+    void setHealthy(bool value) {
+        healthy.store(valid && value, std::memory_order_relaxed);
+    }
+
+    // Starts connecting a non-blocking socket to the server. Returns -1 if it has failed right away.
+    int connect() const {
+        if (!valid) {
+            return -1;
+        }
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && ::connect(fd, (const sockaddr *) &address, sizeof(address)) < 0 && errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+private:
+    std::string name;
+    sockaddr_in address{};
+    bool valid;
+    std::atomic<bool> healthy{false};
+};
+
+/*
+ * Correlated servers requests have been proxied to, each known once to all workers. Servers
+ * are added on first use, so only those actually serving clients are checked, and they're never
+ * removed, as a server file is expected to name a bounded set of them.
+ * */
+class UpstreamRegistry {
+public:
+    static constexpr int checkIntervalMs = 1000;
+    static constexpr int checkTimeoutMs = 500;
+
+    std::shared_ptr<Upstream> get(std::string_view ipAddress, std::string_view port) const {
+        std::string name = std::string(ipAddress) + ":" + std::string(port);
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<Upstream> &upstream = upstreams[name];
+        if (!upstream) {
+            upstream = std::make_shared<Upstream>(ipAddress, port);
+        }
+        return upstream;
+    }
+
+    /*
+     * Tries to connect to every known server at once. Servers accepting the connection within
+     * timeoutMs are marked healthy, the others are marked down.
+     * */
+    void checkHealth(int timeoutMs) const {
+        std::vector<std::shared_ptr<Upstream>> checked;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto &entry : upstreams) {
+                checked.push_back(entry.second);
+            }
+        }
+        std::vector<pollfd> fds;
+        size_t pending = 0;
+        for (const std::shared_ptr<Upstream> &upstream : checked) {
+            fds.push_back(pollfd{upstream->connect(), POLLOUT, 0});
+            if (fds.back().fd < 0) {
+                upstream->setHealthy(false);
+            } else {
+                pending++;
+            }
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        while (pending > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0 || poll(fds.data(), fds.size(), static_cast<int>(left)) <= 0) {
+                break;
+            }
+            for (size_t i = 0; i < fds.size(); i++) {
+                if (fds[i].fd >= 0 && fds[i].revents != 0) {
+                    int error = 0;
+                    socklen_t length = sizeof(error);
+                    getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                    checked[i]->setHealthy(error == 0);
+                    close(fds[i].fd);
+                    fds[i].fd = -1; // Ignored by poll() from now on.
+                    pending--;
+                }
+            }
+        }
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (fds[i].fd >= 0) {
+                checked[i]->setHealthy(false);
+                close(fds[i].fd);
+            }
+        }
+    }
+
+    // Checks health of the servers periodically, forever. Meant to be run by a background thread.
+    void runHealthChecks() const {
+        while (true) {
+            checkHealth(checkTimeoutMs);
+            std::this_thread::sleep_for(std::chrono::milliseconds(checkIntervalMs));
+        }
+    }
+
+private:
+    mutable std::mutex mutex;
+    mutable std::unordered_map<std::string, std::shared_ptr<Upstream>> upstreams;
+};
+
+#endif //ZALICZENIOWE1_UPSTREAMS_H
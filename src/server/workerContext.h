@@ -0,0 +1,43 @@
+#ifndef ZALICZENIOWE1_WORKERCONTEXT_H
+#define ZALICZENIOWE1_WORKERCONTEXT_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "accessLog.h"
+#include "contentPack.h"
+#include "correlatedTable.h"
+#include "fileCache.h"
+#include "metrics.h"
+#include "upstreams.h"
+
+/*
+ * Mutable state owned by a single worker thread. ConnectionHandler is shared by all
+ * workers and stays read-only, so everything it updates while serving lives here.
+ * */
+struct WorkerContext {
+    WorkerContext(const std::string &filesDirectory, WorkerMetrics &metrics, unsigned workers = 1) :
+            fileCache(FileCache::forWorker(filesDirectory, workers)), metrics(metrics) {}
+
+    FileCache fileCache;
+    CorrelatedSnapshot correlated;
+    // Correlated servers already looked up in the shared registry, by "ip:port".
+    std::unordered_map<std::string, std::shared_ptr<Upstream>> upstreams;
+    // Content pack of the handler, if any, under a worker-private reference count.
+    std::shared_ptr<const ContentPack> contentPack;
+    WorkerMetrics &metrics;
+    // Ring the worker's access log records go to, null if requests aren't logged.
+    AccessLogRing *accessLog = nullptr;
+    // Status and correlated server of the response to the request being handled, for the access log.
+    std::string_view responseStatus;
+    std::string_view responseUpstream;
+
+    void logAccess(const AccessEntry &entry) {
+        if (accessLog != nullptr && !accessLog->record(entry, WorkerMetrics::now())) {
+            metrics.countDroppedAccessRecord();
+        }
+    }
+};
+
+#endif //ZALICZENIOWE1_WORKERCONTEXT_H
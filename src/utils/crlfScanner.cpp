@@ -0,0 +1,90 @@
+#include <cstring>
+
+#include "crlfScanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+#define CRLF_SCANNER_X86
+
+#endif
+
+const char *findCrlfScalar(const char *begin, const char *end) {
+    while (end - begin >= 2) {
+        const char *cr = static_cast<const char *>(memchr(begin, '\r', end - begin - 1));
+        if (cr == nullptr) {
+            return nullptr;
+        }
+        if (cr[1] == '\n') {
+            return cr;
+        }
+        begin = cr + 1;
+    }
+    return nullptr;
+}
+
+#ifdef CRLF_SCANNER_X86
+
+/*
+ * Both vector variants compare a block with '\r' and the same block shifted by one byte
+ * with '\n'. Bit i of the combined mask is set when "\r\n" starts at i.
+ * */
+__attribute__((target("sse2")))
+static const char *findCrlfSse2(const char *begin, const char *end) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    while (end - begin >= 17) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin + 1));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block, cr), _mm_cmpeq_epi8(next, lf)));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 16;
+    }
+    return findCrlfScalar(begin, end);
+}
+
+__attribute__((target("avx2")))
+static const char *findCrlfAvx2(const char *begin, const char *end) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    while (end - begin >= 33) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin + 1));
+        unsigned mask = _mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(block, cr), _mm256_cmpeq_epi8(next, lf)));
+        if (mask != 0) {
+            return begin + __builtin_ctz(mask);
+        }
+        begin += 32;
+    }
+    return findCrlfSse2(begin, end);
+}
+
+using CrlfScanner = const char *(*)(const char *, const char *);
+
+static CrlfScanner selectScanner() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return findCrlfAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return findCrlfSse2;
+    }
+    return findCrlfScalar;
+}
+
+const char *findCrlf(const char *begin, const char *end) {
+    static const CrlfScanner scanner = selectScanner();
+    return scanner(begin, end);
+}
+
+#else
+
+const char *findCrlf(const char *begin, const char *end) {
+    return findCrlfScalar(begin, end);
+}
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef ZALICZENIOWE1_CRLFSCANNER_H
+#define ZALICZENIOWE1_CRLFSCANNER_H
+
+/*
+ * Returns pointer to the first "\r\n" pair fully contained in [begin, end) or nullptr.
+ * Uses AVX2 or SSE2 when the CPU supports them and falls back to a scalar loop otherwise.
+ * */
+const char *findCrlf(const char *begin, const char *end);
+
+const char *findCrlfScalar(const char *begin, const char *end);
+
+#endif //ZALICZENIOWE1_CRLFSCANNER_H
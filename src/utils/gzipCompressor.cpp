@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "gzipCompressor.h"
+
+namespace {
+    constexpr int compressionLevel = 6;
+    // Window bits above 15 select the gzip wrapper instead of zlib's.
+    constexpr int gzipWindowBits = 15 + 16;
+    constexpr size_t fileChunkSize = 64 * 1024;
+
+    class Compressor {
+    public:
+        explicit Compressor(size_t maxOutput) : maxOutput(maxOutput) {
+            valid = deflateInit2(&stream, compressionLevel, Z_DEFLATED, gzipWindowBits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        }
+
+        Compressor(const Compressor &) = delete;
+
+        Compressor &operator=(const Compressor &) = delete;
+
+        ~Compressor() {
+            if (valid) {
+                deflateEnd(&stream);
+            }
+        }
+
+        // Compresses next chunk of the input, the last one with last set.
+        bool update(std::string_view input, bool last) {
+            if (!valid) {
+                return false;
+            }
+            stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(input.data()));
+            stream.avail_in = input.size();
+            int flush = last ? Z_FINISH : Z_NO_FLUSH;
+            while (true) {
+                size_t used = output.size();
+                size_t room = std::max<size_t>(deflateBound(&stream, stream.avail_in), 4096);
+                if (used + room > maxOutput + 4096) {
+                    room = maxOutput + 4096 - used;
+                }
+                output.resize(used + room);
+                stream.next_out = reinterpret_cast<Bytef *>(output.data() + used);
+                stream.avail_out = room;
+                int result = deflate(&stream, flush);
+                output.resize(used + room - stream.avail_out);
+                if (result == Z_STREAM_ERROR || output.size() > maxOutput) {
+                    return valid = false;
+                }
+                if (result == Z_STREAM_END || (!last && stream.avail_in == 0 && stream.avail_out > 0)) {
+                    return true;
+                }
+            }
+        }
+
+        std::optional<std::string> takeOutput() {
+            if (!valid) {
+                return {};
+            }
+            return std::move(output);
+        }
+
+    private:
+        z_stream stream{};
+        size_t maxOutput;
+        bool valid;
+        std::string output;
+    };
+}
+
+std::optional<std::string> gzipCompress(std::string_view data, size_t maxOutput) {
+    Compressor compressor(maxOutput);
+    compressor.update(data, true);
+    return compressor.takeOutput();
+}
+
+std::optional<std::string> gzipCompressFile(int fd, uint64_t size, size_t maxOutput) {
+    Compressor compressor(maxOutput);
+    std::string chunk(fileChunkSize, '\0');
+    uint64_t done = 0;
+    do {
+        size_t length = std::min<uint64_t>(chunk.size(), size - done);
+        ssize_t bytesRead = length > 0 ? pread(fd, chunk.data(), length, done) : 0;
+        if (bytesRead < 0 || (bytesRead == 0 && done < size)) {
+            return {};
+        }
+        done += bytesRead;
+        if (!compressor.update(std::string_view(chunk.data(), bytesRead), done == size)) {
+            return {};
+        }
+    } while (done < size);
+    return compressor.takeOutput();
+}
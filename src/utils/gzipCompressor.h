@@ -0,0 +1,21 @@
+#ifndef ZALICZENIOWE1_GZIPCOMPRESSOR_H
+#define ZALICZENIOWE1_GZIPCOMPRESSOR_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/*
+ * Compresses data into the gzip format (RFC 1952). Gives up and returns nothing once the output
+ * would exceed maxOutput bytes, as content which doesn't shrink isn't worth sending compressed.
+ * */
+std::optional<std::string> gzipCompress(std::string_view data, size_t maxOutput);
+
+/*
+ * Same for size bytes of the regular file fd. The file is streamed through the compressor in
+ * chunks, so it's never held in memory uncompressed.
+ * */
+std::optional<std::string> gzipCompressFile(int fd, uint64_t size, size_t maxOutput);
+
+#endif //ZALICZENIOWE1_GZIPCOMPRESSOR_H
@@ -0,0 +1,130 @@
+#ifndef ZALICZENIOWE1_HTTPENCODINGS_H
+#define ZALICZENIOWE1_HTTPENCODINGS_H
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "httpRanges.h"
+
+/*
+ * Content codings the server can send and negotiation of them with Accept-Encoding.
+ * Header values come lowercased from the request parser.
+ * */
+namespace httpEncodings {
+    struct Coding {
+        std::string_view name;
+        // Suffix of a precompressed sibling of a file, e.g. "/a.txt.gz" for "/a.txt".
+        std::string_view extension;
+        // Whether files without a sibling can be compressed on the fly.
+        bool onTheFly;
+    };
+
+    // In the order of server's preference, used between codings of equal quality.
+    constexpr std::array<Coding, 2> supportedCodings = {{{"zstd", ".zst", false}, {"gzip", ".gz", true}}};
+
+    // Quality value "0", "0.5", "1.000"... in thousandths.
+    inline std::optional<int> parseQuality(std::string_view s) {
+        if (s.empty() || s.size() > 5 || (s[0] != '0' && s[0] != '1') || (s.size() > 1 && s[1] != '.')) {
+            return {};
+        }
+        int quality = (s[0] - '0') * 1000;
+        int scale = 100;
+        for (char c : s.substr(std::min<size_t>(2, s.size()))) {
+            if (c < '0' || c > '9') {
+                return {};
+            }
+            quality += (c - '0') * scale;
+            scale /= 10;
+        }
+        if (quality > 1000) {
+            return {};
+        }
+        return quality;
+    }
+
+    /*
+     * Quality in thousandths which an Accept-Encoding value gives to coding. "*" stands for codings
+     * not listed explicitly, "x-gzip" is an alias of "gzip". Elements with malformed quality are ignored.
+     * */
+    inline int qualityOf(std::string_view acceptEncoding, std::string_view coding) {
+        std::optional<int> wildcard;
+        while (true) {
+            size_t comma = acceptEncoding.find(',');
+            std::string_view element = acceptEncoding.substr(0, comma);
+            size_t semicolon = element.find(';');
+            std::string_view name = httpRanges::trim(element.substr(0, semicolon));
+            std::optional<int> quality = 1000;
+            if (semicolon != std::string_view::npos) {
+                std::string_view parameter = httpRanges::trim(element.substr(semicolon + 1));
+                quality = parameter.substr(0, 2) == "q=" ? parseQuality(parameter.substr(2)) : std::nullopt;
+            }
+            if (quality) {
+                if (name == coding || (coding == "gzip" && name == "x-gzip")) {
+                    return *quality;
+                }
+                if (name == "*") {
+                    wildcard = quality;
+                }
+            }
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            acceptEncoding = acceptEncoding.substr(comma + 1);
+        }
+        return wildcard.value_or(0);
+    }
+
+    // Codings acceptable to the client, most preferred first; there are never more than supported ones.
+    class AcceptedCodings {
+    public:
+        void push_back(const Coding &coding) {
+            codings[count++] = coding;
+        }
+
+        const Coding *begin() const {
+            return codings.data();
+        }
+
+        const Coding *end() const {
+            return codings.data() + count;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+        const Coding &operator[](size_t i) const {
+            return codings[i];
+        }
+
+    private:
+        std::array<Coding, supportedCodings.size()> codings{};
+        size_t count = 0;
+    };
+
+    inline AcceptedCodings acceptedCodings(std::string_view acceptEncoding) {
+        std::array<std::pair<int, Coding>, supportedCodings.size()> accepted{};
+        size_t count = 0;
+        for (const Coding &coding : supportedCodings) {
+            if (int quality = qualityOf(acceptEncoding, coding.name)) {
+                accepted[count++] = {quality, coding};
+            }
+        }
+        // Stable insertion sort; std::stable_sort would allocate a buffer for a couple of elements.
+        for (size_t i = 1; i < count; i++) {
+            for (size_t j = i; j > 0 && accepted[j - 1].first < accepted[j].first; j--) {
+                std::swap(accepted[j - 1], accepted[j]);
+            }
+        }
+        AcceptedCodings result;
+        for (size_t i = 0; i < count; i++) {
+            result.push_back(accepted[i].second);
+        }
+        return result;
+    }
+}
+
+#endif //ZALICZENIOWE1_HTTPENCODINGS_H
@@ -1,35 +1,102 @@
 #ifndef ZALICZENIOWE1_PARSE_REQUEST_H
 #define ZALICZENIOWE1_PARSE_REQUEST_H
 
+#include <algorithm>
 #include <array>
-#include <regex>
 #include <optional>
 #include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
 #include <vector>
 
+#include "requestArena.h"
+
+/*
+ * Character classes used by the hand-written parsers below. They mirror the regular
+ * expressions the grammar was originally specified with (ECMAScript \w, \s and '.').
+ * */
+namespace httpChars {
+    inline bool isWordChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+    }
+
+    inline bool isTargetChar(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               c == '.' || c == '/' || c == '-';
+    }
+
+    inline bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    inline char toLower(char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+    }
+
+    inline std::string_view toLower(std::string_view s, RequestArena &arena) {
+        char *data = arena.allocateArray<char>(s.size());
+        std::transform(s.begin(), s.end(), data, [](char c) { return toLower(c); });
+        return std::string_view(data, s.size());
+    }
+
+    // Compares s with an already lowercase string ignoring case of s.
+    inline bool equalsLowercase(std::string_view s, std::string_view lowercase) {
+        return s.size() == lowercase.size() &&
+               std::equal(s.begin(), s.end(), lowercase.begin(), [](char a, char b) { return toLower(a) == b; });
+    }
+}
+
+/*
+ * Parsed requests don't own any text: it's viewed in the request itself (the receive buffer)
+ * or, when it had to be lowercased, in the request's arena. They live as long as those do.
+ * */
 class StartLine {
 public:
-    static std::optional<StartLine> validateString(const std::string &s) {
-        const std::regex startlineRegex(R"regex((\w+) ([/]([^ ]*)) (HTTP/1[.]1))regex");
-        const std::regex validTarget("[/][a-zA-Z0-9./-]*");
-        std::smatch m, tmp;
-        if (!std::regex_match(s, m, startlineRegex)) {
+    /*
+     * Single pass over "method SP request-target SP HTTP/1.1", where method consists of word
+     * characters and request-target starts with '/' and contains no spaces.
+     * */
+    static std::optional<StartLine> validateString(std::string_view s) {
+        size_t i = 0;
+        while (i < s.size() && httpChars::isWordChar(s[i])) {
+            i++;
+        }
+        if (i == 0 || i == s.size() || s[i] != ' ') {
+            return {};
+        }
+        std::string_view method = s.substr(0, i++);
+
+        size_t targetStart = i;
+        if (i == s.size() || s[i] != '/') {
+            return {};
+        }
+        bool validChars = true;
+        while (i < s.size() && s[i] != ' ') {
+            validChars = validChars && httpChars::isTargetChar(s[i]);
+            i++;
+        }
+        if (i == s.size()) {
+            return {};
+        }
+        std::string_view target = s.substr(targetStart, i - targetStart);
+
+        std::string_view httpVersion = s.substr(i + 1);
+        if (httpVersion != "HTTP/1.1") {
             return {};
         }
-        std::string target = m[2];
-        bool validChars = std::regex_match(target, tmp, validTarget);
-        return StartLine(m[1], m[2], m[3], validChars);
+        return StartLine(method, target, httpVersion, validChars);
     }
 
-    const std::string &getMethod() const {
+    std::string_view getMethod() const {
         return method;
     }
 
-    const std::string &getRequestTarget() const {
+    std::string_view getRequestTarget() const {
         return requestTarget;
     }
 
-    const std::string &getHttpVersion() const {
+    std::string_view getHttpVersion() const {
         return httpVersion;
     }
 
@@ -38,65 +105,97 @@ public:
     }
 
 private:
-    StartLine(const std::string &method, const std::string &requestTarget,
-              const std::string &httpVersion, bool validChars) :
+    StartLine(std::string_view method, std::string_view requestTarget, std::string_view httpVersion,
+              bool validChars) :
             method(method), requestTarget(requestTarget), httpVersion(httpVersion), validChars(validChars) {};
-    std::string method;
-    std::string requestTarget;
-    std::string httpVersion;
+    std::string_view method;
+    std::string_view requestTarget;
+    std::string_view httpVersion;
     bool validChars;
 };
 
 
 class HeaderField {
 public:
-    static std::optional<HeaderField> validateString(const std::string &s) {
-        const std::regex headerFieldRegex(R"regex(([^\s:]+):( *)(.+?)( *))regex");
-        std::cmatch m;
-        if (!std::regex_match(s.c_str(), m, headerFieldRegex)) {
+    /*
+     * Splits "name:value" into views of s without copying. Name is a non-empty run of
+     * characters other than whitespace and ':'. Value may not contain CR or LF, spaces
+     * around it are dropped, and a value made only of spaces collapses to a single one.
+     * */
+    static bool parse(std::string_view s, std::string_view &name, std::string_view &value) {
+        size_t colon = 0;
+        while (colon < s.size() && s[colon] != ':' && !httpChars::isSpace(s[colon])) {
+            colon++;
+        }
+        if (colon == 0 || colon == s.size() || s[colon] != ':') {
+            return false;
+        }
+        std::string_view rest = s.substr(colon + 1);
+        if (rest.empty() || rest.find_first_of("\r\n") != std::string_view::npos) {
+            return false;
+        }
+        size_t begin = rest.find_first_not_of(' ');
+        if (begin == std::string_view::npos) {
+            value = rest.substr(0, 1);
+        } else {
+            value = rest.substr(begin, rest.find_last_not_of(' ') - begin + 1);
+        }
+        name = s.substr(0, colon);
+        return true;
+    }
+
+    // Name and value are lowercased into arena.
+    static std::optional<HeaderField> validateString(std::string_view s, RequestArena &arena) {
+        std::string_view name, value;
+        if (!parse(s, name, value)) {
             return {};
         }
         /*
          * Field names other than explicitly described should be ignored. It's important to mark them
          * as such, because repeating non-ignored field names in one request is an error.
          * */
-        std::string method = m[1];
-        std::string value = m[3];
-        std::transform(method.begin(), method.end(), method.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        std::transform(value.begin(), value.end(), value.begin(),
-                       [](unsigned char c) { return std::tolower(c); });
-        static const std::array<std::string, 4> acceptedFieldnames = {"connection", "content-length",
-                                                                      "server", "content-Type"};
+        std::string_view method = httpChars::toLower(name, arena);
+        static const std::array<std::string_view, 4> acceptedFieldnames = {"connection", "content-length",
+                                                                           "server", "content-Type"};
         auto it = std::find(acceptedFieldnames.begin(), acceptedFieldnames.end(), method);
         bool ignored = (it == acceptedFieldnames.end());
-        return HeaderField(method, value, ignored);
+        return HeaderField(method, httpChars::toLower(value, arena), ignored);
     }
 
-    static std::optional<HeaderField> validateRequestString(const std::string &s) {
-        auto res = validateString(s);
-        if (!res) {
+    static std::optional<HeaderField> validateRequestString(std::string_view s, RequestArena &arena) {
+        std::string_view name, value;
+        if (!parse(s, name, value) || !isValidRequestField(name, value)) {
             return {};
         }
+        return HeaderField(httpChars::toLower(name, arena), httpChars::toLower(value, arena),
+                           !isAcceptedRequestField(name));
+    }
 
-        static const std::array<std::string, 2> acceptedFieldnames = {"connection", "content-length"};
-        auto it = std::find(acceptedFieldnames.begin(), acceptedFieldnames.end(), res.value().getName());
-        bool ignored = (it == acceptedFieldnames.end());
-        /*
-         * Additional check for Content-Length value -- it is mandatory that it's 0 in request field.
-         * */
-        if (res.value().getName() == "content-length" && res.value().getValue() != "0") {
-            return {};
-        }
-        res.value().setIsIgnored(ignored);
-        return res;
+    static bool isAcceptedRequestField(std::string_view name) {
+        static const std::array<std::string_view, 7> acceptedFieldnames = {"connection", "content-length", "range",
+                                                                           "if-range", "if-none-match",
+                                                                           "if-modified-since", "accept-encoding"};
+        return std::any_of(acceptedFieldnames.begin(), acceptedFieldnames.end(),
+                           [name](std::string_view accepted) { return httpChars::equalsLowercase(name, accepted); });
     }
 
-    const std::string &getValue() const {
+    // Fields whose value is a comma-separated list, so that repeating them only extends the list.
+    static bool isListRequestField(std::string_view name) {
+        return httpChars::equalsLowercase(name, "accept-encoding") || httpChars::equalsLowercase(name, "if-none-match");
+    }
+
+    /*
+     * Additional check for Content-Length value -- it is mandatory that it's 0 in request field.
+     * */
+    static bool isValidRequestField(std::string_view name, std::string_view value) {
+        return !httpChars::equalsLowercase(name, "content-length") || value == "0";
+    }
+
+    std::string_view getValue() const {
         return value;
     }
 
-    const std::string &getName() const {
+    std::string_view getName() const {
         return name;
     }
 
@@ -113,10 +212,13 @@ public:
     }
 
 private:
-    HeaderField(std::string name, std::string value, bool ignored) : name(name), value(value), ignored(ignored) {}
+    friend class HttpMessage;
+
+    HeaderField(std::string_view name, std::string_view value, bool ignored) :
+            name(name), value(value), ignored(ignored) {}
 
-    std::string name;
-    std::string value;
+    std::string_view name;
+    std::string_view value;
     bool ignored;
 };
 
@@ -126,7 +228,9 @@ public:
         return "HTTP/1.1 " + statusCode + " " + reasonPhrase;
     }
 
-    static std::optional<HttpMessage> validateHttpRequest(const std::vector<std::string> &s) {
+    // Lowercased header fields are placed in arena, which has to be reset only after the message is handled.
+    static std::optional<HttpMessage> validateHttpRequest(const std::vector<std::string_view> &s,
+                                                          RequestArena &arena) {
         if (s.size() == 0) {
             return {};
         }
@@ -134,25 +238,41 @@ public:
         if (!startLine.has_value()) {
             return {};
         }
-        std::vector<HeaderField> headerFields;
+        HeaderField *headerFields = arena.allocateArray<HeaderField>(s.size() - 1);
+        size_t fieldsNum = 0;
         for (size_t i = 1; i < s.size(); i++) {
-            auto headerField = HeaderField::validateRequestString(s[i]);
-            if (!headerField.has_value()) {
+            // Ignored fields are only validated, never copied out of the request.
+            std::string_view name, value;
+            if (!HeaderField::parse(s[i], name, value) || !HeaderField::isValidRequestField(name, value)) {
                 return {};
             }
-            if (headerField.value().isIgnored()) {
+            if (!HeaderField::isAcceptedRequestField(name)) {
                 continue;
             }
             /*
              * Each not ignored header field's name has to be unique. If one appears more than once,
-             * it's treated as "wrong argument" error.
+             * it's treated as "wrong argument" error, unless its value is a list: then the values are joined.
              * */
-            if (std::find(headerFields.begin(), headerFields.end(), headerField.value()) != headerFields.end()) {
-                return {};
+            auto sameName = [name](const HeaderField &hf) { return httpChars::equalsLowercase(name, hf.getName()); };
+            HeaderField *same = std::find_if(headerFields, headerFields + fieldsNum, sameName);
+            if (same != headerFields + fieldsNum) {
+                if (!HeaderField::isListRequestField(name)) {
+                    return {};
+                }
+                std::string_view joined = same->value;
+                char *data = arena.allocateArray<char>(joined.size() + 2 + value.size());
+                std::copy(joined.begin(), joined.end(), data);
+                data[joined.size()] = ',';
+                data[joined.size() + 1] = ' ';
+                std::transform(value.begin(), value.end(), data + joined.size() + 2,
+                               [](char c) { return httpChars::toLower(c); });
+                same->value = std::string_view(data, joined.size() + 2 + value.size());
+                continue;
             }
-            headerFields.push_back(headerField.value());
+            new(&headerFields[fieldsNum++]) HeaderField(httpChars::toLower(name, arena),
+                                                        httpChars::toLower(value, arena), false);
         }
-        return HttpMessage(startLine.value(), headerFields);
+        return HttpMessage(startLine.value(), ArenaArray<const HeaderField>(headerFields, fieldsNum));
     }
 
     static std::string generateHttpString(const std::vector<std::string> tokens) {
@@ -168,15 +288,25 @@ public:
         return sl;
     }
 
-    const std::vector<HeaderField> &getHeaderFields() const {
+    ArenaArray<const HeaderField> getHeaderFields() const {
         return hf;
     }
 
+    // Returns field with given lowercase name, nullptr if the request doesn't have it.
+    const HeaderField *findHeaderField(std::string_view name) const {
+        for (const HeaderField &field : hf) {
+            if (field.getName() == name) {
+                return &field;
+            }
+        }
+        return nullptr;
+    }
+
 private:
     StartLine sl;
-    std::vector<HeaderField> hf;
+    ArenaArray<const HeaderField> hf;
 
-    HttpMessage(const StartLine &sl, const std::vector<HeaderField> &hf) : sl(sl), hf(hf) {}
+    HttpMessage(const StartLine &sl, ArenaArray<const HeaderField> hf) : sl(sl), hf(hf) {}
 };
 
 
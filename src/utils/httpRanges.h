@@ -0,0 +1,193 @@
+#ifndef ZALICZENIOWE1_HTTPRANGES_H
+#define ZALICZENIOWE1_HTTPRANGES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Parsing of Range requests and of the validators used by conditional requests.
+ * Header values come lowercased from the request parser, so everything is matched
+ * in lowercase.
+ * */
+namespace httpRanges {
+    // Inclusive range of byte positions.
+    struct ByteRange {
+        uint64_t first;
+        uint64_t last;
+
+        uint64_t length() const {
+            return last - first + 1;
+        }
+
+        bool operator==(const ByteRange &r) const {
+            return first == r.first && last == r.last;
+        }
+    };
+
+    // More ranges in one request are ignored and the whole file is sent.
+    constexpr size_t maxRanges = 32;
+
+    inline std::string_view trim(std::string_view s) {
+        size_t begin = s.find_first_not_of(" \t");
+        if (begin == std::string_view::npos) {
+            return {};
+        }
+        return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+    }
+
+    inline bool parseNumber(std::string_view s, uint64_t &result) {
+        if (s.empty() || s.size() > 19) {
+            return false;
+        }
+        result = 0;
+        for (char c : s) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            result = result * 10 + (c - '0');
+        }
+        return true;
+    }
+
+    /*
+     * Parses "bytes=first-last, first-, -suffix_length, ..." against a file of given size.
+     * Returns nothing when the header is malformed or lists too many ranges, so that it's
+     * ignored, and an empty list when no range is satisfiable (416). Ranges reaching past
+     * the end of the file are clamped to it. Overlapping and adjacent ranges are coalesced and
+     * the result is sorted, so no byte is sent twice and a response is never longer than the file.
+     * */
+    inline std::optional<std::vector<ByteRange>> parseRange(std::string_view value, uint64_t size) {
+        constexpr std::string_view unit = "bytes=";
+        if (value.substr(0, unit.size()) != unit) {
+            return {};
+        }
+        std::vector<ByteRange> ranges;
+        size_t specs = 0;
+        std::string_view rest = value.substr(unit.size());
+        while (true) {
+            size_t comma = rest.find(',');
+            std::string_view spec = trim(rest.substr(0, comma));
+            if (!spec.empty()) {
+                if (++specs > maxRanges) {
+                    return {};
+                }
+                size_t dash = spec.find('-');
+                if (dash == std::string_view::npos) {
+                    return {};
+                }
+                uint64_t first, last;
+                if (dash == 0) { // Suffix of the given length.
+                    if (!parseNumber(spec.substr(1), last)) {
+                        return {};
+                    }
+                    if (last > 0 && size > 0) {
+                        ranges.push_back(ByteRange{size - std::min(last, size), size - 1});
+                    }
+                } else {
+                    if (!parseNumber(spec.substr(0, dash), first)) {
+                        return {};
+                    }
+                    if (dash + 1 == spec.size()) {
+                        last = UINT64_MAX;
+                    } else if (!parseNumber(spec.substr(dash + 1), last) || last < first) {
+                        return {};
+                    }
+                    if (first < size) {
+                        ranges.push_back(ByteRange{first, std::min(last, size - 1)});
+                    }
+                }
+            }
+            if (comma == std::string_view::npos) {
+                break;
+            }
+            rest = rest.substr(comma + 1);
+        }
+        if (specs == 0) {
+            return {};
+        }
+        std::sort(ranges.begin(), ranges.end(), [](const ByteRange &a, const ByteRange &b) {
+            return a.first < b.first;
+        });
+        size_t coalesced = 0;
+        for (size_t i = 1; i < ranges.size(); i++) {
+            if (ranges[i].first <= ranges[coalesced].last + 1) {
+                ranges[coalesced].last = std::max(ranges[coalesced].last, ranges[i].last);
+            } else {
+                ranges[++coalesced] = ranges[i];
+            }
+        }
+        ranges.resize(ranges.empty() ? 0 : coalesced + 1);
+        return ranges;
+    }
+
+    // IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+    inline std::string formatHttpDate(time_t time) {
+        static const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+        static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov",
+                                       "Dec"};
+        tm t{};
+        gmtime_r(&time, &t);
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%s, %02d %s %04d %02d:%02d:%02d GMT", days[t.tm_wday], t.tm_mday,
+                 months[t.tm_mon], t.tm_year + 1900, t.tm_hour, t.tm_min, t.tm_sec);
+        return buffer;
+    }
+
+    // Parses lowercased IMF-fixdate. Obsolete date formats aren't supported and yield nothing.
+    inline std::optional<time_t> parseHttpDate(std::string_view s) {
+        static const std::string_view months = "janfebmaraprmayjunjulaugsepoctnovdec";
+        // "sun, 06 nov 1994 08:49:37 gmt"
+        if (s.size() != 29 || s.substr(3, 2) != ", " || s[7] != ' ' || s[11] != ' ' || s[16] != ' ' ||
+            s[19] != ':' || s[22] != ':' || s.substr(25) != " gmt") {
+            return {};
+        }
+        uint64_t day, year, hour, minute, second;
+        size_t month = months.find(s.substr(8, 3));
+        if (month == std::string_view::npos || month % 3 != 0 || !parseNumber(s.substr(5, 2), day) ||
+            !parseNumber(s.substr(12, 4), year) || !parseNumber(s.substr(17, 2), hour) ||
+            !parseNumber(s.substr(20, 2), minute) || !parseNumber(s.substr(23, 2), second) ||
+            day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60 || year < 1970) {
+            return {};
+        }
+        tm t{};
+        t.tm_year = static_cast<int>(year) - 1900;
+        t.tm_mon = static_cast<int>(month / 3);
+        t.tm_mday = static_cast<int>(day);
+        t.tm_hour = static_cast<int>(hour);
+        t.tm_min = static_cast<int>(minute);
+        t.tm_sec = static_cast<int>(second);
+        return timegm(&t);
+    }
+
+    /*
+     * Weak comparison of an entity tag against an If-None-Match list: "*" matches anything,
+     * otherwise any listed tag has to be equal to etag ignoring the weakness prefix.
+     * */
+    inline bool matchesAnyEtag(std::string_view list, std::string_view etag) {
+        if (trim(list) == "*") {
+            return true;
+        }
+        while (true) {
+            size_t comma = list.find(',');
+            std::string_view tag = trim(list.substr(0, comma));
+            if (tag.substr(0, 2) == "w/") {
+                tag = tag.substr(2);
+            }
+            if (tag == etag) {
+                return true;
+            }
+            if (comma == std::string_view::npos) {
+                return false;
+            }
+            list = list.substr(comma + 1);
+        }
+    }
+}
+
+#endif //ZALICZENIOWE1_HTTPRANGES_H
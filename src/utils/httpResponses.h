@@ -0,0 +1,233 @@
+#ifndef ZALICZENIOWE1_HTTPRESPONSES_H
+#define ZALICZENIOWE1_HTTPRESPONSES_H
+
+#include <cctype>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "httpRanges.h"
+
+/*
+ * Parsing of responses received from other servers, so that they can be passed on to clients:
+ * the head is checked and stripped of hop-by-hop fields, and the body is delimited without
+ * being copied, whichever way the sender has framed it.
+ * */
+namespace httpResponses {
+    // Finds where a response body ends in the stream of bytes following the head.
+    class BodyFraming {
+    public:
+        enum class Kind {
+            Length, Chunked, UntilClose
+        };
+
+        BodyFraming() = default;
+
+        BodyFraming(Kind kind, uint64_t length) : kind(kind), remaining(length),
+                                                  done(kind == Kind::Length && length == 0) {}
+
+        /*
+         * Returns how many leading bytes of data belong to the body. Body bytes are passed on as
+         * they are, so chunked bodies are only followed, not decoded.
+         * */
+        size_t consume(std::string_view data) {
+            if (kind == Kind::UntilClose) {
+                return data.size();
+            }
+            size_t pos = 0;
+            while (pos < data.size() && !done && !invalid) {
+                if (kind == Kind::Length || state == ChunkState::Data) {
+                    uint64_t taken = std::min<uint64_t>(remaining, data.size() - pos);
+                    pos += taken;
+                    remaining -= taken;
+                    if (remaining == 0) {
+                        done = kind == Kind::Length;
+                        state = ChunkState::DataEnd;
+                    }
+                    continue;
+                }
+                char c = data[pos++];
+                if (c != '\n') {
+                    line += c;
+                    invalid = line.size() > maxLineSize;
+                    continue;
+                }
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                processLine();
+                line.clear();
+            }
+            return pos;
+        }
+
+        Kind getKind() const {
+            return kind;
+        }
+
+        bool isDone() const {
+            return done;
+        }
+
+        bool isInvalid() const {
+            return invalid;
+        }
+
+    private:
+        static constexpr size_t maxLineSize = 4096;
+
+        enum class ChunkState {
+            Size, Data, DataEnd, Trailer
+        };
+
+        Kind kind = Kind::Length;
+        uint64_t remaining = 0;
+        bool done = true;
+        bool invalid = false;
+        ChunkState state = ChunkState::Size;
+        std::string line;
+
+        void processLine() {
+            if (state == ChunkState::DataEnd) {
+                invalid = !line.empty();
+                state = ChunkState::Size;
+            } else if (state == ChunkState::Trailer) {
+                done = line.empty();
+            } else {
+                // Chunk extensions after ';' are ignored.
+                std::string_view size = httpRanges::trim(std::string_view(line).substr(0, line.find(';')));
+                remaining = 0;
+                invalid = size.empty() || size.size() > 15;
+                for (char c : size) {
+                    int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                                               : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+                    invalid = invalid || digit < 0;
+                    remaining = remaining * 16 + digit;
+                }
+                state = remaining == 0 ? ChunkState::Trailer : ChunkState::Data;
+            }
+        }
+    };
+
+    struct ResponseHead {
+        std::string statusCode;
+        BodyFraming framing;
+        // Whether the sender keeps the connection open after the response.
+        bool keepAlive = true;
+        // Head to pass on, ending with the empty line.
+        std::string forwarded;
+    };
+
+    inline bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); i++) {
+            if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether a comma separated list, e.g. a Connection value, contains token.
+    inline bool listContains(std::string_view list, std::string_view token) {
+        while (true) {
+            size_t comma = list.find(',');
+            if (equalsIgnoreCase(httpRanges::trim(list.substr(0, comma)), token)) {
+                return true;
+            }
+            if (comma == std::string_view::npos) {
+                return false;
+            }
+            list = list.substr(comma + 1);
+        }
+    }
+
+    /*
+     * Parses a response head ending with the empty line. Informational (1xx) responses aren't
+     * expected and yield nothing, as do malformed heads. Connection, Keep-Alive and Proxy-Connection
+     * fields are dropped from the forwarded head, as is Content-Length of a body with Transfer-Encoding.
+     * A body delimited by closing the connection makes the forwarded head ask for closing too.
+     * */
+    inline std::optional<ResponseHead> parseHead(std::string_view head, bool headRequest) {
+        size_t lineEnd = head.find("\r\n");
+        std::string_view statusLine = head.substr(0, lineEnd);
+        if (lineEnd == std::string_view::npos || statusLine.size() < 12 || statusLine.substr(0, 7) != "HTTP/1." ||
+            statusLine[8] != ' ' || (statusLine.size() > 12 && statusLine[12] != ' ')) {
+            return {};
+        }
+        uint64_t code;
+        if (!httpRanges::parseNumber(statusLine.substr(9, 3), code) || code < 200) {
+            return {};
+        }
+        ResponseHead result;
+        result.statusCode = std::string(statusLine.substr(9, 3));
+        result.keepAlive = statusLine[7] != '0';
+        result.forwarded.append(statusLine).append("\r\n");
+        std::optional<uint64_t> contentLength;
+        std::string contentLengthField;
+        bool chunked = false, encoded = false;
+        for (size_t begin = lineEnd + 2; begin < head.size();) {
+            lineEnd = head.find("\r\n", begin);
+            if (lineEnd == std::string_view::npos) {
+                return {};
+            }
+            std::string_view line = head.substr(begin, lineEnd - begin);
+            begin = lineEnd + 2;
+            if (line.empty()) {
+                break;
+            }
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos || colon == 0) {
+                return {};
+            }
+            std::string_view name = line.substr(0, colon);
+            std::string_view value = httpRanges::trim(line.substr(colon + 1));
+            if (equalsIgnoreCase(name, "connection")) {
+                result.keepAlive = listContains(value, "keep-alive") ||
+                                   (result.keepAlive && !listContains(value, "close"));
+                continue;
+            }
+            if (equalsIgnoreCase(name, "keep-alive") || equalsIgnoreCase(name, "proxy-connection")) {
+                continue;
+            }
+            if (equalsIgnoreCase(name, "content-length")) {
+                uint64_t length;
+                if (!httpRanges::parseNumber(value, length) || (contentLength && *contentLength != length)) {
+                    return {};
+                }
+                contentLength = length;
+                contentLengthField = std::string(line) + "\r\n";
+                continue;
+            }
+            if (equalsIgnoreCase(name, "transfer-encoding")) {
+                encoded = true;
+                size_t comma = value.rfind(',');
+                chunked = equalsIgnoreCase(httpRanges::trim(comma == std::string_view::npos
+                                                            ? value : value.substr(comma + 1)), "chunked");
+            }
+            result.forwarded.append(line).append("\r\n");
+        }
+        if (headRequest || code == 204 || code == 304) {
+            result.framing = BodyFraming(BodyFraming::Kind::Length, 0);
+            result.forwarded += contentLengthField;
+        } else if (encoded) {
+            result.framing = BodyFraming(chunked ? BodyFraming::Kind::Chunked : BodyFraming::Kind::UntilClose, 0);
+        } else if (contentLength) {
+            result.framing = BodyFraming(BodyFraming::Kind::Length, *contentLength);
+            result.forwarded += contentLengthField;
+        } else {
+            result.framing = BodyFraming(BodyFraming::Kind::UntilClose, 0);
+        }
+        if (result.framing.getKind() == BodyFraming::Kind::UntilClose) {
+            result.keepAlive = false;
+            result.forwarded += "Connection: close\r\n";
+        }
+        result.forwarded += "\r\n";
+        return result;
+    }
+}
+
+#endif //ZALICZENIOWE1_HTTPRESPONSES_H
@@ -1,5 +1,68 @@
+#include <atomic>
+#include <optional>
 #include <string>
+#include <cerrno>
+#include <climits>
 #include <filesystem>
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "pathUtils.h"
+#include "serverAssertions.h"
+
+namespace {
+    /*
+     * Opening is non-blocking, as opening a FIFO (or some devices) would otherwise wait for a writer.
+     * The flag is cleared afterwards: reads of regular files ignore it, but io_uring would fail them with EAGAIN.
+     * */
+    constexpr int openFlags = O_RDONLY | O_NONBLOCK | O_CLOEXEC;
+    constexpr int maxOpenAttempts = 8;
+
+    int clearNonBlocking(int fd) {
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, 0);
+        }
+        return fd;
+    }
+
+#ifdef SYS_openat2
+    // Opens path below baseFd, with ".." and symlinks confined to it by the kernel.
+    int openBeneath(int baseFd, const char *path) {
+        open_how how{};
+        how.flags = openFlags;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        // EAGAIN means a concurrent rename, but also a lease held on the file, so retries are bounded.
+        int fd;
+        int attempts = 0;
+        do {
+            fd = syscall(SYS_openat2, baseFd, path, &how, sizeof(how));
+        } while (fd < 0 && errno == EAGAIN && ++attempts < maxOpenAttempts);
+        return clearNonBlocking(fd);
+    }
+#endif
+
+    /*
+     * Canonicalizes relative path below canonicalBase and returns it relative to the base again ("." for
+     * the base itself). Returns nothing with errno set to EXDEV if it leads outside, ENOENT if it can't be resolved.
+     * */
+    std::optional<std::string> resolveBelow(const std::string &canonicalBase, const char *relative) {
+        std::string canonical;
+        try {
+            canonical = std::filesystem::weakly_canonical(canonicalBase + "/" + relative);
+        } catch (const std::filesystem::filesystem_error &e) {
+            errno = ENOENT;
+            return {};
+        }
+        if (canonical.compare(0, canonicalBase.size(), canonicalBase) != 0 ||
+            (canonical.size() > canonicalBase.size() && canonical[canonicalBase.size()] != '/')) {
+            errno = EXDEV;
+            return {};
+        }
+        return canonical.size() > canonicalBase.size() + 1 ? canonical.substr(canonicalBase.size() + 1) : ".";
+    }
+}
 
 bool validatePath(std::string basePath, std::string relativePath) {
     if (relativePath.empty() || relativePath[0] != '/') {
@@ -14,3 +77,82 @@ bool validatePath(std::string basePath, std::string relativePath) {
         return false;
     }
 }
+
+bool escapesLexically(std::string_view target) {
+    if (target.empty() || target[0] != '/') {
+        return true;
+    }
+    long depth = 0;
+    size_t pos = 1;
+    while (pos <= target.size()) {
+        size_t slash = target.find('/', pos);
+        if (slash == std::string_view::npos) {
+            slash = target.size();
+        }
+        std::string_view component = target.substr(pos, slash - pos);
+        if (component == "..") {
+            if (--depth < 0) {
+                return true;
+            }
+        } else if (!component.empty() && component != ".") {
+            depth++;
+        }
+        pos = slash + 1;
+    }
+    return false;
+}
+
+PathResolver::PathResolver(const std::string &basePath) {
+    baseFd = ::open(basePath.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    exit_on_fail_with_errno(baseFd >= 0, "Opening files directory failed.");
+    std::error_code ec;
+    canonicalBase = std::filesystem::weakly_canonical(basePath, ec).string();
+}
+
+PathResolver::~PathResolver() {
+    close(baseFd);
+}
+
+int PathResolver::open(std::string_view target) const {
+    if (escapesLexically(target)) {
+        errno = EXDEV;
+        return -1;
+    }
+    // Composed on the stack, as opening is on the path of every request for a file not yet cached.
+    char relative[PATH_MAX];
+    if (target.size() >= sizeof(relative)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    target.remove_prefix(1);
+    target.copy(relative, target.size());
+    relative[target.size()] = '\0';
+    if (target.empty()) {
+        relative[0] = '.';
+        relative[1] = '\0';
+    }
+#ifdef SYS_openat2
+    static std::atomic<bool> openat2Supported = true;
+    if (openat2Supported.load(std::memory_order_relaxed)) {
+        int fd = openBeneath(baseFd, relative);
+        if (fd >= 0 || (errno != ENOSYS && errno != EXDEV)) {
+            return fd;
+        }
+        if (errno == EXDEV) {
+            /*
+             * RESOLVE_BENEATH refuses absolute symlinks even when they point inside the base. Such
+             * links are resolved here, and the link-free path they lead to is opened beneath the base
+             * again, so a link changed meanwhile still can't lead outside.
+             * */
+            std::optional<std::string> resolved = resolveBelow(canonicalBase, relative);
+            return resolved ? openBeneath(baseFd, resolved->c_str()) : -1;
+        }
+        openat2Supported.store(false, std::memory_order_relaxed);
+    }
+#endif
+    std::optional<std::string> resolved = resolveBelow(canonicalBase, relative);
+    if (!resolved) {
+        return -1;
+    }
+    return clearNonBlocking(openat(baseFd, resolved->c_str(), openFlags));
+}
@@ -2,7 +2,44 @@
 #define ZALICZENIOWE1_PATHUTILS_H
 
 #include <string>
+#include <string_view>
 
 bool validatePath(std::string basePath, std::string relativePath);
 
+/*
+ * Checks purely lexically whether a request target (starting with '/') climbs above
+ * the directory it's resolved against with "..". Doesn't touch the filesystem.
+ * */
+bool escapesLexically(std::string_view target);
+
+/*
+ * Opens request targets below a base directory, which is opened and canonicalized once.
+ * Confinement is enforced by the kernel with openat2(RESOLVE_BENEATH), so neither ".."
+ * nor symlinks can lead outside of the base and no path is canonicalized per request.
+ * Only targets through absolute symlinks, which the kernel refuses, are canonicalized, so
+ * that those pointing inside the base are still served. Without openat2 every target is
+ * checked that way against the cached canonical base.
+ * */
+class PathResolver {
+public:
+    explicit PathResolver(const std::string &basePath);
+
+    PathResolver(const PathResolver &) = delete;
+
+    PathResolver &operator=(const PathResolver &) = delete;
+
+    ~PathResolver();
+
+    /*
+     * Opens target for reading, without blocking even if it's a FIFO; whether it's a regular file is
+     * up to the caller to check. Returns descriptor, or -1 with errno set: ENOENT or ENOTDIR
+     * when there's no such file, EXDEV when the target leads outside of the base.
+     * */
+    int open(std::string_view target) const;
+
+private:
+    int baseFd;
+    std::string canonicalBase;
+};
+
 #endif //ZALICZENIOWE1_PATHUTILS_H
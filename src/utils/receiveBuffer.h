@@ -0,0 +1,79 @@
+#ifndef ZALICZENIOWE1_RECEIVEBUFFER_H
+#define ZALICZENIOWE1_RECEIVEBUFFER_H
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+/*
+ * Growable byte buffer with separate read and write cursors. Consumed bytes are only
+ * skipped; unread bytes are moved back to the front when more room is needed, so the
+ * unread part is always contiguous and can be handed out as string_views.
+ * Views are invalidated by prepare().
+ * */
+class ReceiveBuffer {
+public:
+    explicit ReceiveBuffer(size_t initialCapacity = 4096) :
+            storage(std::make_unique<char[]>(initialCapacity)), capacity(initialCapacity) {}
+
+    const char *data() const {
+        return storage.get() + readPos;
+    }
+
+    size_t size() const {
+        return writePos - readPos;
+    }
+
+    bool empty() const {
+        return readPos == writePos;
+    }
+
+    std::string_view view(size_t offset, size_t length) const {
+        return std::string_view(data() + offset, length);
+    }
+
+    // Returns place for at least minSpace bytes after the unread ones.
+    char *prepare(size_t minSpace) {
+        if (capacity - writePos >= minSpace) {
+            return storage.get() + writePos;
+        }
+        size_t unread = size();
+        if (unread + minSpace <= capacity && readPos > 0) {
+            memmove(storage.get(), data(), unread);
+        } else {
+            size_t newCapacity = std::max(capacity * 2, unread + minSpace);
+            std::unique_ptr<char[]> grown = std::make_unique<char[]>(newCapacity);
+            memcpy(grown.get(), data(), unread);
+            storage = std::move(grown);
+            capacity = newCapacity;
+        }
+        readPos = 0;
+        writePos = unread;
+        return storage.get() + writePos;
+    }
+
+    void commit(size_t written) {
+        writePos += written;
+    }
+
+    void consume(size_t bytes) {
+        readPos += bytes;
+        if (readPos == writePos) {
+            readPos = writePos = 0;
+        }
+    }
+
+    void append(std::string_view bytes) {
+        memcpy(prepare(bytes.size()), bytes.data(), bytes.size());
+        commit(bytes.size());
+    }
+
+private:
+    std::unique_ptr<char[]> storage;
+    size_t capacity;
+    size_t readPos = 0;
+    size_t writePos = 0;
+};
+
+#endif //ZALICZENIOWE1_RECEIVEBUFFER_H
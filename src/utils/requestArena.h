@@ -0,0 +1,116 @@
+#ifndef ZALICZENIOWE1_REQUESTARENA_H
+#define ZALICZENIOWE1_REQUESTARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Bump allocator for data which lives as long as a single request, e.g. parsed header fields.
+ * Everything is freed at once by reset(). Blocks are kept across resets, so after the first few
+ * requests of a connection have grown the arena to fit, later requests don't allocate at all.
+ * Only trivially destructible objects may be placed in it, as no destructor is ever called.
+ * */
+class RequestArena {
+public:
+    explicit RequestArena(size_t blockSize = 4096) : blockSize(blockSize) {}
+
+    RequestArena(const RequestArena &) = delete;
+
+    RequestArena &operator=(const RequestArena &) = delete;
+
+    void *allocate(size_t size, size_t alignment) {
+        while (current < blocks.size()) {
+            Block &block = blocks[current];
+            auto base = reinterpret_cast<uintptr_t>(block.memory.get());
+            size_t aligned = ((base + offset + alignment - 1) & ~(alignment - 1)) - base;
+            if (aligned + size <= block.size) {
+                offset = aligned + size;
+                return block.memory.get() + aligned;
+            }
+            current++;
+            offset = 0;
+        }
+        size_t newSize = std::max(blocks.empty() ? blockSize : blocks.back().size * 2, size + alignment);
+        blocks.push_back(Block{std::make_unique<char[]>(newSize), newSize});
+        current = blocks.size() - 1;
+        offset = 0;
+        return allocate(size, alignment);
+    }
+
+    template<typename T>
+    T *allocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena never calls destructors.");
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    std::string_view copy(std::string_view s) {
+        char *data = allocateArray<char>(s.size());
+        std::copy(s.begin(), s.end(), data);
+        return std::string_view(data, s.size());
+    }
+
+    // Invalidates everything allocated so far; the memory is handed out again.
+    void reset() {
+        current = 0;
+        offset = 0;
+    }
+
+    size_t capacity() const {
+        size_t total = 0;
+        for (const Block &block : blocks) {
+            total += block.size;
+        }
+        return total;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> memory;
+        size_t size;
+    };
+
+    size_t blockSize;
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t offset = 0;
+};
+
+// Array placed in an arena (or any other memory outliving it), seen as a range.
+template<typename T>
+class ArenaArray {
+public:
+    ArenaArray() = default;
+
+    ArenaArray(T *data, size_t count) : elements(data), count(count) {}
+
+    T *begin() const {
+        return elements;
+    }
+
+    T *end() const {
+        return elements + count;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    T &operator[](size_t i) const {
+        return elements[i];
+    }
+
+private:
+    T *elements = nullptr;
+    size_t count = 0;
+};
+
+#endif //ZALICZENIOWE1_REQUESTARENA_H
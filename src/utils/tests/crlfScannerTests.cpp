@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+#include "../crlfScanner.h"
+
+namespace {
+    const char *naiveFindCrlf(const std::string &s) {
+        size_t pos = s.find("\r\n");
+        return pos == std::string::npos ? nullptr : s.data() + pos;
+    }
+}
+
+TEST(crlf_scanning, simple) {
+    std::string s = "GET / HTTP/1.1\r\n\r\n";
+    ASSERT_EQ(findCrlf(s.data(), s.data() + s.size()), s.data() + 14);
+    ASSERT_EQ(findCrlf(s.data(), s.data() + 15), nullptr);
+    ASSERT_EQ(findCrlf(s.data(), s.data()), nullptr);
+}
+
+TEST(crlf_scanning, matches_naive_search) {
+    std::mt19937 gen(7);
+    const std::string alphabet = "ab\r\n";
+    for (int i = 0; i < 5000; i++) {
+        std::string s(gen() % 130, 'x');
+        size_t specials = gen() % 4;
+        for (size_t j = 0; j < specials && !s.empty(); j++) {
+            s[gen() % s.size()] = alphabet[gen() % alphabet.size()];
+        }
+        if (s.size() >= 2 && gen() % 2) {
+            s.replace(gen() % (s.size() - 1), 2, "\r\n");
+        }
+        ASSERT_EQ(findCrlf(s.data(), s.data() + s.size()), naiveFindCrlf(s)) << i;
+        ASSERT_EQ(findCrlfScalar(s.data(), s.data() + s.size()), naiveFindCrlf(s)) << i;
+    }
+}
@@ -0,0 +1,88 @@
+#include "../gzipCompressor.h"
+#include "../httpEncodings.h"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+namespace {
+    std::vector<std::string_view> names(const httpEncodings::AcceptedCodings &codings) {
+        std::vector<std::string_view> result;
+        for (const httpEncodings::Coding &coding : codings) {
+            result.push_back(coding.name);
+        }
+        return result;
+    }
+
+    std::string gunzip(const std::string &compressed) {
+        z_stream stream{};
+        EXPECT_EQ(inflateInit2(&stream, 15 + 16), Z_OK);
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
+        stream.avail_in = compressed.size();
+        std::string result;
+        char buffer[4096];
+        int status;
+        do {
+            stream.next_out = reinterpret_cast<Bytef *>(buffer);
+            stream.avail_out = sizeof(buffer);
+            status = inflate(&stream, Z_NO_FLUSH);
+            result.append(buffer, sizeof(buffer) - stream.avail_out);
+        } while (status == Z_OK);
+        EXPECT_EQ(status, Z_STREAM_END);
+        inflateEnd(&stream);
+        return result;
+    }
+}
+
+TEST(Encoding_negotiation, quality_values) {
+    ASSERT_EQ(httpEncodings::qualityOf("gzip, deflate, br", "gzip"), 1000);
+    ASSERT_EQ(httpEncodings::qualityOf("deflate;q=0.5, gzip;q=0.25", "gzip"), 250);
+    ASSERT_EQ(httpEncodings::qualityOf("x-gzip", "gzip"), 1000);
+    ASSERT_EQ(httpEncodings::qualityOf("*;q=0.1, gzip;q=0", "gzip"), 0);
+    ASSERT_EQ(httpEncodings::qualityOf("*;q=0.1", "zstd"), 100);
+    ASSERT_EQ(httpEncodings::qualityOf("identity", "gzip"), 0);
+    ASSERT_EQ(httpEncodings::qualityOf("", "gzip"), 0);
+}
+
+TEST(Encoding_negotiation, malformed_quality_is_ignored) {
+    ASSERT_EQ(httpEncodings::qualityOf("gzip;q=2", "gzip"), 0);
+    ASSERT_EQ(httpEncodings::qualityOf("gzip;q=0.5x", "gzip"), 0);
+    ASSERT_EQ(httpEncodings::qualityOf("gzip;level=9", "gzip"), 0);
+    ASSERT_EQ(httpEncodings::qualityOf("gzip;q=1.001, *", "gzip"), 1000);
+}
+
+TEST(Encoding_negotiation, preference_order) {
+    ASSERT_EQ(names(httpEncodings::acceptedCodings("gzip, zstd")), std::vector<std::string_view>({"zstd", "gzip"}));
+    ASSERT_EQ(names(httpEncodings::acceptedCodings("gzip, zstd;q=0.5")),
+              std::vector<std::string_view>({"gzip", "zstd"}));
+    ASSERT_EQ(names(httpEncodings::acceptedCodings("br, deflate")), std::vector<std::string_view>());
+}
+
+TEST(Gzip_compression, round_trip) {
+    std::string text;
+    for (int i = 0; i < 1000; i++) {
+        text += "line " + std::to_string(i % 17) + " of a text-heavy file\n";
+    }
+    std::optional<std::string> compressed = gzipCompress(text, text.size());
+    ASSERT_TRUE(compressed);
+    ASSERT_LT(compressed->size(), text.size() / 5);
+    ASSERT_EQ(gunzip(*compressed), text);
+
+    FILE *file = tmpfile();
+    ASSERT_EQ(fwrite(text.data(), 1, text.size(), file), text.size());
+    fflush(file);
+    std::optional<std::string> fromFile = gzipCompressFile(fileno(file), text.size(), text.size());
+    fclose(file);
+    ASSERT_TRUE(fromFile);
+    ASSERT_EQ(gunzip(*fromFile), text);
+}
+
+TEST(Gzip_compression, gives_up_when_output_is_too_big) {
+    std::string noise;
+    uint32_t state = 12345;
+    for (int i = 0; i < 100000; i++) {
+        state = state * 1103515245 + 12345;
+        noise += static_cast<char>(state >> 24);
+    }
+    ASSERT_FALSE(gzipCompress(noise, noise.size() - noise.size() / 10));
+    ASSERT_TRUE(gzipCompress(noise, noise.size() + 1024));
+}
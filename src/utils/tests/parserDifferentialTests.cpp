@@ -0,0 +1,114 @@
+#include "../httpParsers.h"
+
+#include <random>
+#include <regex>
+#include <gtest/gtest.h>
+
+/*
+ * Regex based parsers the hand-written ones replaced. Both are run on the same inputs
+ * and have to agree on every accepted and rejected string.
+ * */
+namespace reference {
+    struct StartLineResult {
+        std::string method, target;
+        bool validChars;
+    };
+
+    std::optional<StartLineResult> validateStartLine(const std::string &s) {
+        const std::regex startlineRegex(R"regex((\w+) ([/]([^ ]*)) (HTTP/1[.]1))regex");
+        const std::regex validTarget("[/][a-zA-Z0-9./-]*");
+        std::smatch m, tmp;
+        if (!std::regex_match(s, m, startlineRegex)) {
+            return {};
+        }
+        std::string target = m[2];
+        return StartLineResult{m[1], target, std::regex_match(target, tmp, validTarget)};
+    }
+
+    std::optional<std::pair<std::string, std::string>> validateHeaderField(const std::string &s) {
+        const std::regex headerFieldRegex(R"regex(([^\s:]+):( *)(.+?)( *))regex");
+        std::cmatch m;
+        if (!std::regex_match(s.c_str(), m, headerFieldRegex)) {
+            return {};
+        }
+        std::string name = m[1];
+        std::string value = m[3];
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+        return std::make_pair(name, value);
+    }
+}
+
+namespace {
+    std::vector<std::string> existingCases() {
+        return {"GET /pliK1/2 HTTP/1.1", "HEAD /plik HTTP/1,1", "HEAD  /plik HTTP/1.1", "HEAD /plik? HTTP/1.1",
+                "HEAD plik HTTP/1.1", "Content-Length:  0  ", "connection:close", "ala makota", "ala : makota",
+                "content-length:  12", "GET /plik HTTP/1.1", "Content-Length: 0", "Server: spaaaam",
+                "Server: spaaaam2", "Connection: close", "Connection: 12"};
+    }
+
+    std::vector<std::string> randomCases(size_t count) {
+        static const std::string alphabet = "aZ_9:/ .-?\t\r\n\vHTP1GETcl,";
+        static const std::vector<std::string> seeds = {"GET /a/b.c HTTP/1.1", "X-Name:  Value  ", "a:", "a: ",
+                                                       "Connection:   ", "HEAD / HTTP/1.1"};
+        std::mt19937 gen(2137);
+        std::vector<std::string> result;
+        for (size_t i = 0; i < count; i++) {
+            std::string s = seeds[gen() % seeds.size()];
+            size_t mutations = gen() % 4;
+            for (size_t j = 0; j < mutations; j++) {
+                size_t pos = gen() % (s.size() + 1);
+                char c = alphabet[gen() % alphabet.size()];
+                switch (gen() % 3) {
+                    case 0:
+                        s.insert(s.begin() + pos, c);
+                        break;
+                    case 1:
+                        if (pos < s.size()) s[pos] = c;
+                        break;
+                    default:
+                        if (pos < s.size()) s.erase(pos, 1);
+                }
+            }
+            result.push_back(s);
+        }
+        return result;
+    }
+
+    void expectSameStartLine(const std::string &s) {
+        auto expected = reference::validateStartLine(s);
+        auto actual = StartLine::validateString(s);
+        ASSERT_EQ(expected.has_value(), actual.has_value()) << '"' << s << '"';
+        if (expected) {
+            ASSERT_EQ(expected->method, actual->getMethod()) << s;
+            ASSERT_EQ(expected->target, actual->getRequestTarget()) << s;
+            ASSERT_EQ(expected->validChars, actual->validCharacters()) << s;
+            ASSERT_EQ(actual->getHttpVersion(), "HTTP/1.1");
+        }
+    }
+
+    void expectSameHeaderField(const std::string &s) {
+        auto expected = reference::validateHeaderField(s);
+        RequestArena arena;
+        auto actual = HeaderField::validateString(s, arena);
+        ASSERT_EQ(expected.has_value(), actual.has_value()) << '"' << s << '"';
+        if (expected) {
+            ASSERT_EQ(expected->first, actual->getName()) << s;
+            ASSERT_EQ(expected->second, actual->getValue()) << s;
+        }
+    }
+}
+
+TEST(Differential_parsing, existing_cases) {
+    for (const std::string &s : existingCases()) {
+        expectSameStartLine(s);
+        expectSameHeaderField(s);
+    }
+}
+
+TEST(Differential_parsing, mutated_cases) {
+    for (const std::string &s : randomCases(3000)) {
+        expectSameStartLine(s);
+        expectSameHeaderField(s);
+    }
+}
@@ -33,12 +33,13 @@ TEST(Startline_parsing, no_backslash_in_path) {
 }
 
 TEST(HeaderField_parsing, simple) {
-    std::optional<HeaderField> res = HeaderField::validateString("Content-Length:  0  ");
+    RequestArena arena;
+    std::optional<HeaderField> res = HeaderField::validateString("Content-Length:  0  ", arena);
     ASSERT_TRUE(res);
     ASSERT_EQ(res.value().getName(), "content-length");
     ASSERT_EQ(res.value().getValue(), "0");
     ASSERT_FALSE(res.value().isIgnored());
-    std::optional<HeaderField> res2 = HeaderField::validateString("connection:close");
+    std::optional<HeaderField> res2 = HeaderField::validateString("connection:close", arena);
     ASSERT_TRUE(res2);
     ASSERT_EQ(res2.value().getName(), "connection");
     ASSERT_EQ(res2.value().getValue(), "close");
@@ -46,34 +47,55 @@ TEST(HeaderField_parsing, simple) {
 }
 
 TEST(HeaderField_parsing, missing_colon) {
-    std::optional<HeaderField> res = HeaderField::validateString("ala makota");
+    RequestArena arena;
+    std::optional<HeaderField> res = HeaderField::validateString("ala makota", arena);
     ASSERT_FALSE(res);
 }
 
 TEST(HeaderField_parsing, whitespace_error) {
-    std::optional<HeaderField> res = HeaderField::validateString("ala : makota");
+    RequestArena arena;
+    std::optional<HeaderField> res = HeaderField::validateString("ala : makota", arena);
     ASSERT_FALSE(res);
 }
 
 TEST(RequestHeaderField_parsing, invalid_content_length) {
-    std::optional<HeaderField> res = HeaderField::validateRequestString("content-length:  12");
+    RequestArena arena;
+    std::optional<HeaderField> res = HeaderField::validateRequestString("content-length:  12", arena);
     ASSERT_FALSE(res);
 }
 
 TEST(HttpMessage_parsing, simple) {
+    RequestArena arena;
     std::optional<HttpMessage> res = HttpMessage::validateHttpRequest({"GET /plik HTTP/1.1",
                                                                        "Content-Length: 0",
                                                                        "Server: spaaaam",
                                                                        "Server: spaaaam2",
-                                                                       "Connection: close"});
+                                                                       "Connection: close"}, arena);
     ASSERT_TRUE(res);
     ASSERT_EQ(res.value().getHeaderFields().size(), 2);
     ASSERT_TRUE(res.value().getStartLine().getMethod() == "GET");
 }
 
 TEST(HttpMessage_parsing, duplicated) {
+    RequestArena arena;
     std::optional<HttpMessage> res = HttpMessage::validateHttpRequest({"GET /plik HTTP/1.1",
                                                                        "Connection: 12",
-                                                                       "Connection: close"});
+                                                                       "Connection: close"}, arena);
     ASSERT_FALSE(res);
 }
+
+TEST(HttpMessage_parsing, repeated_list_fields_are_joined) {
+    RequestArena arena;
+    std::optional<HttpMessage> res = HttpMessage::validateHttpRequest({"GET /plik HTTP/1.1",
+                                                                       "Accept-Encoding: gzip",
+                                                                       "If-None-Match: \"a\"",
+                                                                       "Accept-Encoding: ZSTD;q=0.5",
+                                                                       "If-None-Match: \"b\""}, arena);
+    ASSERT_TRUE(res);
+    ASSERT_EQ(res.value().getHeaderFields().size(), 2);
+    ASSERT_EQ(res.value().findHeaderField("accept-encoding")->getValue(), "gzip, zstd;q=0.5");
+    ASSERT_EQ(res.value().findHeaderField("if-none-match")->getValue(), "\"a\", \"b\"");
+    // Fields with a single value still can't be repeated.
+    ASSERT_FALSE(HttpMessage::validateHttpRequest({"GET /plik HTTP/1.1", "Range: bytes=0-1", "Range: bytes=2-3"},
+                                                  arena));
+}
@@ -1,4 +1,9 @@
 #include <gtest/gtest.h>
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "../pathUtils.h"
 
 TEST(malicious, detected) {
@@ -11,3 +16,47 @@ TEST(pathOK, ok) {
     ASSERT_TRUE(validatePath("/tmp", "/plik"));
     ASSERT_TRUE(validatePath("/tmp", "/katalog/../plik"));
 }
+
+TEST(pathOK, lexical) {
+    ASSERT_TRUE(escapesLexically("/.."));
+    ASSERT_TRUE(escapesLexically("/a/../../b"));
+    ASSERT_FALSE(escapesLexically("/a/../b"));
+    ASSERT_FALSE(escapesLexically("/a/..b"));
+}
+
+TEST(resolver, confined) {
+    char dirTemplate[] = "/tmp/resolverTestXXXXXX";
+    std::string dir = mkdtemp(dirTemplate);
+    mkdir((dir + "/base").c_str(), 0700);
+    mkdir((dir + "/base/sub").c_str(), 0700);
+    close(open((dir + "/base/sub/plik").c_str(), O_CREAT | O_WRONLY, 0600));
+    close(open((dir + "/secret").c_str(), O_CREAT | O_WRONLY, 0600));
+    ASSERT_EQ(symlink((dir + "/secret").c_str(), (dir + "/base/outside").c_str()), 0);
+    ASSERT_EQ(symlink("sub/plik", (dir + "/base/inside").c_str()), 0);
+    ASSERT_EQ(symlink((dir + "/base/sub/plik").c_str(), (dir + "/base/absoluteInside").c_str()), 0);
+    ASSERT_EQ(symlink((dir + "/base/sub").c_str(), (dir + "/base/absoluteSub").c_str()), 0);
+
+    PathResolver resolver(dir + "/base");
+    int fd = resolver.open("/sub/plik");
+    ASSERT_GE(fd, 0);
+    close(fd);
+    fd = resolver.open("/inside");
+    ASSERT_GE(fd, 0);
+    close(fd);
+    // Absolute links pointing inside are served as well.
+    for (const char *target : {"/absoluteInside", "/absoluteSub/plik"}) {
+        fd = resolver.open(target);
+        ASSERT_GE(fd, 0) << target;
+        close(fd);
+    }
+    ASSERT_EQ(resolver.open("/absoluteSub/missing"), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(resolver.open("/missing"), -1);
+    ASSERT_EQ(errno, ENOENT);
+    ASSERT_EQ(resolver.open("/sub/../../secret"), -1);
+    ASSERT_EQ(errno, EXDEV);
+    ASSERT_EQ(resolver.open("/outside"), -1);
+    ASSERT_EQ(errno, EXDEV);
+
+    std::filesystem::remove_all(dir);
+}
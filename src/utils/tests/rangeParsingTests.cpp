@@ -0,0 +1,68 @@
+#include "../httpRanges.h"
+
+#include <gtest/gtest.h>
+
+using httpRanges::ByteRange;
+
+TEST(Range_parsing, single_ranges) {
+    auto res = httpRanges::parseRange("bytes=0-99", 1000);
+    ASSERT_TRUE(res);
+    ASSERT_EQ(*res, std::vector<ByteRange>({{0, 99}}));
+    ASSERT_EQ(*httpRanges::parseRange("bytes=900-", 1000), std::vector<ByteRange>({{900, 999}}));
+    ASSERT_EQ(*httpRanges::parseRange("bytes=-100", 1000), std::vector<ByteRange>({{900, 999}}));
+    ASSERT_EQ(*httpRanges::parseRange("bytes=-5000", 1000), std::vector<ByteRange>({{0, 999}}));
+    ASSERT_EQ(*httpRanges::parseRange("bytes=990-5000", 1000), std::vector<ByteRange>({{990, 999}}));
+}
+
+TEST(Range_parsing, multiple_ranges) {
+    auto res = httpRanges::parseRange("bytes=0-0, 5-7 ,-1", 10);
+    ASSERT_TRUE(res);
+    ASSERT_EQ(*res, std::vector<ByteRange>({{0, 0}, {5, 7}, {9, 9}}));
+}
+
+TEST(Range_parsing, overlapping_ranges_are_coalesced) {
+    std::string repeated = "bytes=0-";
+    for (int i = 1; i < 32; i++) {
+        repeated += ",0-";
+    }
+    ASSERT_EQ(*httpRanges::parseRange(repeated, 1000), std::vector<ByteRange>({{0, 999}}));
+    ASSERT_EQ(*httpRanges::parseRange("bytes=-1,0-0,5-9,1-3,-100", 1000),
+              std::vector<ByteRange>({{0, 3}, {5, 9}, {900, 999}}));
+    // Adjacent ones too.
+    ASSERT_EQ(*httpRanges::parseRange("bytes=10-19,0-9,30-39", 1000), std::vector<ByteRange>({{0, 19}, {30, 39}}));
+}
+
+TEST(Range_parsing, unsatisfiable) {
+    auto res = httpRanges::parseRange("bytes=1000-", 1000);
+    ASSERT_TRUE(res);
+    ASSERT_TRUE(res->empty());
+    ASSERT_TRUE(httpRanges::parseRange("bytes=-0", 1000)->empty());
+    ASSERT_TRUE(httpRanges::parseRange("bytes=0-10", 0)->empty());
+}
+
+TEST(Range_parsing, malformed_is_ignored) {
+    ASSERT_FALSE(httpRanges::parseRange("items=0-1", 10));
+    ASSERT_FALSE(httpRanges::parseRange("bytes=", 10));
+    ASSERT_FALSE(httpRanges::parseRange("bytes=5-1", 10));
+    ASSERT_FALSE(httpRanges::parseRange("bytes=a-1", 10));
+    ASSERT_FALSE(httpRanges::parseRange("bytes=1", 10));
+    std::string many = "bytes=0-0";
+    for (int i = 0; i < 40; i++) {
+        many += ",0-0";
+    }
+    ASSERT_FALSE(httpRanges::parseRange(many, 10));
+}
+
+TEST(Http_date, round_trip) {
+    ASSERT_EQ(httpRanges::formatHttpDate(784111777), "Sun, 06 Nov 1994 08:49:37 GMT");
+    ASSERT_EQ(httpRanges::parseHttpDate("sun, 06 nov 1994 08:49:37 gmt"), std::optional<time_t>(784111777));
+    ASSERT_FALSE(httpRanges::parseHttpDate("sunday, 06-nov-94 08:49:37 gmt"));
+    ASSERT_FALSE(httpRanges::parseHttpDate("sun, 06 xyz 1994 08:49:37 gmt"));
+}
+
+TEST(Etag_matching, weak_comparison) {
+    ASSERT_TRUE(httpRanges::matchesAnyEtag("\"a-1\"", "\"a-1\""));
+    ASSERT_TRUE(httpRanges::matchesAnyEtag("\"x\", w/\"a-1\"", "\"a-1\""));
+    ASSERT_TRUE(httpRanges::matchesAnyEtag("*", "\"a-1\""));
+    ASSERT_FALSE(httpRanges::matchesAnyEtag("\"a-2\"", "\"a-1\""));
+}
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+#include "../httpResponses.h"
+
+using httpResponses::BodyFraming;
+
+TEST(response_head_parsing, drops_hop_by_hop_fields) {
+    auto head = httpResponses::parseHead("HTTP/1.1 200 OK\r\nConnection: Keep-Alive\r\nKeep-Alive: timeout=5\r\n"
+                                         "Content-Length: 5\r\nETag: \"x\"\r\n\r\n", false);
+    ASSERT_TRUE(head);
+    ASSERT_EQ(head->statusCode, "200");
+    ASSERT_TRUE(head->keepAlive);
+    ASSERT_EQ(head->framing.getKind(), BodyFraming::Kind::Length);
+    ASSERT_EQ(head->forwarded, "HTTP/1.1 200 OK\r\nETag: \"x\"\r\nContent-Length: 5\r\n\r\n");
+
+    head = httpResponses::parseHead("HTTP/1.1 404 Not Found\r\nconnection: close\r\ncontent-length: 0\r\n\r\n", false);
+    ASSERT_FALSE(head->keepAlive);
+    ASSERT_TRUE(head->framing.isDone());
+    // HTTP/1.0 only keeps the connection when asked to.
+    ASSERT_FALSE(httpResponses::parseHead("HTTP/1.0 200 OK\r\nContent-Length: 1\r\n\r\n", false)->keepAlive);
+}
+
+TEST(response_head_parsing, body_framing) {
+    auto head = httpResponses::parseHead("HTTP/1.1 200 OK\r\nContent-Length: 9\r\n"
+                                         "Transfer-Encoding: chunked\r\n\r\n", false);
+    ASSERT_EQ(head->framing.getKind(), BodyFraming::Kind::Chunked);
+    ASSERT_EQ(head->forwarded, "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n");
+
+    head = httpResponses::parseHead("HTTP/1.1 200 OK\r\n\r\n", false);
+    ASSERT_EQ(head->framing.getKind(), BodyFraming::Kind::UntilClose);
+    ASSERT_FALSE(head->keepAlive);
+    ASSERT_EQ(head->forwarded, "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n");
+
+    // Responses to HEAD, 204 and 304 have no body whatever the head says.
+    ASSERT_TRUE(httpResponses::parseHead("HTTP/1.1 200 OK\r\nContent-Length: 7\r\n\r\n", true)->framing.isDone());
+    ASSERT_TRUE(httpResponses::parseHead("HTTP/1.1 304 Not Modified\r\n\r\n", false)->framing.isDone());
+}
+
+TEST(response_head_parsing, malformed) {
+    ASSERT_FALSE(httpResponses::parseHead("HTTP/1.1 100 Continue\r\n\r\n", false));
+    ASSERT_FALSE(httpResponses::parseHead("HTTP/2 200 OK\r\n\r\n", false));
+    ASSERT_FALSE(httpResponses::parseHead("HTTP/1.1 2x0 OK\r\n\r\n", false));
+    ASSERT_FALSE(httpResponses::parseHead("HTTP/1.1 200 OK\r\nno colon\r\n\r\n", false));
+    ASSERT_FALSE(httpResponses::parseHead("HTTP/1.1 200 OK\r\nContent-Length: 1\r\nContent-Length: 2\r\n\r\n",
+                                          false));
+}
+
+TEST(body_framing, content_length) {
+    BodyFraming framing(BodyFraming::Kind::Length, 5);
+    ASSERT_EQ(framing.consume("abc"), 3);
+    ASSERT_FALSE(framing.isDone());
+    ASSERT_EQ(framing.consume("deHTTP"), 2);
+    ASSERT_TRUE(framing.isDone());
+}
+
+TEST(body_framing, chunked_split_anywhere) {
+    const std::string body = "4;ext=1\r\nWiki\r\nA\r\n0123456789\r\n0\r\nTrailer: x\r\n\r\n";
+    for (size_t split = 0; split <= body.size(); split++) {
+        BodyFraming framing(BodyFraming::Kind::Chunked, 0);
+        size_t used = framing.consume(body.substr(0, split));
+        ASSERT_EQ(used, split);
+        ASSERT_EQ(framing.consume(body.substr(split) + "next"), body.size() - split) << split;
+        ASSERT_TRUE(framing.isDone());
+        ASSERT_FALSE(framing.isInvalid());
+    }
+}
+
+TEST(body_framing, invalid_chunks) {
+    BodyFraming badSize(BodyFraming::Kind::Chunked, 0);
+    badSize.consume("zz\r\n");
+    ASSERT_TRUE(badSize.isInvalid());
+    BodyFraming missingCrlf(BodyFraming::Kind::Chunked, 0);
+    missingCrlf.consume("1\r\nab\r\n");
+    ASSERT_TRUE(missingCrlf.isInvalid());
+}